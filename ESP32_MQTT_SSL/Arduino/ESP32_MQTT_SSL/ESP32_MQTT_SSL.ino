@@ -4,6 +4,9 @@
 #include <time.h>
 #include <MQTT.h>
 #include "secrets_local.h"
+#if __has_include("certs_der.h")
+#include "certs_der.h" // generated by tools/pem_to_der.py
+#endif
 
 #include <Wire.h>
 #include <SPI.h>
@@ -13,14 +16,77 @@
 #include <esp_wifi.h>
 #include <esp_bt.h>
 #include <CircularBuffer.h>
-#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <atomic>
 
 // Defines
 
+#define TELEMETRY_FORMAT TELEMETRY_FORMAT_JSON /* Payload encoding: TELEMETRY_FORMAT_JSON, _CBOR, _PACKED or _GORILLA */
+
 #define uS_TO_S_FACTOR 1000000 /* Conversion factor for micro seconds to seconds */
 #define TIME_TO_SLEEP 20       /* Time ESP32 will go to sleep (in seconds) */
 
+#define GAS_EVERY_N 6          /* Gas resistance on every Nth reading, or the next one after "gas" arrives on MQTT_SUB_TOPIC */
+#define GAS_HEATER_TEMP 320    /* ºC */
+#define GAS_HEATER_MS 150
+
+#define SENSOR_TASK_CORE 1      /* Sampling runs on the application core */
+#define NETWORK_TASK_CORE 0     /* Archiving and uploads run next to the WiFi stack */
+#define SENSOR_TASK_STACK 4096
+#define NETWORK_TASK_STACK 10240 /* TLS handshakes and payload buffers */
+
+#define WIFI_TIMEOUT_MS 8000      /* Join with scan and DHCP */
+#define WIFI_FAST_TIMEOUT_MS 3000 /* Join the cached access point with the cached lease, then fall back to a scan */
+#define WIFI_LEASE_REFRESH 3600   /* Seconds after DHCP before the lease is fetched again, keep it below the router's lease time */
+#define CLOCK_VALID 1510592825    /* time() beyond this means SNTP has set the clock */
+#define TLS_SESSION_RTC 1         /* Keep the TLS session in RTC memory, so a reset resumes it instead of a full handshake */
+#define TLS_SESSION_BYTES 512     /* Serialised session with ticket */
+
 #define SERIAL_LOG 1 /* Serial log is active or not */
+#define CYCLE_STATS 1 /* Report time and heap use of every wake cycle */
+
+#define BATCH_PUBLISH 1       /* Publish the buffer as JSON arrays instead of one message per record */
+#define BATCH_MAX_RECORDS 50  /* Records per batch message */
+#define BATCH_MAX_BYTES 1536  /* Payload per batch message; with topic and header it fits one 2048 byte TLS record */
+#if (BATCH_PUBLISH == 1)
+#define RECORDS_PER_MESSAGE BATCH_MAX_RECORDS
+#define PAYLOAD_MAX_BYTES BATCH_MAX_BYTES
+#else
+#define RECORDS_PER_MESSAGE 1
+#define PAYLOAD_MAX_BYTES 200
+#endif
+
+#define SAMPLE_BUFFER_SIZE 300  /* Readings kept uncompressed, 12 bytes each */
+#define ARCHIVE_THRESHOLD 250   /* Buffered readings before the oldest are compressed into an archive block */
+#define ARCHIVE_BLOCKS 20       /* Compressed blocks, about 50 readings each */
+#define ARCHIVE_BLOCK_BYTES 512
+#define UPLOAD_SCHEDULER 1         /* Upload only when one of the limits below is hit, radio off in between */
+#define UPLOAD_MIN_RECORDS 60      /* Buffered readings that make an upload due */
+#define UPLOAD_MAX_AGE 900         /* Seconds the oldest unsent reading may wait */
+#define UPLOAD_TEMPERATURE_DELTA 1.0 /* Change in ºC since the last upload that is sent right away */
+#define UPLOAD_RETRY_INTERVAL 300  /* Seconds before trying again after a failed upload */
+#define MQTT_CONNECT_ATTEMPTS 3    /* Broker connection attempts per upload before giving up on it */
+
+#define FLASH_LOG 1             /* Spill archive blocks to flash when the archive is full, instead of dropping them */
+#define FLASH_LOG_PARTITION "spiffs" /* Raw data partition for it, its contents are overwritten */
+
+#if (PAYLOAD_MAX_BYTES > ARCHIVE_BLOCK_BYTES)
+#define MQTT_BUFFER_SIZE (PAYLOAD_MAX_BYTES + 128)
+#else
+#define MQTT_BUFFER_SIZE (ARCHIVE_BLOCK_BYTES + 128)
+#endif
+
+#include "src/telemetry/telemetry.h"
+#include "src/telemetry/spsc_ring.h"
+#include "src/telemetry/gas_schedule.h"
+#if (UPLOAD_SCHEDULER == 1)
+#include "src/telemetry/upload_policy.h"
+#endif
+#if (FLASH_LOG == 1)
+#include "src/storage/flash_log.h"
+#endif
 
 #ifndef SECRET
 const char ssid[] = "WiFiSSID";
@@ -75,26 +141,109 @@ const char *local_root_ca =
 
 const char MQTT_SUB_TOPIC[] = LOCATION "/" HOSTNAME "/in";
 const char MQTT_PUB_TOPIC[] = LOCATION "/" HOSTNAME "/out";
+const char MQTT_ARCHIVE_TOPIC[] = LOCATION "/" HOSTNAME "/out/gorilla"; // binary blocks, kept off the TELEMETRY_FORMAT topic
 
 // Structs
 
-struct sensor_data
+// Gorilla compressed readings, published as is once the broker is reachable
+struct archive_block
 {
-  time_t timestamp;
-  float temperature;
-  float humidity;
-  float pressure;
-  float gasResistance;
+  uint16_t length;
+  uint8_t data[ARCHIVE_BLOCK_BYTES];
 };
 
+// Access point and DHCP lease of the last full join, for joining without scan and DHCP
+struct wifi_cache
+{
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t obtained; // time() of the DHCP exchange, 0 until the clock was set
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t check;
+};
+
+#define WIFI_CACHE_MAGIC 0x57494649 // "WIFI"
+
+#if (TLS_SESSION_RTC == 1)
+// TLS session of the last connection, offered for resumption after a reset
+struct tls_session_cache
+{
+  uint32_t magic;
+  uint16_t length;
+  uint8_t data[TLS_SESSION_BYTES];
+  uint32_t check;
+};
+
+#define TLS_SESSION_MAGIC 0x544c5353 // "TLSS"
+#endif
+
 // Global variables
 
 WiFiClientSecure net;
-MQTTClient client;
+MQTTClient client(MQTT_BUFFER_SIZE);
 Adafruit_BME680 bme; // I2C
-CircularBuffer<sensor_data, 600> sensor_data_buffer;
+SpscRing<packed_sensor_data, SAMPLE_BUFFER_SIZE> sensor_data_buffer; // sensor task -> network task
+CircularBuffer<archive_block, ARCHIVE_BLOCKS> archive_buffer;
+TelemetryEncoder encoder;
+RTC_NOINIT_ATTR wifi_cache wifi_cached; // kept through sleep and resets, garbage after power on
+bool wifi_fast_joined = false;          // the current link uses the cached lease
+#if (TLS_SESSION_RTC == 1)
+RTC_NOINIT_ATTR tls_session_cache tls_session_cached;
+#endif
+#if (FLASH_LOG == 1)
+FlashLog flash_log;
+bool flash_log_ready = false;
+#endif
+
+time_t now; // network task
 
-time_t now;
+TaskHandle_t loop_task;
+TaskHandle_t sensor_task;
+TaskHandle_t network_task;
+uint32_t samples_requested = 0;            // loop(), one per wake
+std::atomic<uint32_t> samples_taken{0};    // sensor task
+std::atomic<uint32_t> samples_handled{0};  // network task, samples_taken it has caught up with
+GasSchedule gas_schedule(GAS_EVERY_N);     // requested over MQTT, followed by the sensor task
+
+bool wifi_connect();
+void tls_session_store();
+void tls_session_restore();
+void sensor_task_main(void *);
+void network_task_main(void *);
+
+#if (UPLOAD_SCHEDULER == 1)
+const upload_policy upload_limits = {UPLOAD_MIN_RECORDS, UPLOAD_MAX_AGE, (int16_t)(UPLOAD_TEMPERATURE_DELTA * 100)};
+int16_t uploaded_temperature = SAMPLE_NONE_SIGNED; // packed, none until the first upload
+time_t retry_after = 0;
+#endif
+
+#if (CYCLE_STATS == 1)
+struct cycle_stats
+{
+  unsigned long start_us;
+  unsigned long sensor_us;
+  unsigned long connect_us;
+  unsigned long send_us;
+  // Phase trace, ms since the wake; 0 if the phase didn't happen
+  unsigned long conversion_ms;
+  unsigned long wifi_ms;
+  unsigned long mqtt_ms;
+  unsigned long reading_ms;
+  unsigned long published_ms;
+  size_t free_bytes;
+  size_t allocated_blocks;
+  uint32_t handshakes;
+};
+
+// Written by loop() and both tasks, so only touched under cycle_lock
+cycle_stats cycle;
+SemaphoreHandle_t cycle_lock;
+StaticSemaphore_t cycle_lock_buffer;
+#endif
 
 // Internal functions
 
@@ -127,27 +276,130 @@ void print_wakeup_reason()
   }
 }
 
+SemaphoreHandle_t serial_lock;
+StaticSemaphore_t serial_lock_buffer;
+
 void setup_serial()
 {
   Serial.begin(115200);
+  serial_lock = xSemaphoreCreateMutexStatic(&serial_lock_buffer);
 }
 
-void print_serial(String msg)
+// printf-style into a static line buffer, so logging never touches the heap.
+// Both tasks log, so the buffer is shared under a mutex.
+void print_serial(const char *format, ...)
 {
-  Serial.println(msg);
+  static char line[256];
+  va_list args;
+
+  xSemaphoreTake(serial_lock, portMAX_DELAY);
+  va_start(args, format);
+  vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  Serial.println(line);
+  xSemaphoreGive(serial_lock);
 }
 #else
 #define print_wakeup_reason()
-#define print_serial(msg)
+#define print_serial(...)
 #define setup_serial()
 #endif
 
+#if (CYCLE_STATS == 1)
+void setup_cycle_stats()
+{
+  cycle_lock = xSemaphoreCreateMutexStatic(&cycle_lock_buffer);
+}
+
+// A network task still busy from the previous wake adds its time to the
+// new cycle: phases count in the cycle they end in
+void cycle_start()
+{
+  multi_heap_info_t info;
+  cycle_stats fresh = {};
+
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  fresh.start_us = micros();
+  fresh.free_bytes = info.total_free_bytes;
+  fresh.allocated_blocks = info.allocated_blocks;
+  fresh.handshakes = net.fullHandshakes() + net.resumedHandshakes();
+
+  xSemaphoreTake(cycle_lock, portMAX_DELAY);
+  cycle = fresh;
+  xSemaphoreGive(cycle_lock);
+}
+
+void cycle_add(unsigned long cycle_stats::*field, unsigned long us)
+{
+  xSemaphoreTake(cycle_lock, portMAX_DELAY);
+  cycle.*field += us;
+  xSemaphoreGive(cycle_lock);
+}
+
+void cycle_set_ms(unsigned long cycle_stats::*field, unsigned long now_us)
+{
+  xSemaphoreTake(cycle_lock, portMAX_DELAY);
+  cycle.*field = (now_us - cycle.start_us) / 1000;
+  xSemaphoreGive(cycle_lock);
+}
+
+// One line per wake cycle; heap figures are what the cycle left allocated
+void cycle_report()
+{
+  multi_heap_info_t info;
+  cycle_stats stats;
+
+  xSemaphoreTake(cycle_lock, portMAX_DELAY);
+  stats = cycle;
+  xSemaphoreGive(cycle_lock);
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+
+  print_serial("- Cycle: awake %lu ms (sensor %lu, connect %lu, publish %lu), handshakes %u, heap %+d bytes %+d blocks, min free %u",
+                (micros() - stats.start_us) / 1000,
+                stats.sensor_us / 1000,
+                stats.connect_us / 1000,
+                stats.send_us > stats.connect_us ? (stats.send_us - stats.connect_us) / 1000 : 0,
+                (unsigned)(net.fullHandshakes() + net.resumedHandshakes() - stats.handshakes),
+                (int)(stats.free_bytes - info.total_free_bytes),
+                (int)(info.allocated_blocks - stats.allocated_blocks),
+                (unsigned)info.minimum_free_bytes);
+  print_serial("- Phases (ms): conversion started %lu, wifi %lu, mqtt %lu, reading %lu, published %lu",
+                stats.conversion_ms, stats.wifi_ms, stats.mqtt_ms, stats.reading_ms, stats.published_ms);
+}
+
+#define cycle_measure(field, call)                    \
+  do                                                  \
+  {                                                   \
+    unsigned long t0 = micros();                      \
+    call;                                             \
+    cycle_add(&cycle_stats::field, micros() - t0);    \
+  } while (0)
+
+#define cycle_mark(field) cycle_set_ms(&cycle_stats::field, micros())
+#else
+#define setup_cycle_stats()
+#define cycle_start()
+#define cycle_report()
+#define cycle_measure(field, call) call
+#define cycle_mark(field)
+#endif
+
 void get_BME680_readings()
 {
+  static bool heater_on = true; // as set up in setup()
   sensor_data sensor_data;
 
   print_serial("--\nget_BME680_readings()\n--");
 
+  // Temperature, humidity and pressure are read every time; the gas heater
+  // only runs when a gas reading is due, saving its heating time otherwise
+  bool gas = gas_schedule.next();
+  if (gas != heater_on)
+  {
+    bme.setGasHeater(gas ? GAS_HEATER_TEMP : 0, gas ? GAS_HEATER_MS : 0);
+    heater_on = gas;
+  }
+
   // Tell BME680 to begin measurement.
   unsigned long endTime = bme.beginReading();
   if (endTime == 0)
@@ -155,41 +407,156 @@ void get_BME680_readings()
     print_serial("Failed to begin reading :(");
     return;
   }
+  cycle_mark(conversion_ms);
+
+  // The network task brings WiFi, TLS and MQTT up during the conversion;
+  // waiting here only blocks this task
+  xTaskNotifyGive(network_task);
+  int remaining = bme.remainingReadingMillis();
+  if (remaining > 0)
+  {
+    delay(remaining);
+  }
   if (!bme.endReading())
   {
     print_serial("Failed to complete reading :(");
     return;
   }
 
-  sensor_data.timestamp = now;
+  cycle_mark(reading_ms);
+  sensor_data.timestamp = time(nullptr);
   sensor_data.temperature = bme.temperature;
   sensor_data.pressure = bme.pressure / 100.0;
   sensor_data.humidity = bme.humidity;
-  sensor_data.gasResistance = bme.gas_resistance / 1000.0;
+  sensor_data.gasResistance = gas ? bme.gas_resistance / 1000.0 : NAN;
+  sensor_data.fresh = SENSOR_FRESH_TEMPERATURE | SENSOR_FRESH_HUMIDITY | SENSOR_FRESH_PRESSURE | (gas ? SENSOR_FRESH_GAS : 0);
 
-  Serial.printf("- Temperature = %.2f ºC \n", sensor_data.temperature);
-  Serial.printf("- Humidity = %.2f Percent \n", sensor_data.humidity);
-  Serial.printf("- Pressure = %.2f hPa \n", sensor_data.pressure);
-  Serial.printf("- Gas Resistance = %.2f KOhm \n", sensor_data.gasResistance);
+  print_serial("- Temperature = %.2f ºC ", sensor_data.temperature);
+  print_serial("- Humidity = %.2f Percent ", sensor_data.humidity);
+  print_serial("- Pressure = %.2f hPa ", sensor_data.pressure);
+  if (gas)
+  {
+    print_serial("- Gas Resistance = %.2f KOhm ", sensor_data.gasResistance);
+  }
 
-  sensor_data_buffer.push(sensor_data);
+  if (!sensor_data_buffer.push(pack_sensor_data(sensor_data)))
+  {
+    print_serial("- Buffer full, reading dropped");
+  }
 }
 
-void mqtt_connect()
+// Compresses the oldest buffered readings into an archive block. When the
+// archive is full its oldest block moves to the flash log, or is
+// overwritten without one.
+void archive_sensor_data()
 {
+  archive_block block;
+  GorillaTelemetryEncoder gorilla;
+  uint16_t count;
+
+  gorilla.begin(block.data, sizeof(block.data), true);
+  while (gorilla.count() < sensor_data_buffer.size())
+  {
+    if (!gorilla.add(unpack_sensor_data(sensor_data_buffer[gorilla.count()])))
+    {
+      break;
+    }
+  }
+  block.length = gorilla.end();
+  count = gorilla.count();
+
+  if (archive_buffer.isFull())
+  {
+    const archive_block &oldest = archive_buffer.first();
+#if (FLASH_LOG == 1)
+    if (flash_log_ready && flash_log.append(oldest.data, oldest.length))
+    {
+      print_serial("- Archive full, oldest block moved to flash (%u pending)", (unsigned)flash_log.pending());
+    }
+    else
+#endif
+    {
+      print_serial("- Archive full, dropping the oldest block");
+    }
+  }
+  archive_buffer.push(block);
+  print_serial("- Archived %u readings in %u bytes", count, block.length);
+  while (count-- > 0)
+  {
+    sensor_data_buffer.shift();
+  }
+}
+
+// Brings up TCP and TLS without blocking; the MQTT client then only sends CONNECT
+bool tls_connect()
+{
+  int state;
+
+  net.stop();
+  if (!net.connectAsync(MQTT_HOST, MQTT_PORT))
+  {
+    return false;
+  }
+  while ((state = net.poll()) == SSL_STATE_CONNECTING || state == SSL_STATE_HANDSHAKE)
+  {
+    // Other work can be done here while the handshake is in progress
+    delay(10);
+  }
+  return state == SSL_STATE_CONNECTED;
+}
+
+// Gives up after MQTT_CONNECT_ATTEMPTS, so a broker that is down costs one
+// bounded try per upload instead of keeping the radio on until it is back
+bool mqtt_connect()
+{
+  bool connected = false;
+
   print_serial("- MQTT connecting");
-  while (!client.connect(HOSTNAME, MQTT_USER, MQTT_PASS))
+  cycle_measure(connect_us, {
+    for (int attempt = 1; attempt <= MQTT_CONNECT_ATTEMPTS; attempt++)
+    {
+      if (tls_connect() && client.connect(HOSTNAME, MQTT_USER, MQTT_PASS, true))
+      {
+        connected = true;
+        break;
+      }
+      print_serial("- .");
+      if (attempt < MQTT_CONNECT_ATTEMPTS)
+      {
+        delay(500);
+      }
+    }
+  });
+  if (!connected)
   {
-    print_serial("- .");
-    delay(500);
+    print_serial("- MQTT connection failed after %d attempts", MQTT_CONNECT_ATTEMPTS);
+    net.stop();
+    if (wifi_fast_joined)
+    {
+      // The cached address may be stale or taken by another host, so the
+      // next join asks DHCP
+      print_serial("- Dropping the cached lease");
+      wifi_cached.magic = 0;
+      wifi_fast_joined = false;
+    }
+    return false;
   }
   print_serial("- MQTT connected");
+  cycle_mark(mqtt_ms);
+  tls_session_store();
   client.subscribe(MQTT_SUB_TOPIC);
+  return true;
 }
 
-void messageReceived(String &topic, String &payload)
+// The advanced callback hands over the client's own buffers instead of String copies
+void messageReceived(MQTTClient *client, char topic[], char bytes[], int length)
 {
-  print_serial("- Received [" + topic + "]: " + payload);
+  print_serial("- Received [%s]: %.*s", topic, length, bytes);
+
+  if (length == 3 && memcmp(bytes, "gas", 3) == 0)
+  {
+    gas_schedule.request();
+  }
 }
 
 void setup()
@@ -197,39 +564,80 @@ void setup()
   setCpuFrequencyMhz(80);
 
   setup_serial();
+  setup_cycle_stats();
 
   print_serial("First initialisation");
 
-  print_serial("Attempting to connect to SSID: " + String(ssid));
-  WiFi.setHostname(HOSTNAME);
-  WiFi.mode(WIFI_MODE_STA);
-  WiFi.begin(ssid, pass);
-  while (WiFi.status() != WL_CONNECTED)
+#if (FLASH_LOG == 1)
+  flash_log_ready = flash_log.begin(FLASH_LOG_PARTITION);
+  if (!flash_log_ready)
+  {
+    print_serial("Flash log unavailable, partition %s not found", FLASH_LOG_PARTITION);
+  }
+#endif
+
+  print_serial("Attempting to connect to SSID: %s", ssid);
+  while (!wifi_connect())
   {
     delay(500);
   }
-  print_serial("Connected to " + String(ssid));
+  print_serial("Connected to %s", ssid);
 
   print_serial("Setting time using SNTP ");
   configTime(-5 * 3600, 0, "pool.ntp.org", "time.nist.gov");
   now = time(nullptr);
-  while (now < 1510592825)
+  while (now < CLOCK_VALID)
   {
     delay(500);
     now = time(nullptr);
   }
   struct tm timeinfo;
   gmtime_r(&now, &timeinfo);
-  print_serial("Current time: " + String(ctime(&now)));
+  print_serial("Current time: %s", ctime(&now));
 
+#ifdef LOCAL_ROOT_CA_DER
+  net.setCACert(local_root_ca_der, local_root_ca_der_len);
+#endif
+  net.setWriteCoalescing(true); // one TLS record per MQTT packet
+  net.setMaxFragmentLength(2048); // smaller TLS records, dropped again if the broker refuses
+  net.setTimeouts(3000, 8000, 3000); // connect, handshake, write (ms): give up on a dead broker early
+#if defined(MQTT_PSK_IDENTITY)
+  if (!net.setPreSharedKey(MQTT_PSK_IDENTITY, MQTT_PSK_KEY))
+  {
+    print_serial("MQTT_PSK_IDENTITY or MQTT_PSK_KEY is invalid, check secrets.h!");
+    while (1)
+      ;
+  }
+#elif defined(MQTT_ECDSA_ONLY)
+  net.setCipherProfile(SSL_PROFILE_ECDHE_ECDSA);
+#endif
+#if defined(MQTT_PINNED_KEY)
+  if (!net.setPinnedPublicKey(MQTT_PINNED_KEY)) // checks only the broker's key, no CA chain
+  {
+    print_serial("MQTT_PINNED_KEY is not a valid public key, check secrets.h!");
+    while (1)
+      ;
+  }
+#elif defined(MQTT_FINGERPRINT)
+  if (!net.setFingerprint(MQTT_FINGERPRINT))
+  {
+    print_serial("MQTT_FINGERPRINT is not a valid SHA-1 or SHA-256 fingerprint, check secrets.h!");
+    while (1)
+      ;
+  }
+#endif
+  tls_session_restore(); // after the credentials, setting them forgets the session
   client.begin(MQTT_HOST, MQTT_PORT, net);
-  client.onMessage(messageReceived);
-  mqtt_connect();
+  client.onMessageAdvanced(messageReceived);
+  if (!mqtt_connect())
+  {
+    print_serial("- Broker unreachable, readings are buffered until it is back");
+  }
 
   // Init BME680 sensor
   if (!bme.begin())
   {
-    print_serial(F("Could not find a valid BME680 sensor, check wiring!"));
+    print_serial("Could not find a valid BME680 sensor, check wiring!");
     while (1)
       ;
   }
@@ -238,92 +646,438 @@ void setup()
   bme.setHumidityOversampling(BME680_OS_2X);
   bme.setPressureOversampling(BME680_OS_4X);
   bme.setIIRFilterSize(BME680_FILTER_SIZE_3);
-  bme.setGasHeater(320, 150); // 320*C for 150 ms
+  bme.setGasHeater(GAS_HEATER_TEMP, GAS_HEATER_MS);
+
+  // Sampling and networking each get a core, so a slow handshake doesn't delay readings
+  loop_task = xTaskGetCurrentTaskHandle();
+  xTaskCreatePinnedToCore(network_task_main, "network", NETWORK_TASK_STACK, NULL, 1, &network_task, NETWORK_TASK_CORE);
+  xTaskCreatePinnedToCore(sensor_task_main, "sensor", SENSOR_TASK_STACK, NULL, 2, &sensor_task, SENSOR_TASK_CORE);
+}
+
+// Encodes the oldest records into one message, returns its length
+size_t encode_sensor_data(uint8_t *payload, size_t size)
+{
+  encoder.begin(payload, size, BATCH_PUBLISH == 1);
+  while (encoder.count() < sensor_data_buffer.size() && encoder.count() < RECORDS_PER_MESSAGE)
+  {
+    if (!encoder.add(unpack_sensor_data(sensor_data_buffer[encoder.count()])))
+    {
+      break;
+    }
+  }
+  return encoder.end();
+}
+
+// Tells RTC memory that survived a reset from garbage after power on
+uint32_t rtc_check(const void *data, size_t length)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint32_t hash = 2166136261u; // FNV-1a
+
+  for (size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t wifi_cache_check()
+{
+  return rtc_check(&wifi_cached, offsetof(wifi_cache, check));
+}
+
+bool wifi_cache_valid()
+{
+  return wifi_cached.magic == WIFI_CACHE_MAGIC && wifi_cached.check == wifi_cache_check();
+}
+
+// The lease is used until WIFI_LEASE_REFRESH after it was obtained. One taken
+// before the clock was set is dated on the first join that knows the time.
+bool wifi_lease_current()
+{
+  time_t t = time(nullptr);
+
+  if (t < CLOCK_VALID)
+  {
+    return wifi_cached.obtained == 0;
+  }
+  if (wifi_cached.obtained == 0)
+  {
+    wifi_cached.obtained = t;
+    wifi_cached.check = wifi_cache_check();
+  }
+  return t >= (time_t)wifi_cached.obtained && t - (time_t)wifi_cached.obtained < WIFI_LEASE_REFRESH;
+}
+
+#if (TLS_SESSION_RTC == 1)
+// Light sleep keeps the session in the client; this copy covers resets
+void tls_session_store()
+{
+  size_t length = net.saveSession(tls_session_cached.data, sizeof(tls_session_cached.data));
+
+  tls_session_cached.magic = length > 0 ? TLS_SESSION_MAGIC : 0;
+  tls_session_cached.length = length;
+  tls_session_cached.check = rtc_check(&tls_session_cached, offsetof(tls_session_cache, check));
+}
+
+void tls_session_restore()
+{
+  if (tls_session_cached.magic != TLS_SESSION_MAGIC ||
+      tls_session_cached.check != rtc_check(&tls_session_cached, offsetof(tls_session_cache, check)) ||
+      tls_session_cached.length > sizeof(tls_session_cached.data))
+  {
+    return;
+  }
+  if (net.loadSession(tls_session_cached.data, tls_session_cached.length))
+  {
+    print_serial("- TLS session restored from RTC memory");
+  }
+  else
+  {
+    tls_session_cached.magic = 0;
+  }
+}
+#else
+void tls_session_store() {}
+void tls_session_restore() {}
+#endif
+
+// Waits for an address, logging how long association and getting it took
+bool wifi_wait(unsigned long timeout_ms, bool fast)
+{
+  unsigned long start = millis();
+  unsigned long associated = 0;
+  wifi_ap_record_t ap;
+
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    if (millis() - start >= timeout_ms)
+    {
+      return false;
+    }
+    if (associated == 0 && esp_wifi_sta_get_ap_info(&ap) == ESP_OK)
+    {
+      associated = millis() - start;
+    }
+    delay(10);
+  }
+
+  unsigned long elapsed = millis() - start;
+  if (associated == 0)
+  {
+    associated = elapsed;
+  }
+  print_serial("- Wifi connected (%s): association %lu ms, IP %lu ms",
+               fast ? "cached" : "scan", associated, elapsed - associated);
+  cycle_mark(wifi_ms);
+  return true;
+}
+
+// Joins the access point unless already connected. With a cached access
+// point and a current lease it skips the scan and DHCP; a full join
+// refreshes them.
+bool wifi_connect()
+{
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    return true;
+  }
+
+  WiFi.setHostname(HOSTNAME);
+  WiFi.mode(WIFI_MODE_STA);
+
+  if (wifi_cache_valid() && wifi_lease_current())
+  {
+    WiFi.config(IPAddress(wifi_cached.ip), IPAddress(wifi_cached.gateway), IPAddress(wifi_cached.subnet), IPAddress(wifi_cached.dns));
+    WiFi.begin(ssid, pass, wifi_cached.channel, wifi_cached.bssid);
+    if (wifi_wait(WIFI_FAST_TIMEOUT_MS, true))
+    {
+      wifi_fast_joined = true;
+      return true;
+    }
+    print_serial("- Cached access point failed, scanning");
+    WiFi.disconnect();
+  }
+  wifi_cached.magic = 0;
+  wifi_fast_joined = false;
+
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // back to DHCP
+  WiFi.begin(ssid, pass);
+  if (!wifi_wait(WIFI_TIMEOUT_MS, false))
+  {
+    print_serial("- Connection to Wifi failed");
+    return false;
+  }
+
+  memcpy(wifi_cached.bssid, WiFi.BSSID(), sizeof(wifi_cached.bssid));
+  wifi_cached.channel = WiFi.channel();
+  wifi_cached.obtained = time(nullptr) >= CLOCK_VALID ? time(nullptr) : 0;
+  wifi_cached.ip = WiFi.localIP();
+  wifi_cached.gateway = WiFi.gatewayIP();
+  wifi_cached.subnet = WiFi.subnetMask();
+  wifi_cached.dns = WiFi.dnsIP();
+  wifi_cached.magic = WIFI_CACHE_MAGIC;
+  wifi_cached.check = wifi_cache_check();
+  return true;
+}
+
+// Publishes one payload, reconnecting to the broker first if needed
+bool publish_payload(const char *topic, const uint8_t *payload, size_t length)
+{
+  // Check mqtt connection otherwise try to connect
+  if (!client.connected())
+  {
+    if (!mqtt_connect() || !client.connected())
+    {
+      print_serial("- Connection to MQTT failed");
+      return false;
+    }
+  }
+  else
+  {
+    client.loop();
+  }
+
+  if (!client.publish(topic, (const char *)payload, length, false, 0))
+  {
+    print_serial("- Publish failed");
+    return false;
+  }
+  return true;
 }
 
 void send_sensor_data()
 {
-  uint8_t retryCounter = 2;
-  uint8_t number_of_sensor_data = sensor_data_buffer.size();
+  print_serial("--\nsend_sensor_data(sensor_data_buffer.size=%u)\n--", (unsigned)sensor_data_buffer.size());
 
-  print_serial("--\nsend_sensor_data(sensor_data_buffer.size=" + String(number_of_sensor_data) + ")\n--");
+  if (!wifi_connect())
+  {
+    return;
+  }
 
-  if (WiFi.status() != WL_CONNECTED)
+  // Send the data, oldest first: the flash log, the archive, then the
+  // buffer. Readings are only dropped once published.
+#if (FLASH_LOG == 1)
+  if (flash_log_ready)
   {
-    print_serial("- Checking Wifi");
-    while (WiFi.waitForConnectResult() != WL_CONNECTED)
+    uint8_t block[ARCHIVE_BLOCK_BYTES];
+    size_t length;
+
+    while ((length = flash_log.peek(block, sizeof(block))) > 0)
     {
-      WiFi.setHostname(HOSTNAME);
-      WiFi.mode(WIFI_MODE_STA);
-      WiFi.begin(ssid, pass);
-      while (WiFi.status() != WL_CONNECTED)
+      print_serial("- Flash block, %u bytes", (unsigned)length);
+      if (!publish_payload(MQTT_ARCHIVE_TOPIC, block, length))
       {
-        delay(1000);
-        retryCounter--;
-        if (retryCounter == 0)
-        {
-          print_serial("- Connection to Wifi failed");
-          return;
-        }
+        return;
       }
+      flash_log.pop();
+    }
+  }
+#endif
+
+  while (!archive_buffer.isEmpty())
+  {
+    const archive_block &block = archive_buffer.first();
+
+    print_serial("- Archive block, %u bytes", block.length);
+    if (!publish_payload(MQTT_ARCHIVE_TOPIC, block.data, block.length))
+    {
+      return;
     }
-    print_serial("- Wifi connected");
+    archive_buffer.shift();
   }
 
-  // Send the data
-  for (byte i = 0; i < number_of_sensor_data; i++)
+  while (!sensor_data_buffer.isEmpty())
   {
-    char payload[200];
-    sensor_data sensor_data;
-    DynamicJsonDocument json_doc(200);
+    uint8_t payload[PAYLOAD_MAX_BYTES];
+    size_t length;
+    uint16_t count;
 
-    // Check mqtt connection otherwise try to connect
-    if (!client.connected())
+    length = encode_sensor_data(payload, sizeof(payload));
+    count = encoder.count();
+    if (count == 0)
+    {
+      print_serial("- Record doesn't fit the payload buffer, dropped");
+      sensor_data_buffer.shift();
+      continue;
+    }
+
+    print_serial("- %u records, %u bytes", count, (unsigned)length);
+    if (!publish_payload(MQTT_PUB_TOPIC, payload, length))
+    {
+      return;
+    }
+    while (count-- > 0)
     {
-      mqtt_connect();
+      sensor_data_buffer.shift();
+    }
+  }
+  cycle_mark(published_ms);
+}
+
+#if (UPLOAD_SCHEDULER == 1)
+void radio_off()
+{
+  client.disconnect();
+  net.stop();
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+}
 
-      if (!client.connected())
+// Compressed blocks waiting in RAM or flash, left over from a failed upload
+bool backlog_pending()
+{
+#if (FLASH_LOG == 1)
+  if (flash_log_ready && flash_log.pending() > 0)
+  {
+    return true;
+  }
+#endif
+  return !archive_buffer.isEmpty();
+}
+
+// Decides whether this wake brings the radio up. Readings are taken on every
+// wake either way.
+bool upload_due()
+{
+  upload_state state = {sensor_data_buffer.size(), 0, SAMPLE_NONE_SIGNED, uploaded_temperature, backlog_pending()};
+
+  if (now < retry_after)
+  {
+    return false;
+  }
+  if (state.buffered > 0)
+  {
+    time_t oldest = (time_t)(SAMPLE_EPOCH + sensor_data_buffer.first().timestamp);
+    state.oldest_age = now > oldest ? now - oldest : 0;
+    state.temperature = sensor_data_buffer.last().temperature;
+  }
+  return upload_is_due(upload_limits, state);
+}
+
+// Uploads everything if due, then leaves the radio off until the next upload
+void scheduled_send_sensor_data()
+{
+  int16_t temperature;
+
+  if (!upload_due())
+  {
+    print_serial("- Upload not due, %u readings buffered", (unsigned)sensor_data_buffer.size());
+    return;
+  }
+
+  temperature = sensor_data_buffer.isEmpty() ? uploaded_temperature : sensor_data_buffer.last().temperature;
+  send_sensor_data();
+  if (sensor_data_buffer.isEmpty() && !backlog_pending())
+  {
+    if (temperature != SAMPLE_NONE_SIGNED)
+    {
+      uploaded_temperature = temperature;
+    }
+    retry_after = 0;
+  }
+  else
+  {
+    retry_after = now + UPLOAD_RETRY_INTERVAL;
+  }
+  radio_off();
+}
+#endif
+
+// Takes a reading whenever loop() asks for one, however long an upload takes
+void sensor_task_main(void *)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    cycle_measure(sensor_us, get_BME680_readings());
+    samples_taken++;
+    xTaskNotifyGive(network_task);
+  }
+}
+
+// Archives and uploads what the sensor task buffered, then tells loop() it is idle
+void network_task_main(void *)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t taken = samples_taken;
+
+    // Get the current time
+    now = time(nullptr);
+
+    if (taken == samples_handled)
+    {
+      // A conversion has just started: bring the link up meanwhile if this
+      // wake is going to upload. The new reading can only make it more due.
+#if (UPLOAD_SCHEDULER == 1)
+      if (upload_due())
+#endif
       {
-        print_serial("- Connection to MQTT failed");
-        return;
+        bool linked = true;
+        cycle_measure(send_us, {
+          linked = wifi_connect() && (client.connected() || mqtt_connect());
+        });
+#if (UPLOAD_SCHEDULER == 1)
+        if (!linked)
+        {
+          // Not due again until the retry interval has passed
+          retry_after = now + UPLOAD_RETRY_INTERVAL;
+          radio_off();
+        }
+#endif
       }
+      continue;
     }
-    else
+
+    if (sensor_data_buffer.size() >= ARCHIVE_THRESHOLD)
     {
-      client.loop();
+      archive_sensor_data();
     }
 
-    sensor_data = sensor_data_buffer.pop();
-
-    json_doc["timestamp"] = sensor_data.timestamp;
-    json_doc["temperature"] = sensor_data.temperature;
-    json_doc["humidity"] = sensor_data.humidity;
-    json_doc["pressure"] = sensor_data.pressure;
-    json_doc["gasResistance"] = sensor_data.gasResistance;
+    // Send the data (all on the buffer)
+#if (UPLOAD_SCHEDULER == 1)
+    cycle_measure(send_us, scheduled_send_sensor_data());
+#else
+    cycle_measure(send_us, send_sensor_data());
+#endif
 
-    serializeJson(json_doc, payload);
-    print_serial(payload);
-    client.publish(MQTT_PUB_TOPIC, payload, false, 0);
+    samples_handled = taken;
+    xTaskNotifyGive(loop_task);
   }
 }
 
+// Paces the samples and puts the chip to light sleep once both tasks are idle
 void loop()
 {
+  static int64_t next_sample_us = esp_timer_get_time();
+  int64_t remaining_us;
+
+  cycle_start();
+
   // Print the wakeup reason for ESP32
   print_wakeup_reason();
 
-  // Get the current time
-  now = time(nullptr);
+  samples_requested++;
+  xTaskNotifyGive(sensor_task);
+  next_sample_us += (int64_t)TIME_TO_SLEEP * uS_TO_S_FACTOR;
 
-  // Get the sensor data
-  get_BME680_readings();
-
-  // Send the data (all on the buffer)
-  send_sensor_data();
+  // A network task still busy at the next sample time keeps the chip awake,
+  // the next reading is then taken on schedule meanwhile
+  while ((remaining_us = next_sample_us - esp_timer_get_time()) > 0)
+  {
+    if (samples_handled == samples_requested)
+    {
+      cycle_report();
 
-  // Go back to sleep
-  esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR); // ESP32 wakes up every 60 seconds
-  print_serial("Going to light-sleep now");
-  Serial.flush();
-  esp_light_sleep_start();
+      // Go back to sleep
+      esp_sleep_enable_timer_wakeup(remaining_us);
+      print_serial("Going to light-sleep now");
+      Serial.flush();
+      esp_light_sleep_start();
+      break;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(remaining_us / 1000) + 1);
+  }
 }
@@ -25,15 +25,57 @@
 #include <WiFi.h>
 #include "ssl_client.h"
 
+#ifndef WIFICLIENTSECURE_RX_BUFFER_SIZE
+#define WIFICLIENTSECURE_RX_BUFFER_SIZE 512
+#endif
+
+#ifndef WIFICLIENTSECURE_TX_BUFFER_SIZE
+#define WIFICLIENTSECURE_TX_BUFFER_SIZE 1024
+#endif
+
 class WiFiClientSecure : public Client
 {
 protected:
     bool _connected;
     sslclient_context *sslclient;
+    sslclient_credentials _credentials;
 
     const char *_CA_cert;
     const char *_cert;
     const char *_private_key;
+    size_t _CA_cert_len;
+    size_t _cert_len;
+    size_t _private_key_len;
+
+    // Write coalescing: small writes are collected into one TLS record
+    uint8_t *_tx_buf;
+    size_t _tx_size;
+    size_t _tx_len;
+    bool _tx_coalesce;
+    bool _tx_mqtt_framing;
+    uint8_t _mqtt_header_bytes;  // 0: expecting packet type, 1..4: reading remaining length
+    uint32_t _mqtt_remaining;
+    uint32_t _mqtt_multiplier;
+
+    bool mqttPacketsComplete(const uint8_t *buf, size_t size);
+
+    // Decrypted data drained from mbedtls a record at a time
+    uint8_t *_rx_buf;
+    size_t _rx_size;
+    size_t _rx_pos;
+    size_t _rx_len;
+
+    uint16_t _max_fragment_length;
+
+    // Host of the last connectAsync(), while its address is resolved
+    const char *_host;
+    uint32_t _address;  // of the last connectAsync(), for the retry without MFL
+    uint16_t _port;
+    bool _resolving;
+
+    int fillReadBuffer();
+    bool allocateBuffers();
+    void freeBuffers();
 
 public:
     WiFiClientSecure *next;
@@ -44,22 +86,73 @@ public:
     int connect(const char *host, uint16_t port);
     int connect(IPAddress ip, uint16_t port, const char *rootCABuff, const char *cli_cert, const char *cli_key);
     int connect(const char *host, uint16_t port, const char *rootCABuff, const char *cli_cert, const char *cli_key);
+    int connectAsync(IPAddress ip, uint16_t port);
+    int connectAsync(const char *host, uint16_t port);
+    int poll();
     size_t write(uint8_t data);
     size_t write(const uint8_t *buf, size_t size);
     int available();
     int read();
     int read(uint8_t *buf, size_t size);
-    int peek()
-    {
-        return 0;
-    }
-    void flush() {}
+    int peek();
+    void flush();
     void stop();
     uint8_t connected();
 
     void setCACert(const char *rootCA);
     void setCertificate(const char *client_ca);
     void setPrivateKey (const char *private_key);
+    void setWriteCoalescing(bool enable, bool flushOnMqttPacket = true);
+    // The wrapper's read and write coalescing buffers, not the mbedtls records
+    bool setBufferSizes(size_t rxSize, size_t txSize);
+    void setMaxFragmentLength(uint16_t length);
+    void setCipherProfile(sslclient_profile profile);
+    bool setPreSharedKey(const char *identity, const char *pskHex);
+    void setDnsCacheTtl(uint32_t seconds);
+    void setTimeouts(const sslclient_timeouts &timeouts);
+    void setTimeouts(uint32_t connectMs, uint32_t handshakeMs, uint32_t ioMs);
+    sslclient_timeouts timeouts()
+    {
+        return sslclient->timeouts;
+    }
+    bool setPinnedPublicKey(const char *publicKey);
+    bool setPinnedPublicKey(const uint8_t *publicKey, size_t len);
+    bool setFingerprint(const char *fingerprint);
+    uint32_t heapUsed()
+    {
+        return sslclient->heap_used;
+    }
+    uint32_t peakHeapUsed()
+    {
+        return sslclient->heap_peak;
+    }
+    void setCACert(const uint8_t *rootCA, size_t len);
+    void setCertificate(const uint8_t *client_ca, size_t len);
+    void setPrivateKey (const uint8_t *private_key, size_t len);
+
+    void clearSession();
+    size_t saveSession(uint8_t *buf, size_t size);
+    bool loadSession(const uint8_t *buf, size_t size);
+    uint32_t fullHandshakes()
+    {
+        return sslclient->handshakes_full;
+    }
+    uint32_t resumedHandshakes()
+    {
+        return sslclient->handshakes_resumed;
+    }
+    uint32_t credentialParses()
+    {
+        return _credentials.parse_count;
+    }
+    uint32_t credentialReuses()
+    {
+        return _credentials.reuse_count;
+    }
+    uint32_t credentialParseTimeSaved()
+    {
+        return _credentials.saved_parse_us;
+    }
 
     operator bool()
     {
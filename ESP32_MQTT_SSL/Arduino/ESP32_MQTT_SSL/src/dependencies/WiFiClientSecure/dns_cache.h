@@ -0,0 +1,36 @@
+/* Resolved-address cache and non-blocking resolver for WiFiClientSecure
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef DNS_CACHE_ENTRIES
+#define DNS_CACHE_ENTRIES 2
+#endif
+
+#ifndef DNS_CACHE_HOST_LEN
+#define DNS_CACHE_HOST_LEN 64
+#endif
+
+/* lwIP does not hand the record TTL to the application, so entries live
+   for a fixed time. Define DNS_CACHE_RTC to keep them in RTC memory
+   across deep sleep. */
+#ifndef DNS_CACHE_TTL
+#define DNS_CACHE_TTL 3600  // seconds
+#endif
+
+typedef enum {
+    DNS_RESOLVE_DONE = 0,
+    DNS_RESOLVE_PENDING = 1,
+    DNS_RESOLVE_FAILED = -1
+} dns_resolve_state;
+
+bool dns_cache_lookup(const char *host, uint32_t *addr);
+void dns_cache_store(const char *host, uint32_t addr);
+void dns_cache_invalidate(const char *host);
+void dns_cache_set_ttl(uint32_t seconds);
+int dns_resolve_start(const char *host, uint32_t *addr);
+int dns_resolve_poll(uint32_t *addr);
+#endif
@@ -6,6 +6,7 @@
 * Additions Copyright (C) 2017 Evandro Luis Copercini, Apache 2.0 License.
 */
 
+#ifdef ARDUINO
 #include "Arduino.h"
 #include <esp32-hal-log.h>
 #include <lwip/sockets.h>
@@ -13,6 +14,11 @@
 #include <lwip/sockets.h>
 #include <lwip/sys.h>
 #include <lwip/netdb.h>
+#include <errno.h>
+#else
+#include "ssl_client_host.h"
+#endif
+#include "mbedtls/version.h"
 #include "ssl_client.h"
 
 const char *pers = "esp32-tls";
@@ -29,20 +35,240 @@ static int handle_error(int err)
 }
 
 
+static mbedtls_entropy_context rng_entropy;
+static mbedtls_ctr_drbg_context rng_drbg;
+static bool rng_seeded = false;
+static ssl_rng_stats rng_stats;
+
+static int ssl_rng_seed()
+{
+    unsigned long start = micros();
+    int ret;
+
+    if (!rng_seeded) {
+        log_i("Seeding the random number generator");
+        mbedtls_entropy_init(&rng_entropy);
+        mbedtls_ctr_drbg_init(&rng_drbg);
+        ret = mbedtls_ctr_drbg_seed(&rng_drbg, mbedtls_entropy_func,
+                                    &rng_entropy, (const unsigned char *) pers, strlen(pers));
+        if (ret != 0) {
+            mbedtls_ctr_drbg_free(&rng_drbg);
+            mbedtls_entropy_free(&rng_entropy);
+            return handle_error(ret);
+        }
+        rng_seeded = true;
+        rng_stats.seed_count++;
+    } else {
+        log_i("Reseeding the random number generator");
+        if ((ret = mbedtls_ctr_drbg_reseed(&rng_drbg, NULL, 0)) != 0) {
+            return handle_error(ret);
+        }
+        rng_stats.reseed_count++;
+    }
+
+    rng_stats.bytes_since_seed = 0;
+    rng_stats.seeded_at = millis();
+    rng_stats.seed_time_us += micros() - start;
+    return 0;
+}
+
+
+int ssl_rng_random(void *p_rng, unsigned char *output, size_t len)
+{
+    int ret;
+
+    if (!rng_seeded || rng_stats.bytes_since_seed >= SSL_RNG_RESEED_BYTES ||
+        millis() - rng_stats.seeded_at >= SSL_RNG_RESEED_INTERVAL_MS) {
+        if ((ret = ssl_rng_seed()) != 0) {
+            return ret;
+        }
+    }
+
+    if ((ret = mbedtls_ctr_drbg_random(&rng_drbg, output, len)) == 0) {
+        rng_stats.bytes_since_seed += len;
+    }
+    return ret;
+}
+
+
+const ssl_rng_stats *ssl_rng_get_stats()
+{
+    return &rng_stats;
+}
+
+
+static const int ecdhe_ecdsa_ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256,
+    0
+};
+
+static const mbedtls_ecp_group_id ecdhe_ecdsa_curves[] = {
+    MBEDTLS_ECP_DP_SECP256R1,
+    MBEDTLS_ECP_DP_NONE
+};
+
+static const int psk_ciphersuites[] = {
+    MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_PSK_WITH_AES_128_CBC_SHA256,
+    0
+};
+
+/* Restricts the handshake to suites that are cheap on an 80 MHz core
+   instead of letting the broker pick an RSA key exchange. */
+static int ssl_apply_profile(sslclient_context *ssl_client)
+{
+    switch (ssl_client->profile) {
+    case SSL_PROFILE_ECDHE_ECDSA:
+        log_i("Using ECDHE-ECDSA P-256 cipher profile");
+        mbedtls_ssl_conf_ciphersuites(&ssl_client->ssl_conf, ecdhe_ecdsa_ciphersuites);
+        mbedtls_ssl_conf_curves(&ssl_client->ssl_conf, ecdhe_ecdsa_curves);
+        return 0;
+    case SSL_PROFILE_PSK:
+#if defined(MBEDTLS_KEY_EXCHANGE__SOME__PSK_ENABLED)
+        log_i("Using PSK cipher profile");
+        if (ssl_client->psk_identity[0] == '\0' || ssl_client->psk_len == 0) {
+            return MBEDTLS_ERR_SSL_PRIVATE_KEY_REQUIRED;
+        }
+        mbedtls_ssl_conf_ciphersuites(&ssl_client->ssl_conf, psk_ciphersuites);
+        return mbedtls_ssl_conf_psk(&ssl_client->ssl_conf, ssl_client->psk, ssl_client->psk_len,
+                                    (const unsigned char *)ssl_client->psk_identity, strlen(ssl_client->psk_identity));
+#else
+        return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE;
+#endif
+    default:
+        return 0;
+    }
+}
+
+
+static bool ssl_pin_matches(sslclient_context *ssl_client, mbedtls_x509_crt *crt)
+{
+    unsigned char buf[600];
+    int len;
+
+    if (ssl_client->pin_mode == SSL_PIN_PUBLIC_KEY) {
+        len = mbedtls_pk_write_pubkey_der(&crt->pk, buf, sizeof(buf));  // written to the end of buf
+        return len > 0 && (size_t)len == ssl_client->pin_public_key_len &&
+               memcmp(buf + sizeof(buf) - len, ssl_client->pin_public_key, len) == 0;
+    }
+
+    if (ssl_client->pin_fingerprint_len == 20) {
+        mbedtls_sha1_ret(crt->raw.p, crt->raw.len, buf);
+    } else {
+        mbedtls_sha256_ret(crt->raw.p, crt->raw.len, buf, 0);
+    }
+    return memcmp(buf, ssl_client->pin_fingerprint, ssl_client->pin_fingerprint_len) == 0;
+}
+
+
+/* With a pin configured only the server certificate itself is checked
+   against it; no trust anchor is set, so mbedtls has no chain to build
+   and no CA signatures to verify. */
+static int ssl_verify_pin(void *ctx, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    sslclient_context *ssl_client = (sslclient_context *)ctx;
+
+    if (depth > 0) {
+        *flags = 0;
+        return 0;
+    }
+
+    if (ssl_pin_matches(ssl_client, crt)) {
+        log_i("Server certificate matches the pinned %s", ssl_client->pin_mode == SSL_PIN_PUBLIC_KEY ? "public key" : "fingerprint");
+        *flags = 0;
+    } else {
+        log_e("Server certificate doesn't match the pinned %s", ssl_client->pin_mode == SSL_PIN_PUBLIC_KEY ? "public key" : "fingerprint");
+        *flags |= MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+    }
+    return 0;
+}
+
+
+/* A resumed handshake is recognised by the server echoing the session ID we
+   offered (mbedtls also generates a random ID when offering a ticket). */
+static void ssl_store_session(sslclient_context *ssl_client)
+{
+    unsigned char offered_id[32];
+    size_t offered_id_len = 0;
+    int ret;
+
+    if (ssl_client->session_valid) {
+        offered_id_len = ssl_client->session.id_len;
+        memcpy(offered_id, ssl_client->session.id, offered_id_len);
+    }
+
+    mbedtls_ssl_session_free(&ssl_client->session);
+    mbedtls_ssl_session_init(&ssl_client->session);
+    ssl_client->session_valid = false;
+
+    if ((ret = mbedtls_ssl_get_session(&ssl_client->ssl_ctx, &ssl_client->session)) != 0) {
+        handle_error(ret);
+        return;
+    }
+    ssl_client->session_valid = true;
+
+    if (offered_id_len > 0 && ssl_client->session.id_len == offered_id_len &&
+        memcmp(ssl_client->session.id, offered_id, offered_id_len) == 0) {
+        ssl_client->handshakes_resumed++;
+        log_i("TLS session resumed (full: %u, resumed: %u)", ssl_client->handshakes_full, ssl_client->handshakes_resumed);
+    } else {
+        ssl_client->handshakes_full++;
+        log_i("Full TLS handshake (full: %u, resumed: %u)", ssl_client->handshakes_full, ssl_client->handshakes_resumed);
+    }
+}
+
+
 void ssl_init(sslclient_context *ssl_client)
 {
     mbedtls_ssl_init(&ssl_client->ssl_ctx);
     mbedtls_ssl_config_init(&ssl_client->ssl_conf);
-    mbedtls_ctr_drbg_init(&ssl_client->drbg_ctx);
+    mbedtls_ssl_session_init(&ssl_client->session);
+    ssl_client->session_valid = false;
+    ssl_client->handshakes_full = 0;
+    ssl_client->handshakes_resumed = 0;
+    ssl_client->state = SSL_STATE_IDLE;
+    ssl_client->last_error = 0;
+    ssl_client->timeouts.connect_ms = SSL_CONNECT_TIMEOUT_MS;
+    ssl_client->timeouts.handshake_ms = SSL_HANDSHAKE_TIMEOUT_MS;
+    ssl_client->timeouts.io_ms = SSL_IO_TIMEOUT_MS;
+    ssl_client->creds = NULL;
+    ssl_client->profile = SSL_PROFILE_DEFAULT;
+    ssl_client->psk_identity[0] = '\0';
+    ssl_client->psk_len = 0;
+    ssl_client->pin_mode = SSL_PIN_NONE;
+    ssl_client->pin_fingerprint_len = 0;
+    ssl_client->pin_public_key = NULL;
+    ssl_client->pin_public_key_len = 0;
+    ssl_client->mfl_code = MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+    ssl_client->mfl_skip = 0;
+    ssl_client->mfl_requested = false;
+    ssl_client->mfl_fallback = false;
+    ssl_client->heap_used = 0;
+    ssl_client->heap_peak = 0;
 }
 
 
-int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t port, const char *rootCABuff, const char *cli_cert, const char *cli_key)
+/* Opens a non-blocking socket towards the server and prepares the TLS
+   context; the connection itself is driven forward by ssl_client_poll(). */
+int start_ssl_client_async(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t port, sslclient_credentials *creds)
 {
-    char buf[512];
-    int ret, flags, timeout;
-    int enable = 1;
-    log_i("Free heap before TLS %u", xPortGetFreeHeapSize());
+    int ret;
+    ssl_client->heap_before = xPortGetFreeHeapSize();
+    ssl_client->heap_min = ssl_client->heap_before;
+    log_i("Free heap before TLS %u", ssl_client->heap_before);
+
+    ssl_client->state = SSL_STATE_FAILED;
+    ssl_client->last_error = 0;
+    ssl_client->creds = creds;
+    ssl_client->mfl_requested = false;
+    ssl_client->mfl_fallback = false;
+
+    if (ssl_client->pin_mode == SSL_PIN_INVALID) {
+        log_e("Refusing to connect without the configured pin");
+        ssl_client->last_error = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
+        return ssl_client->last_error;
+    }
 
     log_i("Starting socket");
     ssl_client->socket = -1;
@@ -50,83 +276,60 @@ int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t
     ssl_client->socket = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (ssl_client->socket < 0) {
         log_e("ERROR opening socket");
+        ssl_client->last_error = ssl_client->socket;
         return ssl_client->socket;
     }
 
+    fcntl( ssl_client->socket, F_SETFL, fcntl( ssl_client->socket, F_GETFL, 0 ) | O_NONBLOCK );
+
     struct sockaddr_in serv_addr;
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = ipAddress;
     serv_addr.sin_port = htons(port);
 
-    if (lwip_connect(ssl_client->socket, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) == 0) {
-        timeout = 30000;
-        lwip_setsockopt(ssl_client->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-        lwip_setsockopt(ssl_client->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-        lwip_setsockopt(ssl_client->socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
-        lwip_setsockopt(ssl_client->socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
-    } else {
+    if (lwip_connect(ssl_client->socket, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) != 0 && errno != EINPROGRESS) {
         log_e("Connect to Server failed!");
+        ssl_client->last_error = -1;
         return -1;
     }
 
-    fcntl( ssl_client->socket, F_SETFL, fcntl( ssl_client->socket, F_GETFL, 0 ) | O_NONBLOCK );
-
-    log_i("Seeding the random number generator");
-    mbedtls_entropy_init(&ssl_client->entropy_ctx);
-
-    ret = mbedtls_ctr_drbg_seed(&ssl_client->drbg_ctx, mbedtls_entropy_func,
-                                &ssl_client->entropy_ctx, (const unsigned char *) pers, strlen(pers));
-    if (ret < 0) {
-        return handle_error(ret);
-    }
-
     log_i("Setting up the SSL/TLS structure...");
 
     if ((ret = mbedtls_ssl_config_defaults(&ssl_client->ssl_conf,
                                            MBEDTLS_SSL_IS_CLIENT,
                                            MBEDTLS_SSL_TRANSPORT_STREAM,
                                            MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
-        return handle_error(ret);
+        return ssl_client->last_error = handle_error(ret);
+    }
+
+    if ((ret = ssl_apply_profile(ssl_client)) != 0) {
+        return ssl_client->last_error = handle_error(ret);
     }
 
     /* MBEDTLS_SSL_VERIFY_REQUIRED if a CA certificate is defined on Arduino IDE and
-        MBEDTLS_SSL_VERIFY_NONE if not.
+        MBEDTLS_SSL_VERIFY_NONE if not. PSK suites don't exchange certificates.
         */
-    if (rootCABuff != NULL) {
-        log_i("Loading CA cert");
-        mbedtls_x509_crt_init(&ssl_client->ca_cert);
+    if (ssl_client->profile == SSL_PROFILE_PSK) {
+        mbedtls_ssl_conf_authmode(&ssl_client->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
+    } else if (ssl_client->pin_mode != SSL_PIN_NONE) {
+        log_i("Using pinned server %s", ssl_client->pin_mode == SSL_PIN_PUBLIC_KEY ? "public key" : "fingerprint");
+        // OPTIONAL: without a CA chain mbedtls only reports NOT_TRUSTED, which ssl_verify_pin() clears
+        mbedtls_ssl_conf_authmode(&ssl_client->ssl_conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+        mbedtls_ssl_conf_verify(&ssl_client->ssl_conf, ssl_verify_pin, ssl_client);
+    } else if (creds->ca_src != NULL) {
+        log_i("Using CA cert");
         mbedtls_ssl_conf_authmode(&ssl_client->ssl_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
-        ret = mbedtls_x509_crt_parse(&ssl_client->ca_cert, (const unsigned char *)rootCABuff, strlen(rootCABuff) + 1);
-        mbedtls_ssl_conf_ca_chain(&ssl_client->ssl_conf, &ssl_client->ca_cert, NULL);
+        mbedtls_ssl_conf_ca_chain(&ssl_client->ssl_conf, &creds->ca_cert, NULL);
         //mbedtls_ssl_conf_verify(&ssl_client->ssl_ctx, my_verify, NULL );
-        if (ret < 0) {
-            return handle_error(ret);
-        }
     } else {
         mbedtls_ssl_conf_authmode(&ssl_client->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
         log_i("WARNING: Use certificates for a more secure communication!");
     }
 
-    if (cli_cert != NULL && cli_key != NULL) {
-        mbedtls_x509_crt_init(&ssl_client->client_cert);
-        mbedtls_pk_init(&ssl_client->client_key);
-
-        log_i("Loading CRT cert");
-
-        ret = mbedtls_x509_crt_parse(&ssl_client->client_cert, (const unsigned char *)cli_cert, strlen(cli_cert) + 1);
-        if (ret < 0) {
-            return handle_error(ret);
-        }
-
-        log_i("Loading private key");
-        ret = mbedtls_pk_parse_key(&ssl_client->client_key, (const unsigned char *)cli_key, strlen(cli_key) + 1, NULL, 0);
-
-        if (ret != 0) {
-            return handle_error(ret);
-        }
-
-        mbedtls_ssl_conf_own_cert(&ssl_client->ssl_conf, &ssl_client->client_cert, &ssl_client->client_key);
+    if (ssl_client->profile != SSL_PROFILE_PSK && creds->cert_src != NULL && creds->key_src != NULL) {
+        log_i("Using CRT cert and private key");
+        mbedtls_ssl_conf_own_cert(&ssl_client->ssl_conf, &creds->client_cert, &creds->client_key);
     }
 
     /*
@@ -142,26 +345,77 @@ int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t
         }
     */
 
-    mbedtls_ssl_conf_rng(&ssl_client->ssl_conf, mbedtls_ctr_drbg_random, &ssl_client->drbg_ctx);
+    mbedtls_ssl_conf_rng(&ssl_client->ssl_conf, ssl_rng_random, NULL);
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    if (ssl_client->mfl_code != MBEDTLS_SSL_MAX_FRAG_LEN_NONE && ssl_client->mfl_skip > 0) {
+        ssl_client->mfl_skip--;
+        log_i("Connecting without max fragment length, %u more times", ssl_client->mfl_skip);
+    } else if (ssl_client->mfl_code != MBEDTLS_SSL_MAX_FRAG_LEN_NONE) {
+        log_i("Requesting max fragment length code %u", ssl_client->mfl_code);
+        if ((ret = mbedtls_ssl_conf_max_frag_len(&ssl_client->ssl_conf, ssl_client->mfl_code)) != 0) {
+            return ssl_client->last_error = handle_error(ret);
+        }
+        ssl_client->mfl_requested = true;
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&ssl_client->ssl_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
 
     if ((ret = mbedtls_ssl_setup(&ssl_client->ssl_ctx, &ssl_client->ssl_conf)) != 0) {
-        return handle_error(ret);
+        return ssl_client->last_error = handle_error(ret);
+    }
+
+    if (ssl_client->session_valid) {
+        log_i("Offering saved TLS session for resumption");
+        if ((ret = mbedtls_ssl_set_session(&ssl_client->ssl_ctx, &ssl_client->session)) != 0) {
+            handle_error(ret);
+            ssl_clear_session(ssl_client);
+        }
     }
 
     mbedtls_ssl_set_bio(&ssl_client->ssl_ctx, &ssl_client->socket, mbedtls_net_send, mbedtls_net_recv, NULL );
 
-    log_i("Performing the SSL/TLS handshake...");
+    ssl_client->state = SSL_STATE_CONNECTING;
+    ssl_client->phase_start = millis();
+    return 0;
+}
 
-    while ((ret = mbedtls_ssl_handshake(&ssl_client->ssl_ctx)) != 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != -76) {  //workaround for bug: https://github.com/espressif/esp-idf/issues/434
-            return handle_error(ret);
-        }
-        delay(10);
-        vPortYield();
+
+static int ssl_client_connected(sslclient_context *ssl_client)
+{
+    struct timeval tv = { 0, 0 };
+    fd_set wfds;
+    int err = 0, enable = 1;
+    socklen_t len = sizeof(err);
+
+    FD_ZERO(&wfds);
+    FD_SET(ssl_client->socket, &wfds);
+    if (select(ssl_client->socket + 1, NULL, &wfds, NULL, &tv) <= 0) {
+        return 0;
     }
 
+    lwip_getsockopt(ssl_client->socket, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+        log_e("Connect to Server failed! (%d)", err);
+        return -1;
+    }
 
-    if (cli_cert != NULL && cli_key != NULL) {
+    // No SO_RCVTIMEO/SO_SNDTIMEO: the socket stays non-blocking, the deadlines are kept in the callers
+    lwip_setsockopt(ssl_client->socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    lwip_setsockopt(ssl_client->socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    return 1;
+}
+
+
+static int ssl_client_finish_handshake(sslclient_context *ssl_client)
+{
+    char buf[512];
+    int ret, flags;
+
+    if (ssl_client->creds->cert_src != NULL && ssl_client->creds->key_src != NULL) {
         log_i("Protocol is %s Ciphersuite is %s", mbedtls_ssl_get_version(&ssl_client->ssl_ctx), mbedtls_ssl_get_ciphersuite(&ssl_client->ssl_ctx));
         if ((ret = mbedtls_ssl_get_record_expansion(&ssl_client->ssl_ctx)) >= 0) {
             log_i("Record expansion is %d", ret);
@@ -177,19 +431,115 @@ int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t
         bzero(buf, sizeof(buf));
         mbedtls_x509_crt_verify_info(buf, sizeof(buf), "  ! ", flags);
         log_e("verification info: %s", buf);
-        stop_ssl_socket(ssl_client, rootCABuff, cli_cert, cli_key);  //It's not safe continue.
-        return handle_error(ret);
+        stop_ssl_socket(ssl_client);  //It's not safe continue.
+        return handle_error(MBEDTLS_ERR_X509_CERT_VERIFY_FAILED);
     } else {
         log_i("Certificate verified.");
     }
 
-    log_i("Free heap after TLS %u", xPortGetFreeHeapSize());
+    ssl_store_session(ssl_client);
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    log_i("Max fragment length is %u", (unsigned)mbedtls_ssl_get_max_frag_len(&ssl_client->ssl_ctx));
+#endif
+    ssl_client->heap_used = ssl_client->heap_before - xPortGetFreeHeapSize();
+    ssl_client->heap_peak = ssl_client->heap_before - ssl_client->heap_min;
+    log_i("Free heap after TLS %u (connection uses %u, peak %u)", xPortGetFreeHeapSize(), ssl_client->heap_used, ssl_client->heap_peak);
+    return 0;
+}
+
+
+/* Servers that don't know the extension should ignore it, but some answer
+   with an alert or hang up, and a server picking another length fails
+   ServerHello parsing. Certificate, timeout or memory errors have nothing
+   to do with it and keep it on. */
+static bool ssl_mfl_suspect(int err)
+{
+    switch (err) {
+    case MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE:
+    case MBEDTLS_ERR_SSL_BAD_HS_SERVER_HELLO:
+    case MBEDTLS_ERR_SSL_CONN_EOF:
+    case MBEDTLS_ERR_NET_CONN_RESET:
+    case MBEDTLS_ERR_NET_RECV_FAILED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/* Advances a connection started by start_ssl_client_async() as far as
+   possible without blocking and returns the resulting state. */
+int ssl_client_poll(sslclient_context *ssl_client)
+{
+    int ret;
+
+    if (ssl_client->state == SSL_STATE_CONNECTING) {
+        ret = ssl_client_connected(ssl_client);
+        if (ret < 0) {
+            ssl_client->last_error = -1;
+            ssl_client->state = SSL_STATE_FAILED;
+        } else if (ret > 0) {
+            log_i("Performing the SSL/TLS handshake...");
+            ssl_client->state = SSL_STATE_HANDSHAKE;
+            ssl_client->phase_start = millis();
+        } else if (millis() - ssl_client->phase_start >= ssl_client->timeouts.connect_ms) {
+            log_e("Connect to Server timed out after %u ms", ssl_client->timeouts.connect_ms);
+            ssl_client->last_error = -1;
+            ssl_client->state = SSL_STATE_FAILED;
+        }
+    }
+
+    if (ssl_client->state == SSL_STATE_HANDSHAKE) {
+        ret = mbedtls_ssl_handshake(&ssl_client->ssl_ctx);
+        uint32_t heap = xPortGetFreeHeapSize();
+        if (heap < ssl_client->heap_min) {
+            ssl_client->heap_min = heap;
+        }
+        if (ret == 0) {
+            ret = ssl_client_finish_handshake(ssl_client);
+            ssl_client->last_error = ret;
+            ssl_client->state = ret == 0 ? SSL_STATE_CONNECTED : SSL_STATE_FAILED;
+        } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != -76) {  //workaround for bug: https://github.com/espressif/esp-idf/issues/434
+            ssl_clear_session(ssl_client);  // don't offer a session the server may have choked on
+            if (ssl_client->mfl_requested && ssl_mfl_suspect(ret)) {
+                log_w("Handshake failed with max fragment length, the next %u attempts go without it", SSL_MFL_RETRY_CONNECTS);
+                ssl_client->mfl_skip = SSL_MFL_RETRY_CONNECTS;
+                ssl_client->mfl_fallback = true;
+            }
+            ssl_client->last_error = handle_error(ret);
+            ssl_client->state = SSL_STATE_FAILED;
+        } else if (millis() - ssl_client->phase_start >= ssl_client->timeouts.handshake_ms) {
+            log_e("Handshake timed out after %u ms", ssl_client->timeouts.handshake_ms);
+            ssl_client->last_error = handle_error(MBEDTLS_ERR_SSL_TIMEOUT);
+            ssl_client->state = SSL_STATE_FAILED;
+        }
+    }
+
+    return ssl_client->state;
+}
+
+
+int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t port, sslclient_credentials *creds)
+{
+    int ret = start_ssl_client_async(ssl_client, ipAddress, port, creds);
+    if (ret < 0) {
+        return ret;
+    }
+
+    while ((ret = ssl_client_poll(ssl_client)) != SSL_STATE_CONNECTED) {
+        if (ret == SSL_STATE_FAILED) {
+            return ssl_client->last_error < 0 ? ssl_client->last_error : -1;
+        }
+        delay(10);
+        vPortYield();
+    }
 
     return ssl_client->socket;
 }
 
 
-void stop_ssl_socket(sslclient_context *ssl_client, const char *rootCABuff, const char *cli_cert, const char *cli_key)
+void stop_ssl_socket(sslclient_context *ssl_client)
 {
     log_i("Cleaning SSL connection.");
 
@@ -197,23 +547,10 @@ void stop_ssl_socket(sslclient_context *ssl_client, const char *rootCABuff, cons
         close(ssl_client->socket);
         ssl_client->socket = -1;
     }
+    ssl_client->state = SSL_STATE_IDLE;
 
     mbedtls_ssl_free(&ssl_client->ssl_ctx);
     mbedtls_ssl_config_free(&ssl_client->ssl_conf);
-    mbedtls_ctr_drbg_free(&ssl_client->drbg_ctx);
-    mbedtls_entropy_free(&ssl_client->entropy_ctx);
-
-    if (rootCABuff != NULL) {
-        mbedtls_x509_crt_free(&ssl_client->ca_cert);
-    }
-
-    if (cli_cert != NULL) {
-        mbedtls_x509_crt_free(&ssl_client->client_cert);
-    }
-
-    if (cli_key != NULL) {
-        mbedtls_pk_free(&ssl_client->client_key);
-    }
 }
 
 
@@ -232,15 +569,61 @@ int data_to_read(sslclient_context *ssl_client)
 }
 
 
+/* Cheap readiness check: only reports data when mbedtls already holds
+   decrypted or undecoded record bytes or the socket has something pending,
+   so callers can skip mbedtls_ssl_read() when there is nothing to do. */
+int ssl_data_pending(sslclient_context *ssl_client)
+{
+    struct timeval tv = { 0, 0 };
+    fd_set rfds;
+
+    if (mbedtls_ssl_get_bytes_avail(&ssl_client->ssl_ctx) > 0) {
+        return 1;
+    }
+#if MBEDTLS_VERSION_NUMBER >= 0x020D0000
+    if (mbedtls_ssl_check_pending(&ssl_client->ssl_ctx)) {
+        return 1;
+    }
+#endif
+    if (ssl_client->socket < 0) {
+        return -1;
+    }
+
+    FD_ZERO(&rfds);
+    FD_SET(ssl_client->socket, &rfds);
+    return select(ssl_client->socket + 1, &rfds, NULL, NULL, &tv) > 0 ? 1 : 0;
+}
+
+
+/* The socket stays non-blocking after connecting, so a write that can't
+   make progress waits in select() for at most timeouts.io_ms in total. */
 int send_ssl_data(sslclient_context *ssl_client, const uint8_t *data, uint16_t len)
 {
     //log_i("Writing HTTP request...");  //for low level debug
     int ret = -1;
+    unsigned long start = millis();
 
     while ((ret = mbedtls_ssl_write(&ssl_client->ssl_ctx, data, len)) <= 0) {
         if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != -76) {
             return handle_error(ret);
         }
+
+        unsigned long elapsed = millis() - start;
+        if (elapsed >= ssl_client->timeouts.io_ms) {
+            log_e("Write timed out after %u ms", ssl_client->timeouts.io_ms);
+            return handle_error(MBEDTLS_ERR_SSL_TIMEOUT);
+        }
+
+        unsigned long wait = ssl_client->timeouts.io_ms - elapsed;
+        if (wait > 100) {
+            wait = 100;
+        }
+        struct timeval tv = { 0, (suseconds_t)(wait * 1000) };
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(ssl_client->socket, &fds);
+        select(ssl_client->socket + 1, ret == MBEDTLS_ERR_SSL_WANT_READ ? &fds : NULL,
+               ret == MBEDTLS_ERR_SSL_WANT_READ ? NULL : &fds, NULL, &tv);
     }
 
     len = ret;
@@ -249,6 +632,9 @@ int send_ssl_data(sslclient_context *ssl_client, const uint8_t *data, uint16_t l
 }
 
 
+/* Doesn't block: without a complete record it returns WANT_READ and the
+   caller tries again later. How long to wait for an answer is up to the
+   protocol on top, e.g. the MQTT client's command timeout. */
 int get_ssl_receive(sslclient_context *ssl_client, uint8_t *data, int length)
 {
     //log_i( "Reading HTTP response...");   //for low level debug
@@ -259,3 +645,366 @@ int get_ssl_receive(sslclient_context *ssl_client, uint8_t *data, int length)
     //log_i( "%d bytes readed", ret);   //for low level debug
     return ret;
 }
+
+
+void ssl_clear_session(sslclient_context *ssl_client)
+{
+    mbedtls_ssl_session_free(&ssl_client->session);
+    mbedtls_ssl_session_init(&ssl_client->session);
+    ssl_client->session_valid = false;
+}
+
+
+#if MBEDTLS_VERSION_NUMBER < 0x02130000
+/* mbedtls before 2.19 has no mbedtls_ssl_session_save()/load(), so the
+   fields a client needs to resume are written out here. The peer
+   certificate is left out: it isn't sent again on resumption, and the
+   verification result travels with the session. The format only has to
+   be read back by the same firmware. */
+#define SSL_SESSION_FORMAT 0x53  // 'S'
+
+typedef struct ssl_session_record {
+    uint8_t format;
+    uint8_t id_len;
+    uint8_t mfl_code;
+    uint8_t flags;                  // bit 0: truncated HMAC, bit 1: encrypt-then-MAC
+    int64_t start;
+    int32_t ciphersuite;
+    int32_t compression;
+    uint32_t verify_result;
+    uint32_t ticket_lifetime;
+    uint32_t ticket_len;
+    unsigned char id[32];
+    unsigned char master[48];
+} ssl_session_record;               // followed by the ticket
+
+static int ssl_session_write(const mbedtls_ssl_session *session, unsigned char *buf, size_t buf_len, size_t *olen)
+{
+    ssl_session_record record;
+    const unsigned char *ticket = NULL;
+
+    memset(&record, 0, sizeof(record));
+    record.format = SSL_SESSION_FORMAT;
+    record.id_len = session->id_len;
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    record.mfl_code = session->mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    record.flags |= session->trunc_hmac ? 0x01 : 0;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    record.flags |= session->encrypt_then_mac ? 0x02 : 0;
+#endif
+#if defined(MBEDTLS_HAVE_TIME)
+    record.start = session->start;
+#endif
+    record.ciphersuite = session->ciphersuite;
+    record.compression = session->compression;
+    record.verify_result = session->verify_result;
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    record.ticket_lifetime = session->ticket_lifetime;
+    record.ticket_len = session->ticket_len;
+    ticket = session->ticket;
+#endif
+    memcpy(record.id, session->id, sizeof(record.id));
+    memcpy(record.master, session->master, sizeof(record.master));
+
+    *olen = sizeof(record) + record.ticket_len;
+    if (buf_len < *olen) {
+        return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+    }
+    memcpy(buf, &record, sizeof(record));
+    if (record.ticket_len > 0) {
+        memcpy(buf + sizeof(record), ticket, record.ticket_len);
+    }
+    return 0;
+}
+
+static int ssl_session_read(mbedtls_ssl_session *session, const unsigned char *buf, size_t len)
+{
+    ssl_session_record record;
+
+    if (len < sizeof(record)) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+    memcpy(&record, buf, sizeof(record));
+    if (record.format != SSL_SESSION_FORMAT || record.id_len > sizeof(record.id) ||
+        len != sizeof(record) + record.ticket_len) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS) && defined(MBEDTLS_SSL_CLI_C)
+    if (record.ticket_len > 0) {
+        session->ticket = (unsigned char *)malloc(record.ticket_len);
+        if (session->ticket == NULL) {
+            return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+        }
+        memcpy(session->ticket, buf + sizeof(record), record.ticket_len);
+    }
+    session->ticket_len = record.ticket_len;
+    session->ticket_lifetime = record.ticket_lifetime;
+#else
+    if (record.ticket_len > 0) {
+        return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE;
+    }
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    session->mfl_code = record.mfl_code;
+#endif
+#if defined(MBEDTLS_SSL_TRUNCATED_HMAC)
+    session->trunc_hmac = (record.flags & 0x01) != 0;
+#endif
+#if defined(MBEDTLS_SSL_ENCRYPT_THEN_MAC)
+    session->encrypt_then_mac = (record.flags & 0x02) != 0;
+#endif
+#if defined(MBEDTLS_HAVE_TIME)
+    session->start = (mbedtls_time_t)record.start;
+#endif
+    session->ciphersuite = record.ciphersuite;
+    session->compression = record.compression;
+    session->verify_result = record.verify_result;
+    session->id_len = record.id_len;
+    memcpy(session->id, record.id, sizeof(record.id));
+    memcpy(session->master, record.master, sizeof(record.master));
+    return 0;
+}
+#endif
+
+
+/* Serialise the saved session, e.g. into RTC memory to survive deep sleep
+   or a reset. Light sleep keeps RAM powered, so the in-context copy is
+   enough there. */
+int ssl_session_save(sslclient_context *ssl_client, unsigned char *buf, size_t buf_len, size_t *olen)
+{
+    if (!ssl_client->session_valid) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+    return mbedtls_ssl_session_save(&ssl_client->session, buf, buf_len, olen);
+#else
+    return ssl_session_write(&ssl_client->session, buf, buf_len, olen);
+#endif
+}
+
+
+int ssl_session_load(sslclient_context *ssl_client, const unsigned char *buf, size_t len)
+{
+    int ret;
+
+    ssl_clear_session(ssl_client);
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+    ret = mbedtls_ssl_session_load(&ssl_client->session, buf, len);
+#else
+    ret = ssl_session_read(&ssl_client->session, buf, len);
+#endif
+    if (ret != 0) {
+        ssl_clear_session(ssl_client);
+        return ret;
+    }
+    ssl_client->session_valid = true;
+    return 0;
+}
+
+
+void ssl_credentials_init(sslclient_credentials *creds)
+{
+    creds->ca_src = NULL;
+    creds->cert_src = NULL;
+    creds->key_src = NULL;
+    creds->ca_len = 0;
+    creds->cert_len = 0;
+    creds->key_len = 0;
+    creds->loaded = false;
+
+    mbedtls_x509_crt_init(&creds->ca_cert);
+    mbedtls_x509_crt_init(&creds->client_cert);
+    mbedtls_pk_init(&creds->client_key);
+
+    creds->parse_count = 0;
+    creds->reuse_count = 0;
+    creds->last_parse_us = 0;
+    creds->saved_parse_us = 0;
+}
+
+
+static size_t credential_length(const unsigned char *buf, size_t len)
+{
+    return len != 0 ? len : strlen((const char *)buf) + 1;
+}
+
+
+/* PEM goes to mbedtls_x509_crt_parse(), which takes every block of a chain.
+   DER may also hold several certificates back to back, as written by
+   tools/pem_to_der.py; each is measured by its outer SEQUENCE and parsed
+   on its own, since mbedtls_x509_crt_parse_der() stops after the first. */
+static int ssl_parse_certs(mbedtls_x509_crt *chain, const unsigned char *buf, size_t len)
+{
+    int ret;
+
+    if (len == 0 || buf[0] != (MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE)) {
+        return mbedtls_x509_crt_parse(chain, buf, credential_length(buf, len));
+    }
+    while (len > 0) {
+        unsigned char *p = (unsigned char *)buf;
+        size_t body;
+        if ((ret = mbedtls_asn1_get_tag(&p, buf + len, &body, MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE)) != 0) {
+            return ret;
+        }
+        size_t cert_len = (p - buf) + body;
+        if ((ret = mbedtls_x509_crt_parse_der(chain, buf, cert_len)) != 0) {
+            return ret;
+        }
+        buf += cert_len;
+        len -= cert_len;
+    }
+    return 0;
+}
+
+
+/* Parses the PEM/DER buffers unless the very same buffers were parsed before,
+   in which case the parsed objects are reused as they are. */
+int ssl_credentials_load(sslclient_credentials *creds, const unsigned char *rootCABuff, size_t ca_len,
+                         const unsigned char *cli_cert, size_t cert_len, const unsigned char *cli_key, size_t key_len)
+{
+    int ret;
+    unsigned long start;
+
+    if (creds->loaded && creds->ca_src == rootCABuff && creds->ca_len == ca_len &&
+        creds->cert_src == cli_cert && creds->cert_len == cert_len &&
+        creds->key_src == cli_key && creds->key_len == key_len) {
+        creds->reuse_count++;
+        creds->saved_parse_us += creds->last_parse_us;
+        log_i("Reusing parsed credentials, saved %u us (total %u us)", creds->last_parse_us, creds->saved_parse_us);
+        return 0;
+    }
+
+    ssl_credentials_free(creds);
+    start = micros();
+
+    if (rootCABuff != NULL) {
+        log_i("Loading CA cert");
+        ret = ssl_parse_certs(&creds->ca_cert, rootCABuff, ca_len);
+        if (ret < 0) {
+            ssl_credentials_free(creds);
+            return handle_error(ret);
+        }
+    }
+
+    if (cli_cert != NULL && cli_key != NULL) {
+        log_i("Loading CRT cert");
+        ret = ssl_parse_certs(&creds->client_cert, cli_cert, cert_len);
+        if (ret < 0) {
+            ssl_credentials_free(creds);
+            return handle_error(ret);
+        }
+
+        log_i("Loading private key");
+        ret = mbedtls_pk_parse_key(&creds->client_key, cli_key, credential_length(cli_key, key_len), NULL, 0);
+        if (ret != 0) {
+            ssl_credentials_free(creds);
+            return handle_error(ret);
+        }
+    }
+
+    creds->ca_src = rootCABuff;
+    creds->cert_src = cli_cert;
+    creds->key_src = cli_key;
+    creds->ca_len = ca_len;
+    creds->cert_len = cert_len;
+    creds->key_len = key_len;
+    creds->loaded = true;
+    creds->parse_count++;
+    creds->last_parse_us = micros() - start;
+    log_i("Credentials parsed in %u us", creds->last_parse_us);
+    return 0;
+}
+
+
+void ssl_credentials_free(sslclient_credentials *creds)
+{
+    mbedtls_x509_crt_free(&creds->ca_cert);
+    mbedtls_x509_crt_free(&creds->client_cert);
+    mbedtls_pk_free(&creds->client_key);
+
+    mbedtls_x509_crt_init(&creds->ca_cert);
+    mbedtls_x509_crt_init(&creds->client_cert);
+    mbedtls_pk_init(&creds->client_key);
+
+    creds->ca_src = NULL;
+    creds->cert_src = NULL;
+    creds->key_src = NULL;
+    creds->loaded = false;
+}
+
+
+void ssl_clear_pin(sslclient_context *ssl_client)
+{
+    free(ssl_client->pin_public_key);
+    ssl_client->pin_public_key = NULL;
+    ssl_client->pin_public_key_len = 0;
+    ssl_client->pin_fingerprint_len = 0;
+    ssl_client->pin_mode = SSL_PIN_NONE;
+}
+
+
+/* A pin that can't be used must not leave the client on a weaker check
+   than the one asked for, so it fails closed: connections are refused
+   until a valid pin is set or the pin is cleared on purpose. */
+static int ssl_reject_pin(sslclient_context *ssl_client, int err)
+{
+    ssl_clear_pin(ssl_client);
+    ssl_clear_session(ssl_client);
+    ssl_client->pin_mode = SSL_PIN_INVALID;
+    return err;
+}
+
+
+/* Accepts the key as PEM (NUL-terminated, len 0) or DER and keeps it in
+   the DER form mbedtls_pk_write_pubkey_der() produces for the server key. */
+int ssl_pin_public_key(sslclient_context *ssl_client, const unsigned char *key, size_t len)
+{
+    mbedtls_pk_context pk;
+    unsigned char buf[600];
+    unsigned char *der;
+    int ret;
+
+    if (key == NULL) {
+        return ssl_reject_pin(ssl_client, MBEDTLS_ERR_PK_BAD_INPUT_DATA);
+    }
+    mbedtls_pk_init(&pk);
+    ret = mbedtls_pk_parse_public_key(&pk, key, len != 0 ? len : strlen((const char *)key) + 1);
+    if (ret == 0) {
+        ret = mbedtls_pk_write_pubkey_der(&pk, buf, sizeof(buf));
+    }
+    mbedtls_pk_free(&pk);
+    if (ret <= 0) {
+        return ssl_reject_pin(ssl_client, handle_error(ret < 0 ? ret : MBEDTLS_ERR_PK_BAD_INPUT_DATA));
+    }
+
+    der = (unsigned char *)malloc(ret);
+    if (der == NULL) {
+        return ssl_reject_pin(ssl_client, MBEDTLS_ERR_PK_ALLOC_FAILED);
+    }
+    memcpy(der, buf + sizeof(buf) - ret, ret);
+
+    ssl_clear_pin(ssl_client);
+    ssl_client->pin_public_key = der;
+    ssl_client->pin_public_key_len = ret;
+    ssl_client->pin_mode = SSL_PIN_PUBLIC_KEY;
+    ssl_clear_session(ssl_client);
+    return 0;
+}
+
+
+int ssl_pin_fingerprint(sslclient_context *ssl_client, const unsigned char *fingerprint, size_t len)
+{
+    if (fingerprint == NULL || (len != 20 && len != 32)) {
+        return ssl_reject_pin(ssl_client, MBEDTLS_ERR_SSL_BAD_INPUT_DATA);
+    }
+    ssl_clear_pin(ssl_client);
+    memcpy(ssl_client->pin_fingerprint, fingerprint, len);
+    ssl_client->pin_fingerprint_len = len;
+    ssl_client->pin_mode = SSL_PIN_FINGERPRINT;
+    ssl_clear_session(ssl_client);
+    return 0;
+}
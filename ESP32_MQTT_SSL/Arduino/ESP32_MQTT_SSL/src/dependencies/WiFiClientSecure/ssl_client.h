@@ -11,27 +11,162 @@
 #include "mbedtls/entropy.h"
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/error.h"
+#include "mbedtls/asn1.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/sha256.h"
+
+/* Parsed CA/client certificate and key, kept across connections and only
+   re-parsed when the source buffers change. A length of 0 marks a
+   NUL-terminated PEM buffer, anything else is DER. */
+typedef struct sslclient_credentials {
+    const unsigned char *ca_src;
+    const unsigned char *cert_src;
+    const unsigned char *key_src;
+    size_t ca_len;
+    size_t cert_len;
+    size_t key_len;
+    bool loaded;
+
+    mbedtls_x509_crt ca_cert;
+    mbedtls_x509_crt client_cert;
+    mbedtls_pk_context client_key;
+
+    uint32_t parse_count;
+    uint32_t reuse_count;
+    uint32_t last_parse_us;
+    uint32_t saved_parse_us;
+} sslclient_credentials;
+
+/* One entropy/CTR-DRBG pair is shared by all connections. It is seeded on
+   first use and reseeded once SSL_RNG_RESEED_BYTES were drawn from it or
+   SSL_RNG_RESEED_INTERVAL_MS passed, not on every connect. */
+#ifndef SSL_RNG_RESEED_BYTES
+#define SSL_RNG_RESEED_BYTES (64 * 1024)
+#endif
+#ifndef SSL_RNG_RESEED_INTERVAL_MS
+#define SSL_RNG_RESEED_INTERVAL_MS (60 * 60 * 1000UL)
+#endif
+
+typedef struct ssl_rng_stats {
+    uint32_t seed_count;
+    uint32_t reseed_count;
+    uint32_t seed_time_us;          // total time spent in seed and reseed
+    uint32_t bytes_since_seed;
+    unsigned long seeded_at;        // millis() of the last (re)seed
+} ssl_rng_stats;
+
+typedef enum {
+    SSL_PROFILE_DEFAULT = 0,        // everything MBEDTLS_SSL_PRESET_DEFAULT offers
+    SSL_PROFILE_ECDHE_ECDSA,        // ECDHE-ECDSA with AES-128 on P-256 only
+    SSL_PROFILE_PSK                 // pre-shared key, no certificates at all
+} sslclient_profile;
+
+typedef enum {
+    SSL_PIN_NONE = 0,               // verify against the CA, if one is set
+    SSL_PIN_PUBLIC_KEY,             // server certificate must carry this public key
+    SSL_PIN_FINGERPRINT,            // SHA-1 or SHA-256 of the server certificate
+    SSL_PIN_INVALID                 // a pin was rejected, connections are refused until one is set
+} sslclient_pin_mode;
+
+typedef enum {
+    SSL_STATE_IDLE = 0,
+    SSL_STATE_CONNECTING,   // TCP connect in progress
+    SSL_STATE_HANDSHAKE,    // TLS handshake in progress
+    SSL_STATE_CONNECTED,
+    SSL_STATE_FAILED
+} sslclient_state;
+
+/* Upper bounds for the phases of a connection, so an unreachable or
+   stalled broker can't hold up a wake cycle. */
+#ifndef SSL_CONNECT_TIMEOUT_MS
+#define SSL_CONNECT_TIMEOUT_MS 5000
+#endif
+#ifndef SSL_HANDSHAKE_TIMEOUT_MS
+#define SSL_HANDSHAKE_TIMEOUT_MS 10000
+#endif
+#ifndef SSL_IO_TIMEOUT_MS
+#define SSL_IO_TIMEOUT_MS 5000
+#endif
+
+/* Connections made without max fragment length after a handshake that
+   may have failed because of it; the next one asks for it again, so a
+   broker hiccup doesn't cost the smaller buffers for good. */
+#ifndef SSL_MFL_RETRY_CONNECTS
+#define SSL_MFL_RETRY_CONNECTS 16
+#endif
+
+/* Longest PSK identity setPreSharedKey() accepts; it is copied into the
+   context, so the caller's string doesn't have to outlive the client. */
+#ifndef SSL_PSK_IDENTITY_MAX
+#define SSL_PSK_IDENTITY_MAX 64
+#endif
+
+typedef struct sslclient_timeouts {
+    uint32_t connect_ms;            // TCP connect
+    uint32_t handshake_ms;          // TLS handshake, once TCP is up
+    uint32_t io_ms;                 // a single write; reads never wait, see get_ssl_receive()
+} sslclient_timeouts;
 
 typedef struct sslclient_context {
     int socket;
+    sslclient_state state;
+    int last_error;
+    sslclient_timeouts timeouts;
+    unsigned long phase_start;      // millis() when the current state was entered
+    sslclient_credentials *creds;
     mbedtls_net_context net_ctx;
     mbedtls_ssl_context ssl_ctx;
     mbedtls_ssl_config ssl_conf;
 
-    mbedtls_ctr_drbg_context drbg_ctx;
-    mbedtls_entropy_context entropy_ctx;
+    mbedtls_ssl_session session;    // kept across stop_ssl_socket() for resumption
+    bool session_valid;
+    uint32_t handshakes_full;
+    uint32_t handshakes_resumed;
 
-    mbedtls_x509_crt ca_cert;
-    mbedtls_x509_crt client_cert;
-    mbedtls_pk_context client_key;
+    sslclient_profile profile;
+    char psk_identity[SSL_PSK_IDENTITY_MAX + 1];
+    unsigned char psk[32];
+    size_t psk_len;
+
+    sslclient_pin_mode pin_mode;
+    unsigned char pin_fingerprint[32];
+    size_t pin_fingerprint_len;     // 20 for SHA-1, 32 for SHA-256
+    unsigned char *pin_public_key;  // DER SubjectPublicKeyInfo
+    size_t pin_public_key_len;
+
+    unsigned char mfl_code;         // MBEDTLS_SSL_MAX_FRAG_LEN_xxx requested from the server
+    uint32_t mfl_skip;              // connections left without it after a suspect failure
+    bool mfl_requested;             // asked for in the current handshake
+    bool mfl_fallback;              // the last handshake failure suspended it
+    uint32_t heap_before;
+    uint32_t heap_min;
+    uint32_t heap_used;             // held by the connection once established
+    uint32_t heap_peak;             // highest usage seen during the handshake
 } sslclient_context;
 
 
+int ssl_rng_random(void *p_rng, unsigned char *output, size_t len);
+const ssl_rng_stats *ssl_rng_get_stats();
+
 void ssl_init(sslclient_context *ssl_client);
-int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t port, const char *rootCABuff, const char *cli_cert, const char *cli_key);
-void stop_ssl_socket(sslclient_context *ssl_client, const char *rootCABuff, const char *cli_cert, const char *cli_key);
+int start_ssl_client(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t port, sslclient_credentials *creds);
+int start_ssl_client_async(sslclient_context *ssl_client, uint32_t ipAddress, uint32_t port, sslclient_credentials *creds);
+int ssl_client_poll(sslclient_context *ssl_client);
+void stop_ssl_socket(sslclient_context *ssl_client);
 int data_to_read(sslclient_context *ssl_client);
+int ssl_data_pending(sslclient_context *ssl_client);
 int send_ssl_data(sslclient_context *ssl_client, const uint8_t *data, uint16_t len);
 int get_ssl_receive(sslclient_context *ssl_client, uint8_t *data, int length);
+void ssl_clear_session(sslclient_context *ssl_client);
+int ssl_pin_public_key(sslclient_context *ssl_client, const unsigned char *key, size_t len);
+int ssl_pin_fingerprint(sslclient_context *ssl_client, const unsigned char *fingerprint, size_t len);
+void ssl_clear_pin(sslclient_context *ssl_client);
+int ssl_session_save(sslclient_context *ssl_client, unsigned char *buf, size_t buf_len, size_t *olen);
+int ssl_session_load(sslclient_context *ssl_client, const unsigned char *buf, size_t len);
+
+void ssl_credentials_init(sslclient_credentials *creds);
+int ssl_credentials_load(sslclient_credentials *creds, const unsigned char *rootCABuff, size_t ca_len,
+                         const unsigned char *cli_cert, size_t cert_len, const unsigned char *cli_key, size_t key_len);
+void ssl_credentials_free(sslclient_credentials *creds);
 
 #endif
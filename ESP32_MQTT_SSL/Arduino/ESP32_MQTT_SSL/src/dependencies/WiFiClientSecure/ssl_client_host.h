@@ -0,0 +1,78 @@
+/* Stand-ins for the ESP32 core and lwIP calls used by ssl_client.cpp, so
+ * the TLS client can be compiled on Linux against the system mbedtls and
+ * POSIX sockets for profiling:
+ *
+ *   g++ -O2 -c ssl_client.cpp -o ssl_client.o
+ *
+ * and link the program using it with -lmbedtls -lmbedx509 -lmbedcrypto.
+ * Only included when ARDUINO is not defined.
+ */
+
+#ifndef SSL_CLIENT_HOST_H
+#define SSL_CLIENT_HOST_H
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define lwip_socket socket
+#define lwip_connect connect
+#define lwip_getsockopt getsockopt
+#define lwip_setsockopt setsockopt
+
+// 0: errors only, 1: also warnings, 2: everything
+#ifndef SSL_CLIENT_HOST_LOG
+#define SSL_CLIENT_HOST_LOG 0
+#endif
+
+#define ssl_host_log(level, tag, format, ...) \
+    do { if (SSL_CLIENT_HOST_LOG >= level) fprintf(stderr, "[" tag "] " format "\n", ##__VA_ARGS__); } while (0)
+#define log_e(format, ...) ssl_host_log(0, "E", format, ##__VA_ARGS__)
+#define log_w(format, ...) ssl_host_log(1, "W", format, ##__VA_ARGS__)
+#define log_i(format, ...) ssl_host_log(2, "I", format, ##__VA_ARGS__)
+#define log_v(format, ...) ssl_host_log(2, "V", format, ##__VA_ARGS__)
+
+static inline unsigned long micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+
+static inline unsigned long millis()
+{
+    return micros() / 1000;
+}
+
+static inline void delay(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+static inline void vPortYield()
+{
+    sched_yield();
+}
+
+/* The heap figures the client logs are relative, so the process heap in
+   use is reported against a nominal ESP32-sized heap. */
+#ifndef SSL_CLIENT_HOST_HEAP_SIZE
+#define SSL_CLIENT_HOST_HEAP_SIZE (320 * 1024)
+#endif
+
+static inline uint32_t xPortGetFreeHeapSize()
+{
+    return SSL_CLIENT_HOST_HEAP_SIZE - (uint32_t)mallinfo2().uordblks;
+}
+#endif
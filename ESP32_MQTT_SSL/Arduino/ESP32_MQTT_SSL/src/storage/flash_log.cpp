@@ -0,0 +1,347 @@
+#include "Arduino.h"
+#include <string.h>
+#include <stddef.h>
+#include "flash_log.h"
+
+#define FLASH_LOG_MAGIC 0x474f4c46 // "FLOG"
+#define RECORD_WRITING 0xff
+#define RECORD_PENDING 0xfe
+#define RECORD_SENT 0x00
+
+struct segment_header
+{
+  uint32_t magic;
+  uint32_t sequence;
+};
+
+struct record_header
+{
+  uint16_t length;
+  uint8_t state;
+  uint8_t crc; // over length and data, the state byte changes
+};
+
+static_assert(sizeof(segment_header) == FLASH_LOG_SEGMENT_HEADER, "segment_header size");
+static_assert(sizeof(record_header) == FLASH_LOG_RECORD_HEADER, "record_header size");
+
+static uint8_t crc8(uint8_t crc, const uint8_t *data, size_t length)
+{
+  while (length--)
+  {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+bool FlashLog::begin(const char *label)
+{
+  bool found = false;
+
+  _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!_partition)
+  {
+    log_e("No data partition named %s", label);
+    return false;
+  }
+  _segments = _partition->size / FLASH_LOG_SEGMENT_SIZE;
+  if (_segments < 2)
+  {
+    log_e("Partition %s is too small", label);
+    _partition = NULL;
+    return false;
+  }
+
+  // The newest segment is the one appended to
+  for (uint32_t segment = 0; segment < _segments; segment++)
+  {
+    uint32_t sequence;
+    if (readSegment(segment, &sequence) && (!found || (int32_t)(sequence - _sequence) > 0))
+    {
+      found = true;
+      _sequence = sequence;
+      _head = segment;
+    }
+  }
+
+  _pending = 0;
+  _tail_length = 0;
+  if (!found)
+  {
+    if (!startSegment(0))
+    {
+      _partition = NULL;
+      return false;
+    }
+  }
+  else
+  {
+    // Segments are written in index order, so the oldest follows the head
+    for (uint32_t i = 1; i <= _segments; i++)
+    {
+      uint32_t segment = (_head + i) % _segments;
+      uint32_t sequence, end, first_pending;
+      if (!readSegment(segment, &sequence))
+      {
+        continue;
+      }
+      uint32_t count = scanSegment(segment, &end, &first_pending);
+      if (count > 0 && _pending == 0)
+      {
+        _tail = segment;
+        _tail_offset = first_pending;
+      }
+      _pending += count;
+      if (segment == _head)
+      {
+        _head_offset = end;
+      }
+    }
+  }
+
+  if (_pending == 0)
+  {
+    _tail = _head;
+    _tail_offset = _head_offset;
+  }
+  log_i("Flash log: %u segments, %u records pending", (unsigned)_segments, (unsigned)_pending);
+  return true;
+}
+
+bool FlashLog::append(const uint8_t *data, size_t length)
+{
+  if (!_partition || length == 0 || length > FLASH_LOG_MAX_RECORD)
+  {
+    return false;
+  }
+
+  if (_head_offset + FLASH_LOG_RECORD_HEADER + length > FLASH_LOG_SEGMENT_SIZE)
+  {
+    uint32_t next = (_head + 1) % _segments;
+    if (_pending > 0 && _tail == next)
+    {
+      // Full: the oldest segment goes, whatever it still holds
+      uint32_t end, first_pending;
+      uint32_t lost = scanSegment(next, &end, &first_pending);
+      _pending -= lost < _pending ? lost : _pending;
+      _dropped += lost;
+      _tail = (next + 1) % _segments;
+      _tail_offset = FLASH_LOG_SEGMENT_HEADER;
+      _tail_length = 0;
+      log_w("Flash log full, dropped %u records", (unsigned)lost);
+    }
+    if (!startSegment(next))
+    {
+      return false;
+    }
+  }
+
+  if (_pending == 0)
+  {
+    _tail = _head;
+    _tail_offset = _head_offset;
+    _tail_length = 0;
+  }
+
+  record_header header;
+  header.length = length;
+  header.state = RECORD_WRITING;
+  header.crc = crc8(crc8(0, (const uint8_t *)&header.length, sizeof(header.length)), data, length);
+
+  // The state byte is committed last: a reset halfway leaves a record that
+  // is never read and closes the segment instead of getting overwritten
+  uint8_t state = RECORD_PENDING;
+  size_t address = _head * FLASH_LOG_SEGMENT_SIZE + _head_offset;
+  if (esp_partition_write(_partition, address, &header, sizeof(header)) != ESP_OK ||
+      esp_partition_write(_partition, address + sizeof(header), data, length) != ESP_OK ||
+      esp_partition_write(_partition, address + offsetof(record_header, state), &state, sizeof(state)) != ESP_OK)
+  {
+    log_e("Flash log write failed");
+    _head_offset = FLASH_LOG_SEGMENT_SIZE;
+    return false;
+  }
+  _head_offset += sizeof(header) + length;
+  _pending++;
+  return true;
+}
+
+size_t FlashLog::peek(uint8_t *buf, size_t size)
+{
+  uint32_t hops = 0;
+
+  _tail_length = 0;
+  while (_pending > 0)
+  {
+    uint16_t length;
+    uint8_t state;
+
+    if (!readRecord(_tail, _tail_offset, &length, &state, buf, size))
+    {
+      // End of this segment, carry on in the next one
+      if (_tail == _head || ++hops > _segments)
+      {
+        _pending = 0;
+        return 0;
+      }
+      _tail = (_tail + 1) % _segments;
+      _tail_offset = FLASH_LOG_SEGMENT_HEADER;
+      continue;
+    }
+    if (state == RECORD_PENDING)
+    {
+      _tail_length = length;
+      if (length <= size)
+      {
+        return length;
+      }
+      log_e("Flash log record of %u bytes doesn't fit, dropped", (unsigned)length);
+      pop();
+      _dropped++;
+      continue;
+    }
+    _tail_offset += FLASH_LOG_RECORD_HEADER + length;
+  }
+  return 0;
+}
+
+bool FlashLog::pop()
+{
+  uint8_t state = RECORD_SENT;
+
+  if (_tail_length == 0)
+  {
+    return false;
+  }
+  size_t address = _tail * FLASH_LOG_SEGMENT_SIZE + _tail_offset + offsetof(record_header, state);
+  if (esp_partition_write(_partition, address, &state, sizeof(state)) != ESP_OK)
+  {
+    return false;
+  }
+  _tail_offset += FLASH_LOG_RECORD_HEADER + _tail_length;
+  _tail_length = 0;
+  _pending--;
+  if (_pending == 0)
+  {
+    _tail = _head;
+    _tail_offset = _head_offset;
+  }
+  return true;
+}
+
+bool FlashLog::readSegment(uint32_t segment, uint32_t *sequence)
+{
+  segment_header header;
+
+  if (esp_partition_read(_partition, segment * FLASH_LOG_SEGMENT_SIZE, &header, sizeof(header)) != ESP_OK ||
+      header.magic != FLASH_LOG_MAGIC)
+  {
+    return false;
+  }
+  *sequence = header.sequence;
+  return true;
+}
+
+// Reads and checks the record at offset; data is filled in when it fits in size
+bool FlashLog::readRecord(uint32_t segment, uint32_t offset, uint16_t *length, uint8_t *state, uint8_t *data, size_t size)
+{
+  record_header header;
+  size_t address = segment * FLASH_LOG_SEGMENT_SIZE + offset;
+
+  if (offset + sizeof(header) > FLASH_LOG_SEGMENT_SIZE ||
+      esp_partition_read(_partition, address, &header, sizeof(header)) != ESP_OK ||
+      header.state == RECORD_WRITING || header.length == 0 ||
+      offset + sizeof(header) + header.length > FLASH_LOG_SEGMENT_SIZE)
+  {
+    return false;
+  }
+
+  uint8_t crc = crc8(0, (const uint8_t *)&header.length, sizeof(header.length));
+  address += sizeof(header);
+  if (data && header.length <= size)
+  {
+    if (esp_partition_read(_partition, address, data, header.length) != ESP_OK)
+    {
+      return false;
+    }
+    crc = crc8(crc, data, header.length);
+  }
+  else
+  {
+    uint8_t chunk[64];
+    for (size_t done = 0; done < header.length; done += sizeof(chunk))
+    {
+      size_t n = header.length - done < sizeof(chunk) ? header.length - done : sizeof(chunk);
+      if (esp_partition_read(_partition, address + done, chunk, n) != ESP_OK)
+      {
+        return false;
+      }
+      crc = crc8(crc, chunk, n);
+    }
+  }
+  if (crc != header.crc)
+  {
+    return false;
+  }
+  *length = header.length;
+  *state = header.state;
+  return true;
+}
+
+/* Walks the records of a segment. Returns how many are pending, the offset
+ * of the first of them, and where the next record can go: past the last
+ * good one, or the segment end if a damaged record closed it.
+ */
+uint32_t FlashLog::scanSegment(uint32_t segment, uint32_t *end, uint32_t *first_pending)
+{
+  uint32_t offset = FLASH_LOG_SEGMENT_HEADER;
+  uint32_t pending = 0;
+  uint16_t length;
+  uint8_t state;
+
+  *first_pending = 0;
+  while (readRecord(segment, offset, &length, &state))
+  {
+    if (state == RECORD_PENDING)
+    {
+      if (pending == 0)
+      {
+        *first_pending = offset;
+      }
+      pending++;
+    }
+    offset += FLASH_LOG_RECORD_HEADER + length;
+  }
+
+  record_header header;
+  *end = FLASH_LOG_SEGMENT_SIZE;
+  if (offset + sizeof(header) <= FLASH_LOG_SEGMENT_SIZE &&
+      esp_partition_read(_partition, segment * FLASH_LOG_SEGMENT_SIZE + offset, &header, sizeof(header)) == ESP_OK &&
+      header.length == 0xffff && header.state == 0xff && header.crc == 0xff)
+  {
+    *end = offset; // erased, free from here on
+  }
+  return pending;
+}
+
+bool FlashLog::startSegment(uint32_t segment)
+{
+  segment_header header;
+  size_t address = segment * FLASH_LOG_SEGMENT_SIZE;
+
+  header.magic = FLASH_LOG_MAGIC;
+  header.sequence = _sequence + 1;
+  if (esp_partition_erase_range(_partition, address, FLASH_LOG_SEGMENT_SIZE) != ESP_OK ||
+      esp_partition_write(_partition, address, &header, sizeof(header)) != ESP_OK)
+  {
+    log_e("Flash log segment %u erase failed", (unsigned)segment);
+    return false;
+  }
+  _erases++;
+  _sequence = header.sequence;
+  _head = segment;
+  _head_offset = FLASH_LOG_SEGMENT_HEADER;
+  return true;
+}
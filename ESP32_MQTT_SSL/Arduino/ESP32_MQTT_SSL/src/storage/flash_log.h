@@ -0,0 +1,66 @@
+/* Append-only record log on a raw flash partition, used to keep archive
+ * blocks through long outages and resets.
+ *
+ * The partition is split into 4 KB segments, written round robin so every
+ * sector sees the same number of erases. A segment starts with a magic and
+ * a sequence number; records follow as
+ *
+ *   uint16 length, uint8 state (0xff written, 0xfe pending, 0x00 sent), uint8 crc8, data
+ *
+ * A record counts once its state is cleared to pending, after the data; marking
+ * it sent clears the rest, so neither needs an erase.
+ * When the log is full the oldest segment is erased, pending or not.
+ */
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_partition.h>
+
+#define FLASH_LOG_SEGMENT_SIZE 4096
+#define FLASH_LOG_SEGMENT_HEADER 8
+#define FLASH_LOG_RECORD_HEADER 4
+#define FLASH_LOG_MAX_RECORD (FLASH_LOG_SEGMENT_SIZE - FLASH_LOG_SEGMENT_HEADER - FLASH_LOG_RECORD_HEADER)
+
+class FlashLog
+{
+public:
+  bool begin(const char *label = "spiffs");
+  bool append(const uint8_t *data, size_t length);
+  size_t peek(uint8_t *buf, size_t size); // oldest pending record, 0 if none
+  bool pop(); // marks the record returned by peek() as sent
+
+  uint32_t pending()
+  {
+    return _pending;
+  }
+  uint32_t dropped()
+  {
+    return _dropped;
+  }
+  uint32_t erases()
+  {
+    return _erases;
+  }
+
+protected:
+  const esp_partition_t *_partition = NULL;
+  uint32_t _segments = 0;
+  uint32_t _sequence = 0;
+  uint32_t _head = 0;         // segment written to
+  uint32_t _head_offset = 0;  // next free byte in it
+  uint32_t _tail = 0;         // segment of the oldest pending record
+  uint32_t _tail_offset = 0;
+  uint16_t _tail_length = 0;  // set by peek(), consumed by pop()
+  uint32_t _pending = 0;
+  uint32_t _dropped = 0;
+  uint32_t _erases = 0;
+
+  bool readSegment(uint32_t segment, uint32_t *sequence);
+  bool readRecord(uint32_t segment, uint32_t offset, uint16_t *length, uint8_t *state, uint8_t *data = NULL, size_t size = 0);
+  uint32_t scanSegment(uint32_t segment, uint32_t *end, uint32_t *first_pending);
+  bool startSegment(uint32_t segment);
+};
+
+#endif
@@ -0,0 +1,39 @@
+/* Which readings run the BME680 gas heater: every Nth one, the first
+ * included, and the next one after request(). A requested reading restarts
+ * the count, so the regular one doesn't follow right after it.
+ *
+ * request() may be called from another task than next().
+ */
+
+#ifndef GAS_SCHEDULE_H
+#define GAS_SCHEDULE_H
+#include <stdint.h>
+#include <atomic>
+
+class GasSchedule
+{
+public:
+  explicit GasSchedule(uint32_t every_n) : _every_n(every_n > 0 ? every_n : 1)
+  {
+  }
+
+  void request()
+  {
+    _requested = true;
+  }
+
+  // Whether the coming reading measures gas
+  bool next()
+  {
+    bool gas = _requested.exchange(false) || _count == 0;
+    _count = ((gas ? 0 : _count) + 1) % _every_n;
+    return gas;
+  }
+
+private:
+  const uint32_t _every_n;
+  uint32_t _count = 0; // readings since the last gas reading, modulo N
+  std::atomic<bool> _requested{false};
+};
+
+#endif
@@ -0,0 +1,177 @@
+/* Time series compression after Facebook's Gorilla paper, sized for 32 bit
+ * timestamps and float32 values. Bits are written MSB first.
+ *
+ * The first record is stored raw: 32 bit timestamp, then four 32 bit values.
+ *
+ * Following timestamps store the change of the interval (delta of delta):
+ *   0                   dod == 0
+ *   10   + 7 bits       -63..64
+ *   110  + 9 bits       -255..256
+ *   1110 + 12 bits      -2047..2048
+ *   1111 + 32 bits      anything else
+ * Each n bit field holds dod plus 2^(n-1) - 1.
+ *
+ * Following values store the XOR with the previous value of the field:
+ *   0                   unchanged
+ *   10 + meaningful bits, reusing the previous leading/trailing zero window
+ *   11 + 5 bits leading zeros + 5 bits (length - 1) + length meaningful bits
+ */
+
+#include <string.h>
+#include "telemetry.h"
+
+void GorillaTelemetryEncoder::begin(uint8_t *buf, size_t size, bool batch)
+{
+  TelemetryWriter::begin(buf, size, batch);
+  memset(&_state, 0, sizeof(_state));
+  _overflow = !room(TELEMETRY_GORILLA_HEADER);
+  if (!_overflow)
+  {
+    put(TELEMETRY_GORILLA_MAGIC);
+    put(TELEMETRY_GORILLA_VERSION);
+    put(0); // count, filled in by end()
+    put(0);
+  }
+  _state.bits = _len * 8;
+}
+
+void GorillaTelemetryEncoder::writeBits(uint32_t value, uint8_t count)
+{
+  if (_state.bits + count > _size * 8)
+  {
+    _overflow = true;
+    return;
+  }
+  while (count-- > 0)
+  {
+    uint8_t mask = 0x80 >> (_state.bits & 7);
+    if ((value >> count) & 1)
+    {
+      _buf[_state.bits >> 3] |= mask;
+    }
+    else
+    {
+      _buf[_state.bits >> 3] &= ~mask;
+    }
+    _state.bits++;
+  }
+}
+
+void GorillaTelemetryEncoder::writeTimestamp(uint32_t timestamp)
+{
+  int32_t delta = (int32_t)(timestamp - _state.timestamp);
+  int32_t dod = delta - _state.delta;
+
+  if (dod == 0)
+  {
+    writeBits(0, 1);
+  }
+  else if (dod >= -63 && dod <= 64)
+  {
+    writeBits(0x2, 2);
+    writeBits(dod + 63, 7);
+  }
+  else if (dod >= -255 && dod <= 256)
+  {
+    writeBits(0x6, 3);
+    writeBits(dod + 255, 9);
+  }
+  else if (dod >= -2047 && dod <= 2048)
+  {
+    writeBits(0xe, 4);
+    writeBits(dod + 2047, 12);
+  }
+  else
+  {
+    writeBits(0xf, 4);
+    writeBits((uint32_t)dod, 32);
+  }
+  _state.timestamp = timestamp;
+  _state.delta = delta;
+}
+
+void GorillaTelemetryEncoder::writeValue(uint8_t index, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32_t x = bits ^ _state.value[index];
+
+  if (x == 0)
+  {
+    writeBits(0, 1);
+    return;
+  }
+
+  uint8_t leading = __builtin_clz(x);
+  uint8_t trailing = __builtin_ctz(x);
+
+  if (_state.leading[index] + _state.trailing[index] > 0 &&
+      leading >= _state.leading[index] && trailing >= _state.trailing[index])
+  {
+    writeBits(0x2, 2);
+    writeBits(x >> _state.trailing[index], 32 - _state.leading[index] - _state.trailing[index]);
+  }
+  else
+  {
+    uint8_t length = 32 - leading - trailing;
+    writeBits(0x3, 2);
+    writeBits(leading, 5);
+    writeBits(length - 1, 5);
+    writeBits(x >> trailing, length);
+    _state.leading[index] = leading;
+    _state.trailing[index] = trailing;
+  }
+  _state.value[index] = bits;
+}
+
+bool GorillaTelemetryEncoder::add(const sensor_data &data)
+{
+  const float values[] = {data.temperature, data.humidity, data.pressure, data.gasResistance};
+  State saved = _state;
+
+  if (_overflow || !room(0))
+  {
+    return false;
+  }
+
+  if (_count == 0)
+  {
+    uint32_t bits;
+    writeBits((uint32_t)data.timestamp, 32);
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      memcpy(&bits, &values[i], sizeof(bits));
+      writeBits(bits, 32);
+      _state.value[i] = bits;
+    }
+    _state.timestamp = (uint32_t)data.timestamp;
+  }
+  else
+  {
+    writeTimestamp((uint32_t)data.timestamp);
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      writeValue(i, values[i]);
+    }
+  }
+
+  if (_overflow)
+  {
+    _state = saved;
+    return false;
+  }
+  _count++;
+  return true;
+}
+
+size_t GorillaTelemetryEncoder::end()
+{
+  if (_len < TELEMETRY_GORILLA_HEADER)
+  {
+    return 0;
+  }
+  _buf[2] = _count & 0xff;
+  _buf[3] = _count >> 8;
+  _len = (_state.bits + 7) / 8;
+  return _len;
+}
@@ -0,0 +1,123 @@
+#ifndef SENSOR_DATA_H
+#define SENSOR_DATA_H
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+
+// Fields measured in a reading; the others are NAN
+#define SENSOR_FRESH_TEMPERATURE 0x01
+#define SENSOR_FRESH_HUMIDITY 0x02
+#define SENSOR_FRESH_PRESSURE 0x04
+#define SENSOR_FRESH_GAS 0x08
+#define SENSOR_FRESH_ALL 0x0f
+
+struct sensor_data
+{
+  time_t timestamp;
+  float temperature;   // ºC
+  float humidity;      // %
+  float pressure;      // hPa
+  float gasResistance; // KOhm
+  uint8_t fresh;       // SENSOR_FRESH_*
+};
+
+/* Fixed-point form of sensor_data for the RAM buffer, 12 bytes instead of
+ * 24. Precision is well below the BME680's noise:
+ *
+ *   timestamp      seconds since SAMPLE_EPOCH, until 2156
+ *   temperature    0.01 ºC, -327.68..327.67 ºC
+ *   humidity       0.01 %, 0..655.35 %
+ *   pressure       0.02 hPa, 0..1310.7 hPa
+ *   gas            log2(Ohm) * 2048, 0.034 % steps up to 4.2 GOhm; 0 is 0 Ohm
+ *
+ * Values outside a range are clamped to it. The lowest temperature and the
+ * highest other values stand for a field that wasn't measured; a NaN
+ * reading is stored the same way, so it comes back as not fresh instead of
+ * a clamped extreme.
+ */
+#define SAMPLE_EPOCH 1577836800UL // 2020-01-01 00:00:00 UTC
+#define SAMPLE_NONE_SIGNED INT16_MIN
+#define SAMPLE_NONE UINT16_MAX
+
+struct packed_sensor_data
+{
+  uint32_t timestamp;
+  int16_t temperature;
+  uint16_t humidity;
+  uint16_t pressure;
+  uint16_t gas;
+};
+
+static_assert(sizeof(packed_sensor_data) == 12, "packed_sensor_data should be 12 bytes");
+
+// value must not be NaN, see sample_field()
+static inline long sample_fixed(float value, float scale, long min, long max)
+{
+  float scaled = roundf(value * scale);
+  if (!(scaled > min))
+  {
+    return min;
+  }
+  return scaled < max ? (long)scaled : max;
+}
+
+// A field that wasn't measured or read as NaN becomes none
+static inline long sample_field(const sensor_data &data, uint8_t flag, float value, float scale, long min, long max, long none)
+{
+  return (data.fresh & flag) && !isnan(value) ? sample_fixed(value, scale, min, max) : none;
+}
+
+static inline packed_sensor_data pack_sensor_data(const sensor_data &data)
+{
+  packed_sensor_data packed;
+  float ohm = data.gasResistance * 1000.0f;
+
+  packed.timestamp = data.timestamp > (time_t)SAMPLE_EPOCH ? (uint32_t)(data.timestamp - SAMPLE_EPOCH) : 0;
+  packed.temperature = sample_field(data, SENSOR_FRESH_TEMPERATURE, data.temperature, 100.0f, INT16_MIN + 1, INT16_MAX, SAMPLE_NONE_SIGNED);
+  packed.humidity = sample_field(data, SENSOR_FRESH_HUMIDITY, data.humidity, 100.0f, 0, UINT16_MAX - 1, SAMPLE_NONE);
+  packed.pressure = sample_field(data, SENSOR_FRESH_PRESSURE, data.pressure, 50.0f, 0, UINT16_MAX - 1, SAMPLE_NONE);
+  if (!(data.fresh & SENSOR_FRESH_GAS) || isnan(ohm))
+  {
+    packed.gas = SAMPLE_NONE;
+  }
+  else
+  {
+    packed.gas = ohm >= 1.0f ? sample_fixed(log2f(ohm), 2048.0f, 1, UINT16_MAX - 1) : 0;
+  }
+  return packed;
+}
+
+static inline sensor_data unpack_sensor_data(const packed_sensor_data &packed)
+{
+  sensor_data data;
+
+  data.timestamp = (time_t)SAMPLE_EPOCH + packed.timestamp;
+  data.temperature = packed.temperature / 100.0f;
+  data.humidity = packed.humidity / 100.0f;
+  data.pressure = packed.pressure / 50.0f;
+  data.gasResistance = packed.gas > 0 ? exp2f(packed.gas / 2048.0f) / 1000.0f : 0.0f;
+  data.fresh = SENSOR_FRESH_ALL;
+  if (packed.temperature == SAMPLE_NONE_SIGNED)
+  {
+    data.temperature = NAN;
+    data.fresh &= ~SENSOR_FRESH_TEMPERATURE;
+  }
+  if (packed.humidity == SAMPLE_NONE)
+  {
+    data.humidity = NAN;
+    data.fresh &= ~SENSOR_FRESH_HUMIDITY;
+  }
+  if (packed.pressure == SAMPLE_NONE)
+  {
+    data.pressure = NAN;
+    data.fresh &= ~SENSOR_FRESH_PRESSURE;
+  }
+  if (packed.gas == SAMPLE_NONE)
+  {
+    data.gasResistance = NAN;
+    data.fresh &= ~SENSOR_FRESH_GAS;
+  }
+  return data;
+}
+
+#endif
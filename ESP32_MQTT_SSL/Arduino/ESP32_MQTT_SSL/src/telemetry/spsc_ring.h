@@ -0,0 +1,97 @@
+/* Lock-free ring buffer for exactly one producer and one consumer, such as
+ * two tasks pinned to different cores.
+ *
+ * The producer only calls push(); everything else belongs to the consumer.
+ * head is written by the producer and tail by the consumer, each with a
+ * release store that the other side loads with acquire, so a slot is fully
+ * written before it becomes visible and fully read before it is reused.
+ *
+ * Both positions run over 0..2N-1, which tells a full ring from an empty one
+ * without giving up a slot. Unlike CircularBuffer, push() on a full ring
+ * fails instead of overwriting the oldest element, which only the consumer
+ * may remove.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+#include <stddef.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SpscRing
+{
+public:
+  static constexpr size_t capacity = N;
+
+  // Producer
+  bool push(const T &value)
+  {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (distance(head, _tail.load(std::memory_order_acquire)) == N)
+    {
+      return false;
+    }
+    _slots[slot(head)] = value;
+    _head.store(next(head), std::memory_order_release);
+    return true;
+  }
+
+  // Consumer
+  size_t size() const
+  {
+    return distance(_head.load(std::memory_order_acquire), _tail.load(std::memory_order_relaxed));
+  }
+  bool isEmpty() const
+  {
+    return size() == 0;
+  }
+  bool isFull() const
+  {
+    return size() == N;
+  }
+  // Oldest first; index must be below size()
+  const T &operator[](size_t index) const
+  {
+    return _slots[slot(advance(_tail.load(std::memory_order_relaxed), index))];
+  }
+  const T &first() const
+  {
+    return (*this)[0];
+  }
+  const T &last() const
+  {
+    return (*this)[size() - 1];
+  }
+  T shift()
+  {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    T value = _slots[slot(tail)];
+    _tail.store(next(tail), std::memory_order_release);
+    return value;
+  }
+
+private:
+  T _slots[N];
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+
+  static size_t slot(size_t position)
+  {
+    return position < N ? position : position - N;
+  }
+  static size_t next(size_t position)
+  {
+    return position + 1 < 2 * N ? position + 1 : 0;
+  }
+  static size_t advance(size_t position, size_t count)
+  {
+    position += count;
+    return position < 2 * N ? position : position - 2 * N;
+  }
+  static size_t distance(size_t head, size_t tail)
+  {
+    return head >= tail ? head - tail : head + 2 * N - tail;
+  }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include <string.h>
+#include <ArduinoJson.h>
+#include "telemetry.h"
+
+// TelemetryWriter
+
+void TelemetryWriter::begin(uint8_t *buf, size_t size, bool batch)
+{
+  _buf = buf;
+  _size = size;
+  _len = 0;
+  _count = 0;
+  _batch = batch;
+}
+
+// True if len bytes fit and reserve more are still left over for end()
+bool TelemetryWriter::room(size_t len, size_t reserve)
+{
+  if (!_batch && _count > 0)
+  {
+    return false;
+  }
+  return _len + len + reserve <= _size;
+}
+
+void TelemetryWriter::put(uint8_t b)
+{
+  _buf[_len++] = b;
+}
+
+void TelemetryWriter::put(const void *data, size_t len)
+{
+  memcpy(_buf + _len, data, len);
+  _len += len;
+}
+
+void TelemetryWriter::putBigEndian(uint32_t value)
+{
+  put(value >> 24);
+  put(value >> 16);
+  put(value >> 8);
+  put(value);
+}
+
+// JsonTelemetryEncoder
+
+void JsonTelemetryEncoder::begin(uint8_t *buf, size_t size, bool batch)
+{
+  TelemetryWriter::begin(buf, size, batch);
+  if (_batch)
+  {
+    put('[');
+  }
+}
+
+bool JsonTelemetryEncoder::add(const sensor_data &data)
+{
+  StaticJsonDocument<200> json_doc; // on the stack, no heap per record
+  size_t separator = _count > 0 ? 1 : 0;
+
+  // Fields that weren't measured are left out
+  json_doc["timestamp"] = data.timestamp;
+  if (data.fresh & SENSOR_FRESH_TEMPERATURE)
+  {
+    json_doc["temperature"] = data.temperature;
+  }
+  if (data.fresh & SENSOR_FRESH_HUMIDITY)
+  {
+    json_doc["humidity"] = data.humidity;
+  }
+  if (data.fresh & SENSOR_FRESH_PRESSURE)
+  {
+    json_doc["pressure"] = data.pressure;
+  }
+  if (data.fresh & SENSOR_FRESH_GAS)
+  {
+    json_doc["gasResistance"] = data.gasResistance;
+  }
+
+  // Keep room for the closing bracket and the terminator
+  if (!room(separator + measureJson(json_doc), _batch ? 2 : 1))
+  {
+    return false;
+  }
+  if (separator)
+  {
+    put(',');
+  }
+  _len += serializeJson(json_doc, (char *)_buf + _len, _size - _len);
+  _count++;
+  return true;
+}
+
+// The payload stays NUL-terminated so it can be printed as is
+size_t JsonTelemetryEncoder::end()
+{
+  if (_batch)
+  {
+    put(']');
+  }
+  _buf[_len] = '\0';
+  return _len;
+}
+
+// CborTelemetryEncoder
+
+#define CBOR_RECORD_SIZE (1 + 1 + 5 + 4 * (1 + 5))
+
+void CborTelemetryEncoder::begin(uint8_t *buf, size_t size, bool batch)
+{
+  TelemetryWriter::begin(buf, size, batch);
+  if (_batch)
+  {
+    put(0x9f); // indefinite-length array
+  }
+}
+
+bool CborTelemetryEncoder::add(const sensor_data &data)
+{
+  const float values[] = {data.temperature, data.humidity, data.pressure, data.gasResistance};
+  uint8_t fields = 1;
+
+  if (!room(CBOR_RECORD_SIZE, _batch ? 1 : 0))
+  {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    fields += (data.fresh >> i) & 1;
+  }
+  put(0xa0 | fields); // map, without the fields that weren't measured
+  put(0x00);
+  put(0x1a); // uint32
+  putBigEndian((uint32_t)data.timestamp);
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    uint32_t bits;
+    if (!(data.fresh & (1 << i)))
+    {
+      continue;
+    }
+    memcpy(&bits, &values[i], sizeof(bits));
+    put(i + 1);
+    put(0xfa); // float32
+    putBigEndian(bits);
+  }
+  _count++;
+  return true;
+}
+
+size_t CborTelemetryEncoder::end()
+{
+  if (_batch)
+  {
+    put(0xff); // break
+  }
+  return _len;
+}
+
+// PackedTelemetryEncoder
+
+void PackedTelemetryEncoder::begin(uint8_t *buf, size_t size, bool batch)
+{
+  TelemetryWriter::begin(buf, size, batch);
+  if (room(TELEMETRY_PACKED_HEADER))
+  {
+    put(TELEMETRY_PACKED_MAGIC);
+    put(TELEMETRY_PACKED_VERSION);
+    put(0); // count, filled in by end()
+    put(0);
+  }
+}
+
+bool PackedTelemetryEncoder::add(const sensor_data &data)
+{
+  uint32_t timestamp = data.timestamp;
+
+  if (_len < TELEMETRY_PACKED_HEADER || !room(TELEMETRY_PACKED_RECORD))
+  {
+    return false;
+  }
+
+  put(&timestamp, sizeof(timestamp));
+  put(&data.temperature, sizeof(float));
+  put(&data.humidity, sizeof(float));
+  put(&data.pressure, sizeof(float));
+  put(&data.gasResistance, sizeof(float));
+  _count++;
+  return true;
+}
+
+size_t PackedTelemetryEncoder::end()
+{
+  if (_len < TELEMETRY_PACKED_HEADER)
+  {
+    return 0;
+  }
+  _buf[2] = _count & 0xff;
+  _buf[3] = _count >> 8;
+  return _len;
+}
@@ -0,0 +1,129 @@
+/* Payload encoders for sensor_data records.
+ *
+ * All encoders share one interface: begin() on a buffer, add() records
+ * until it returns false, end() returns the payload length. With batch set
+ * a payload holds any number of records, otherwise exactly one.
+ *
+ *   JSON    {"timestamp":..,"temperature":..,..} or an array of them
+ *   CBOR    map {0: timestamp, 1: temperature, 2: humidity, 3: pressure,
+ *           4: gasResistance} with float32 values, or an indefinite array
+ *   PACKED  'P', version, uint16 count, then per record uint32 timestamp
+ *           and four float32, all little endian
+ *   GORILLA 'G', version, uint16 count, then a bit stream compressing the
+ *           timestamps as delta-of-delta and each value as the XOR with
+ *           its predecessor (see gorilla.cpp)
+ *
+ * Fields not measured in a reading (sensor_data.fresh) are left out of JSON
+ * and CBOR records and are NaN in the other two.
+ *
+ * TELEMETRY_FORMAT picks the one the sketch uses as TelemetryEncoder.
+ * tools/mqtt_decode.py decodes all of them.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <stdint.h>
+#include <stddef.h>
+#include "sensor_data.h"
+
+#define TELEMETRY_FORMAT_JSON 0
+#define TELEMETRY_FORMAT_CBOR 1
+#define TELEMETRY_FORMAT_PACKED 2
+#define TELEMETRY_FORMAT_GORILLA 3
+
+#ifndef TELEMETRY_FORMAT
+#define TELEMETRY_FORMAT TELEMETRY_FORMAT_JSON
+#endif
+
+#define TELEMETRY_PACKED_MAGIC 'P'
+#define TELEMETRY_PACKED_VERSION 1
+#define TELEMETRY_PACKED_HEADER 4
+#define TELEMETRY_PACKED_RECORD 20
+
+#define TELEMETRY_GORILLA_MAGIC 'G'
+#define TELEMETRY_GORILLA_VERSION 1
+#define TELEMETRY_GORILLA_HEADER 4
+
+class TelemetryWriter
+{
+public:
+  void begin(uint8_t *buf, size_t size, bool batch);
+  uint16_t count()
+  {
+    return _count;
+  }
+
+protected:
+  uint8_t *_buf;
+  size_t _size;
+  size_t _len;
+  uint16_t _count;
+  bool _batch;
+
+  bool room(size_t len, size_t reserve = 0);
+  void put(uint8_t b);
+  void put(const void *data, size_t len);
+  void putBigEndian(uint32_t value);
+};
+
+class JsonTelemetryEncoder : public TelemetryWriter
+{
+public:
+  void begin(uint8_t *buf, size_t size, bool batch);
+  bool add(const sensor_data &data);
+  size_t end();
+};
+
+class CborTelemetryEncoder : public TelemetryWriter
+{
+public:
+  void begin(uint8_t *buf, size_t size, bool batch);
+  bool add(const sensor_data &data);
+  size_t end();
+};
+
+class PackedTelemetryEncoder : public TelemetryWriter
+{
+public:
+  void begin(uint8_t *buf, size_t size, bool batch);
+  bool add(const sensor_data &data);
+  size_t end();
+};
+
+// Records that don't fit are rolled back, so add() can fill a buffer to the last bit
+class GorillaTelemetryEncoder : public TelemetryWriter
+{
+public:
+  void begin(uint8_t *buf, size_t size, bool batch);
+  bool add(const sensor_data &data);
+  size_t end();
+
+protected:
+  struct State
+  {
+    uint32_t bits;
+    uint32_t timestamp;
+    int32_t delta;
+    uint32_t value[4];
+    uint8_t leading[4];
+    uint8_t trailing[4];
+  };
+  State _state;
+  bool _overflow;
+
+  void writeBits(uint32_t value, uint8_t count);
+  void writeTimestamp(uint32_t timestamp);
+  void writeValue(uint8_t index, float value);
+};
+
+#if (TELEMETRY_FORMAT == TELEMETRY_FORMAT_CBOR)
+typedef CborTelemetryEncoder TelemetryEncoder;
+#elif (TELEMETRY_FORMAT == TELEMETRY_FORMAT_PACKED)
+typedef PackedTelemetryEncoder TelemetryEncoder;
+#elif (TELEMETRY_FORMAT == TELEMETRY_FORMAT_GORILLA)
+typedef GorillaTelemetryEncoder TelemetryEncoder;
+#else
+typedef JsonTelemetryEncoder TelemetryEncoder;
+#endif
+
+#endif
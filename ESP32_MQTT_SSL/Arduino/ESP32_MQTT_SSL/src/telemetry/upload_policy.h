@@ -0,0 +1,57 @@
+/* When a wake brings the radio up. Readings are taken on every wake either
+ * way; an upload is due once the buffer holds enough of them, the oldest
+ * has waited long enough or the temperature moved since the last upload.
+ * A limit of 0 is never hit.
+ */
+
+#ifndef UPLOAD_POLICY_H
+#define UPLOAD_POLICY_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "sensor_data.h"
+
+struct upload_policy
+{
+  size_t min_records;        // buffered readings
+  uint32_t max_age;          // seconds the oldest reading may wait
+  int16_t temperature_delta; // 0.01 ºC since the last upload
+};
+
+struct upload_state
+{
+  size_t buffered;
+  uint32_t oldest_age;          // seconds since the oldest buffered reading
+  int16_t temperature;          // newest buffered reading, packed
+  int16_t uploaded_temperature; // packed, SAMPLE_NONE_SIGNED until the first upload
+  bool backlog;                 // archive blocks left over from a failed upload
+};
+
+static inline bool upload_is_due(const upload_policy &policy, const upload_state &state)
+{
+  if (state.backlog)
+  {
+    return true;
+  }
+  if (state.buffered == 0)
+  {
+    return false;
+  }
+  if (policy.min_records > 0 && state.buffered >= policy.min_records)
+  {
+    return true;
+  }
+  if (policy.max_age > 0 && state.oldest_age >= policy.max_age)
+  {
+    return true;
+  }
+  // A reading without temperature neither triggers nor holds back
+  if (policy.temperature_delta == 0 || state.temperature == SAMPLE_NONE_SIGNED)
+  {
+    return false;
+  }
+  return state.uploaded_temperature == SAMPLE_NONE_SIGNED ||
+         abs(state.temperature - state.uploaded_temperature) >= policy.temperature_delta;
+}
+
+#endif
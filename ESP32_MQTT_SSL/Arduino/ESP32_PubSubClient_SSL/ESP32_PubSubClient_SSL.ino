@@ -4,6 +4,9 @@
 #include <time.h>
 #include <PubSubClient.h>
 //#include "secrets.h"
+#if __has_include("certs_der.h")
+#include "certs_der.h" // generated by tools/pem_to_der.py
+#endif
 
 #ifndef SECRET
   const char ssid[] = "WiFiSSID";
@@ -125,7 +128,12 @@ void setup()
   Serial.print("Current time: ");
   Serial.print(asctime(&timeinfo));
 
+#ifdef LOCAL_ROOT_CA_DER
+  net.setCACert(local_root_ca_der, local_root_ca_der_len);
+#else
   net.setCACert(local_root_ca);
+#endif
+  net.setWriteCoalescing(true); // one TLS record per MQTT packet
   client.setServer(MQTT_HOST, MQTT_PORT);
   client.setCallback(receivedCallback);
   mqtt_connect();
@@ -22,6 +22,7 @@
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
 #include <errno.h>
+#include "dns_cache.h"
 
 #undef connect
 #undef write
@@ -35,10 +36,31 @@ WiFiClientSecure::WiFiClientSecure()
     sslclient = new sslclient_context;
     ssl_init(sslclient);
     sslclient->socket = -1;
+    ssl_credentials_init(&_credentials);
 
     _CA_cert = NULL;
     _cert = NULL;
     _private_key = NULL;
+    _CA_cert_len = 0;
+    _cert_len = 0;
+    _private_key_len = 0;
+    _tx_len = 0;
+    _tx_coalesce = false;
+    _tx_mqtt_framing = false;
+    _mqtt_header_bytes = 0;
+    _mqtt_remaining = 0;
+    _mqtt_multiplier = 1;
+    _tx_buf = NULL;
+    _tx_size = WIFICLIENTSECURE_TX_BUFFER_SIZE;
+    _rx_buf = NULL;
+    _rx_size = WIFICLIENTSECURE_RX_BUFFER_SIZE;
+    _rx_pos = 0;
+    _rx_len = 0;
+    _max_fragment_length = 0;
+    _host = NULL;
+    _address = 0;
+    _port = 0;
+    _resolving = false;
 	next = NULL;			
 }
 
@@ -50,6 +72,7 @@ WiFiClientSecure::WiFiClientSecure(int sock)
     sslclient = new sslclient_context;
     ssl_init(sslclient);
     sslclient->socket = sock;
+    ssl_credentials_init(&_credentials);
 
     if (sock >= 0) {
         _connected = true;
@@ -58,12 +81,39 @@ WiFiClientSecure::WiFiClientSecure(int sock)
     _CA_cert = NULL;
     _cert = NULL;
     _private_key = NULL;
-    next = NULL;				
+    _CA_cert_len = 0;
+    _cert_len = 0;
+    _private_key_len = 0;
+    _tx_len = 0;
+    _tx_coalesce = false;
+    _tx_mqtt_framing = false;
+    _mqtt_header_bytes = 0;
+    _mqtt_remaining = 0;
+    _mqtt_multiplier = 1;
+    _tx_buf = NULL;
+    _tx_size = WIFICLIENTSECURE_TX_BUFFER_SIZE;
+    _rx_buf = NULL;
+    _rx_size = WIFICLIENTSECURE_RX_BUFFER_SIZE;
+    _rx_pos = 0;
+    _rx_len = 0;
+    _max_fragment_length = 0;
+    _host = NULL;
+    _address = 0;
+    _port = 0;
+    _resolving = false;
+    next = NULL;
+
+    if (_connected && !allocateBuffers()) {
+        _connected = false;
+    }
 }
 
 WiFiClientSecure::~WiFiClientSecure()
 {
     stop();
+    ssl_credentials_free(&_credentials);
+    ssl_clear_pin(sslclient);
+    freeBuffers();
 }
 
 WiFiClientSecure &WiFiClientSecure::operator=(const WiFiClientSecure &other)
@@ -76,45 +126,189 @@ WiFiClientSecure &WiFiClientSecure::operator=(const WiFiClientSecure &other)
 
 void WiFiClientSecure::stop()
 {
+    if (_connected && _tx_len > 0) {
+        flush();
+    }
+    _tx_len = 0;
+    _mqtt_header_bytes = 0;
+    _mqtt_remaining = 0;
+    _rx_pos = 0;
+    _rx_len = 0;
+    _host = NULL;
+    _resolving = false;
+
     if (sslclient->socket >= 0) {
         close(sslclient->socket);
         sslclient->socket = -1;
         _connected = false;
     }
-    stop_ssl_socket(sslclient, _CA_cert, _cert, _private_key);
+    stop_ssl_socket(sslclient);
 }
 
 int WiFiClientSecure::connect(IPAddress ip, uint16_t port)
 {
-    return connect(ip, port, _CA_cert, _cert, _private_key);
+    if (!allocateBuffers()) {
+        return 0;
+    }
+    int ret = ssl_credentials_load(&_credentials, (const unsigned char *)_CA_cert, _CA_cert_len,
+                                   (const unsigned char *)_cert, _cert_len,
+                                   (const unsigned char *)_private_key, _private_key_len);
+    if (ret == 0) {
+        ret = start_ssl_client(sslclient, ip, port, &_credentials);
+        if (ret < 0 && sslclient->mfl_fallback) {
+            log_w("Retrying without max fragment length");
+            stop();
+            ret = start_ssl_client(sslclient, ip, port, &_credentials);
+        }
+    }
+    if (ret < 0) {
+        log_e("lwip_connect_r: %d", errno);
+        stop();
+        return 0;
+    }
+    _connected = true;
+    return 1;
 }
 
+/* Reconnects reuse the cached address; it is dropped again if the
+   connection fails, so a moved broker is looked up on the next attempt. */
 int WiFiClientSecure::connect(const char *host, uint16_t port)
 {
-    return connect(host, port, _CA_cert, _cert, _private_key);
+    uint32_t addr;
+    if (!dns_cache_lookup(host, &addr)) {
+        struct hostent *server;
+        server = gethostbyname(host);
+        if (server == NULL) {
+            return 0;
+        }
+        memcpy(&addr, server->h_addr, sizeof(addr));
+        dns_cache_store(host, addr);
+    }
+    if (!connect(IPAddress(addr), port)) {
+        dns_cache_invalidate(host);
+        return 0;
+    }
+    return 1;
 }
 
-int WiFiClientSecure::connect(IPAddress ip, uint16_t port, const char *_CA_cert, const char *_cert, const char *_private_key)
+/* Starts connecting without waiting for TCP and TLS; call poll() until it
+   returns SSL_STATE_CONNECTED or SSL_STATE_FAILED. Like connect(), a
+   handshake that fails with max fragment length is retried once without it
+   before poll() reports the failure. */
+int WiFiClientSecure::connectAsync(IPAddress ip, uint16_t port)
 {
-    int ret = start_ssl_client(sslclient, ip, port, _CA_cert, _cert, _private_key);
+    if (!allocateBuffers()) {
+        return 0;
+    }
+    _address = ip;
+    _port = port;
+    int ret = ssl_credentials_load(&_credentials, (const unsigned char *)_CA_cert, _CA_cert_len,
+                                   (const unsigned char *)_cert, _cert_len,
+                                   (const unsigned char *)_private_key, _private_key_len);
+    if (ret == 0) {
+        ret = start_ssl_client_async(sslclient, ip, port, &_credentials);
+    }
     if (ret < 0) {
         log_e("lwip_connect_r: %d", errno);
         stop();
         return 0;
     }
-    _connected = true;
     return 1;
 }
 
-int WiFiClientSecure::connect(const char *host, uint16_t port, const char *_CA_cert, const char *_cert, const char *_private_key)
+/* A cache miss doesn't block: the DNS query runs in the background and
+   poll() reports SSL_STATE_CONNECTING until the address is known. */
+int WiFiClientSecure::connectAsync(const char *host, uint16_t port)
 {
-    struct hostent *server;
-    server = gethostbyname(host);
-    if (server == NULL) {
+    uint32_t addr;
+    int state = dns_resolve_start(host, &addr);
+    if (state == DNS_RESOLVE_FAILED) {
         return 0;
     }
-    IPAddress srv((const uint8_t *)(server->h_addr));
-    return connect(srv, port, _CA_cert, _cert, _private_key);
+    if (state == DNS_RESOLVE_DONE && !connectAsync(IPAddress(addr), port)) {
+        dns_cache_invalidate(host);
+        return 0;
+    }
+    _host = host;
+    _port = port;
+    _resolving = state == DNS_RESOLVE_PENDING;
+    return 1;
+}
+
+int WiFiClientSecure::poll()
+{
+    if (_resolving) {
+        uint32_t addr;
+        int resolved = dns_resolve_poll(&addr);
+        if (resolved == DNS_RESOLVE_PENDING) {
+            return SSL_STATE_CONNECTING;
+        }
+        _resolving = false;
+        if (resolved == DNS_RESOLVE_FAILED) {
+            log_e("Could not resolve %s", _host);
+            stop();
+            return SSL_STATE_FAILED;
+        }
+        if (!connectAsync(IPAddress(addr), _port)) {
+            return SSL_STATE_FAILED;
+        }
+    }
+
+    int state = ssl_client_poll(sslclient);
+    if (state == SSL_STATE_CONNECTED) {
+        _connected = true;
+    } else if (state == SSL_STATE_FAILED) {
+        const char *host = _host;
+        bool retry = sslclient->mfl_fallback;
+        stop();
+        if (retry) {
+            log_w("Retrying without max fragment length");
+            if (connectAsync(IPAddress(_address), _port)) {
+                _host = host;
+                return SSL_STATE_CONNECTING;
+            }
+        }
+        if (host != NULL) {
+            dns_cache_invalidate(host);
+        }
+    }
+    return state;
+}
+
+void WiFiClientSecure::setDnsCacheTtl(uint32_t seconds)
+{
+    dns_cache_set_ttl(seconds);
+}
+
+/* Takes effect on the next connect; a connect, handshake or write that
+   exceeds its limit fails instead of waiting on the broker. Reads never
+   block, so ioMs only bounds writes. */
+void WiFiClientSecure::setTimeouts(const sslclient_timeouts &timeouts)
+{
+    sslclient->timeouts = timeouts;
+}
+
+void WiFiClientSecure::setTimeouts(uint32_t connectMs, uint32_t handshakeMs, uint32_t ioMs)
+{
+    sslclient->timeouts.connect_ms = connectMs;
+    sslclient->timeouts.handshake_ms = handshakeMs;
+    sslclient->timeouts.io_ms = ioMs;
+}
+
+int WiFiClientSecure::connect(IPAddress ip, uint16_t port, const char *CA_cert, const char *cert, const char *private_key)
+{
+    setCACert(CA_cert);
+    setCertificate(cert);
+    setPrivateKey(private_key);
+    return connect(ip, port);
+}
+
+int WiFiClientSecure::connect(const char *host, uint16_t port, const char *CA_cert, const char *cert, const char *private_key)
+{
+    setCACert(CA_cert);
+    setCertificate(cert);
+    setPrivateKey(private_key);
+    return connect(host, port);
 }
 
 
@@ -138,60 +332,408 @@ size_t WiFiClientSecure::write(const uint8_t *buf, size_t size)
     if (!_connected) {
         return 0;
     }
-    int res = send_ssl_data(sslclient, buf, size);
-    if (res < 0) {
-						   
-        stop();
-        res = 0;
+    if (!_tx_coalesce) {
+        int res = send_ssl_data(sslclient, buf, size);
+        if (res < 0) {
+            stop();
+            res = 0;
+        }
+        return res;
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        size_t chunk = size - written;
+        if (chunk > _tx_size - _tx_len) {
+            chunk = _tx_size - _tx_len;
+        }
+        memcpy(_tx_buf + _tx_len, buf + written, chunk);
+        _tx_len += chunk;
+        written += chunk;
+
+        if (_tx_len == _tx_size) {
+            flush();
+            if (!_connected) {
+                return 0;
+            }
+        }
+    }
+
+    if (_tx_mqtt_framing && mqttPacketsComplete(buf, size)) {
+        flush();
+        if (!_connected) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+void WiFiClientSecure::flush()
+{
+    size_t sent = 0;
+
+    while (sent < _tx_len) {
+        int res = send_ssl_data(sslclient, _tx_buf + sent, _tx_len - sent);
+        if (res < 0) {
+            _tx_len = 0;
+            stop();
+            return;
+        }
+        sent += res;
     }
-    return res;
+    _tx_len = 0;
+}
+
+/* Follows the MQTT fixed header (packet type byte plus variable length
+   "remaining length") through the written bytes and reports whether the
+   stream ends exactly on a packet boundary. */
+bool WiFiClientSecure::mqttPacketsComplete(const uint8_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (_mqtt_header_bytes > 0) {
+            _mqtt_remaining += (buf[i] & 0x7F) * _mqtt_multiplier;
+            _mqtt_multiplier <<= 7;
+            if ((buf[i] & 0x80) == 0 || ++_mqtt_header_bytes > 4) {
+                _mqtt_header_bytes = 0;
+            }
+        } else if (_mqtt_remaining > 0) {
+            size_t skip = size - i;
+            if (skip > _mqtt_remaining) {
+                skip = _mqtt_remaining;
+            }
+            _mqtt_remaining -= skip;
+            i += skip - 1;
+        } else {
+            _mqtt_header_bytes = 1;
+            _mqtt_multiplier = 1;
+        }
+    }
+    return _mqtt_header_bytes == 0 && _mqtt_remaining == 0;
 }
 
 int WiFiClientSecure::read(uint8_t *buf, size_t size)
 {
-    if (!available()) {
+    int avail = available();
+    if (avail <= 0) {
         return -1;
     }
-    int res = get_ssl_receive(sslclient, buf, size);
-    if (res < 0) {
-							
-        stop();
+    if (size > (size_t)avail) {
+        size = avail;
     }
-    return res;
+    memcpy(buf, _rx_buf + _rx_pos, size);
+    _rx_pos += size;
+    return size;
+}
+
+int WiFiClientSecure::peek()
+{
+    if (available() <= 0) {
+        return -1;
+    }
+    return _rx_buf[_rx_pos];
 }
 
 int WiFiClientSecure::available()
 {
+    if (_rx_pos < _rx_len) {
+        return _rx_len - _rx_pos;
+    }
     if (!_connected) {
         return 0;
     }
-    int res = data_to_read(sslclient);
-    if (res < 0 ) {
-        stop();
-    }	
-    return res;
+    if (_tx_len > 0) {
+        flush();  // the peer can't answer what is still in our buffer
+        if (!_connected) {
+            return 0;
+        }
+    }
+    return fillReadBuffer();
 }
 
-uint8_t WiFiClientSecure::connected()
+/* Drains as much decrypted data as fits into the receive buffer, but only
+   enters mbedtls when the socket or mbedtls actually has bytes pending. */
+int WiFiClientSecure::fillReadBuffer()
 {
-    uint8_t dummy = 0;
-    read(&dummy, 0);
+    int res = ssl_data_pending(sslclient);
+    if (res <= 0) {
+        if (res < 0) {
+            stop();
+        }
+        return 0;
+    }
 
+    res = get_ssl_receive(sslclient, _rx_buf, _rx_size);
+    if (res > 0) {
+        _rx_pos = 0;
+        _rx_len = res;
+        return res;
+    }
+    if (res != MBEDTLS_ERR_SSL_WANT_READ && res != MBEDTLS_ERR_SSL_WANT_WRITE && res != -76) {
+        stop();  // 0 is EOF, everything else a close notify or a fatal error
+    }
+    return 0;
+}
+
+uint8_t WiFiClientSecure::connected()
+{
+    if (_connected && _rx_pos == _rx_len) {
+        fillReadBuffer();
+    }
     return _connected;
 }
 
+/* Collect writes in a record sized buffer instead of sending one TLS record
+   per write() call. The buffer is sent when full, on flush(), before any
+   read and, with MQTT framing, whenever a complete MQTT packet was written. */
+void WiFiClientSecure::setWriteCoalescing(bool enable, bool flushOnMqttPacket)
+{
+    if (!enable && _connected && _tx_len > 0) {
+        flush();
+    }
+    _tx_coalesce = enable;
+    _tx_mqtt_framing = enable && flushOnMqttPacket;
+    _mqtt_header_bytes = 0;
+    _mqtt_remaining = 0;
+}
+
+/* Sizes this wrapper's own buffers, the decrypted data drained from
+   mbedtls and the write coalescing buffer. They come on top of the mbedtls
+   record buffers, whose size MBEDTLS_SSL_IN/OUT_CONTENT_LEN fix when the
+   core is built; only setMaxFragmentLength() makes the server's records
+   smaller. The buffers are allocated on the first connect and kept for the
+   lifetime of the client, so the sizes can't change while connected. */
+bool WiFiClientSecure::setBufferSizes(size_t rxSize, size_t txSize)
+{
+    if (_connected) {
+        log_w("Buffer sizes can't change while connected");
+        return false;
+    }
+    freeBuffers();
+    _rx_size = rxSize;
+    _tx_size = txSize;
+    return true;
+}
+
+bool WiFiClientSecure::allocateBuffers()
+{
+    if (_rx_buf == NULL) {
+        _rx_buf = (uint8_t *)malloc(_rx_size);
+    }
+    if (_tx_buf == NULL) {
+        _tx_buf = (uint8_t *)malloc(_tx_size);
+    }
+    if (_rx_buf == NULL || _tx_buf == NULL) {
+        log_e("Not enough memory for %u/%u byte buffers", _rx_size, _tx_size);
+        freeBuffers();
+        return false;
+    }
+    return true;
+}
+
+void WiFiClientSecure::freeBuffers()
+{
+    free(_rx_buf);
+    free(_tx_buf);
+    _rx_buf = NULL;
+    _tx_buf = NULL;
+}
+
+/* Ask the server for smaller records (RFC 6066), which lets the write
+   buffer and, with MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH, mbedtls' own record
+   buffers shrink. 0 disables the extension. If the broker rejects the
+   handshake, the client falls back to connecting without it for the next
+   SSL_MFL_RETRY_CONNECTS connections, then asks again. */
+void WiFiClientSecure::setMaxFragmentLength(uint16_t length)
+{
+    switch (length) {
+    case 512:
+        sslclient->mfl_code = MBEDTLS_SSL_MAX_FRAG_LEN_512;
+        break;
+    case 1024:
+        sslclient->mfl_code = MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+        break;
+    case 2048:
+        sslclient->mfl_code = MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+        break;
+    case 4096:
+        sslclient->mfl_code = MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+        break;
+    default:
+        length = 0;
+        sslclient->mfl_code = MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+        break;
+    }
+    _max_fragment_length = length;
+    sslclient->mfl_skip = 0;
+    if (length != 0 && _tx_size > length) {
+        setBufferSizes(_rx_size, length);
+    }
+}
+
+void WiFiClientSecure::setCipherProfile(sslclient_profile profile)
+{
+    if (profile != sslclient->profile) {
+        ssl_clear_session(sslclient);
+    }
+    sslclient->profile = profile;
+}
+
+/* Parses a hex string into out, skipping ':' and ' ' separators.
+   Returns the number of bytes, or 0 if the string is malformed or too long. */
+static size_t parseHex(const char *hex, uint8_t *out, size_t size)
+{
+    size_t len = 0;
+    bool high = true;
+
+    for (; *hex != '\0'; hex++) {
+        char c = *hex;
+        uint8_t nibble;
+        if (c == ':' || c == ' ') {
+            if (!high) {
+                return 0;
+            }
+            continue;
+        } else if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else {
+            return 0;
+        }
+        if (high) {
+            if (len == size) {
+                return 0;
+            }
+            out[len] = nibble << 4;
+        } else {
+            out[len++] |= nibble;
+        }
+        high = !high;
+    }
+    return high ? len : 0;
+}
+
+/* Switches to the PSK profile. The key is given as hex string, as in
+   mosquitto's psk_file, e.g. setPreSharedKey("sensor1", "a1b2c3..."). */
+bool WiFiClientSecure::setPreSharedKey(const char *identity, const char *pskHex)
+{
+    uint8_t psk[sizeof(sslclient->psk)];
+    size_t len = pskHex != NULL ? parseHex(pskHex, psk, sizeof(psk)) : 0;
+    if (identity == NULL || identity[0] == '\0' || strlen(identity) > SSL_PSK_IDENTITY_MAX || len == 0) {
+        log_e("Invalid pre-shared key");
+        return false;
+    }
+
+    memcpy(sslclient->psk, psk, len);
+    sslclient->psk_len = len;
+    strcpy(sslclient->psk_identity, identity);
+    ssl_clear_session(sslclient);
+    setCipherProfile(SSL_PROFILE_PSK);
+    return true;
+}
+
+/* Pinning replaces CA verification: only the server certificate is
+   compared, against its public key (PEM) or its SHA-1/SHA-256
+   fingerprint ("AA:BB:..."). Passing NULL goes back to the CA. A pin
+   that doesn't parse returns false and blocks connecting until a valid
+   one is set, rather than falling back to the CA or no check at all. */
+bool WiFiClientSecure::setPinnedPublicKey(const char *publicKey)
+{
+    if (publicKey == NULL) {
+        ssl_clear_pin(sslclient);
+        return true;
+    }
+    return ssl_pin_public_key(sslclient, (const unsigned char *)publicKey, 0) == 0;
+}
+
+bool WiFiClientSecure::setPinnedPublicKey(const uint8_t *publicKey, size_t len)
+{
+    if (publicKey == NULL || len == 0) {
+        log_e("Invalid pinned public key");
+        ssl_pin_public_key(sslclient, NULL, 0);
+        return false;
+    }
+    return ssl_pin_public_key(sslclient, publicKey, len) == 0;
+}
+
+bool WiFiClientSecure::setFingerprint(const char *fingerprint)
+{
+    uint8_t fp[32];
+    size_t len;
+
+    if (fingerprint == NULL) {
+        ssl_clear_pin(sslclient);
+        return true;
+    }
+    len = parseHex(fingerprint, fp, sizeof(fp));
+    if (ssl_pin_fingerprint(sslclient, fp, len) != 0) {
+        log_e("Fingerprint must be 20 (SHA-1) or 32 (SHA-256) hex bytes");
+        return false;
+    }
+    return true;
+}
+
+/* A session was verified against, or authenticated with, the credentials
+   in use when it was made, so changing them also forgets the session. */
 void WiFiClientSecure::setCACert (const char *rootCA)
 {
-    _CA_cert = rootCA;
+    setCACert((const uint8_t *)rootCA, 0);
 }
 
 void WiFiClientSecure::setCertificate (const char *client_ca)
 {
-    _cert = client_ca;
+    setCertificate((const uint8_t *)client_ca, 0);
 }
 
 void WiFiClientSecure::setPrivateKey (const char *private_key)
 {
-    _private_key = private_key;
+    setPrivateKey((const uint8_t *)private_key, 0);
+}
+
+void WiFiClientSecure::setCACert (const uint8_t *rootCA, size_t len)
+{
+    if ((const char *)rootCA != _CA_cert || len != _CA_cert_len) {
+        ssl_clear_session(sslclient);
+    }
+    _CA_cert = (const char *)rootCA;
+    _CA_cert_len = len;
+}
+
+void WiFiClientSecure::setCertificate (const uint8_t *client_ca, size_t len)
+{
+    if ((const char *)client_ca != _cert || len != _cert_len) {
+        ssl_clear_session(sslclient);
+    }
+    _cert = (const char *)client_ca;
+    _cert_len = len;
 }
 
+void WiFiClientSecure::setPrivateKey (const uint8_t *private_key, size_t len)
+{
+    if ((const char *)private_key != _private_key || len != _private_key_len) {
+        ssl_clear_session(sslclient);
+    }
+    _private_key = (const char *)private_key;
+    _private_key_len = len;
+}
+
+void WiFiClientSecure::clearSession()
+{
+    ssl_clear_session(sslclient);
+}
+
+size_t WiFiClientSecure::saveSession(uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+    if (ssl_session_save(sslclient, buf, size, &len) != 0) {
+        return 0;
+    }
+    return len;
+}
+
+bool WiFiClientSecure::loadSession(const uint8_t *buf, size_t size)
+{
+    return ssl_session_load(sslclient, buf, size) == 0;
+}
@@ -0,0 +1,156 @@
+/* Resolved-address cache and non-blocking resolver for WiFiClientSecure
+ */
+
+#include "Arduino.h"
+#include <time.h>
+#include <string.h>
+#include <esp_attr.h>
+#include <lwip/dns.h>
+#include "dns_cache.h"
+
+typedef struct dns_cache_entry {
+    char host[DNS_CACHE_HOST_LEN];
+    uint32_t addr;
+    time_t expires;
+} dns_cache_entry;
+
+#ifdef DNS_CACHE_RTC
+RTC_DATA_ATTR static dns_cache_entry dns_cache[DNS_CACHE_ENTRIES];
+#else
+static dns_cache_entry dns_cache[DNS_CACHE_ENTRIES];
+#endif
+static uint32_t dns_cache_ttl = DNS_CACHE_TTL;
+
+/* Only one lookup is in flight at a time. The generation passed to lwIP
+   lets a late callback of an abandoned lookup be ignored. */
+static struct {
+    char host[DNS_CACHE_HOST_LEN];
+    uint32_t generation;
+    volatile int state;
+    volatile uint32_t addr;
+} dns_pending;
+
+
+static dns_cache_entry *dns_cache_find(const char *host)
+{
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        if (dns_cache[i].expires != 0 && strcmp(dns_cache[i].host, host) == 0) {
+            return &dns_cache[i];
+        }
+    }
+    return NULL;
+}
+
+
+bool dns_cache_lookup(const char *host, uint32_t *addr)
+{
+    dns_cache_entry *entry = dns_cache_find(host);
+    if (entry == NULL) {
+        return false;
+    }
+    if (time(nullptr) >= entry->expires) {
+        log_v("DNS cache entry for %s expired", host);
+        entry->expires = 0;
+        return false;
+    }
+    *addr = entry->addr;
+    return true;
+}
+
+
+void dns_cache_store(const char *host, uint32_t addr)
+{
+    dns_cache_entry *entry;
+
+    if (strlen(host) >= DNS_CACHE_HOST_LEN || dns_cache_ttl == 0) {
+        return;
+    }
+    entry = dns_cache_find(host);
+    if (entry == NULL) {
+        // Take a free slot, otherwise the one closest to expiry
+        entry = &dns_cache[0];
+        for (int i = 1; i < DNS_CACHE_ENTRIES && entry->expires != 0; i++) {
+            if (dns_cache[i].expires < entry->expires) {
+                entry = &dns_cache[i];
+            }
+        }
+        strcpy(entry->host, host);
+    }
+    entry->addr = addr;
+    entry->expires = time(nullptr) + dns_cache_ttl;
+}
+
+
+void dns_cache_invalidate(const char *host)
+{
+    dns_cache_entry *entry = dns_cache_find(host);
+    if (entry != NULL) {
+        log_v("Dropping DNS cache entry for %s", host);
+        entry->expires = 0;
+    }
+}
+
+
+void dns_cache_set_ttl(uint32_t seconds)
+{
+    dns_cache_ttl = seconds;
+    if (seconds == 0) {
+        memset(dns_cache, 0, sizeof(dns_cache));
+    }
+}
+
+
+static void dns_resolve_found(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    if ((uint32_t)(uintptr_t)arg != dns_pending.generation) {
+        return;
+    }
+    if (ipaddr != NULL) {
+        dns_pending.addr = ip4_addr_get_u32(ip_2_ip4(ipaddr));
+        dns_pending.state = DNS_RESOLVE_DONE;
+    } else {
+        dns_pending.state = DNS_RESOLVE_FAILED;
+    }
+}
+
+
+/* Returns DNS_RESOLVE_DONE with the address filled in when the host is
+   cached, an IP literal or already known to lwIP. DNS_RESOLVE_PENDING
+   means a query was sent; call dns_resolve_poll() until it completes. */
+int dns_resolve_start(const char *host, uint32_t *addr)
+{
+    ip_addr_t ip;
+    err_t err;
+
+    if (dns_cache_lookup(host, addr)) {
+        return DNS_RESOLVE_DONE;
+    }
+    if (strlen(host) >= DNS_CACHE_HOST_LEN) {
+        log_e("Host name too long: %s", host);
+        return DNS_RESOLVE_FAILED;
+    }
+
+    strcpy(dns_pending.host, host);
+    dns_pending.generation++;
+    dns_pending.state = DNS_RESOLVE_PENDING;
+    err = dns_gethostbyname(host, &ip, dns_resolve_found, (void *)(uintptr_t)dns_pending.generation);
+    if (err == ERR_OK) {
+        dns_pending.state = DNS_RESOLVE_DONE;
+        dns_pending.addr = ip4_addr_get_u32(ip_2_ip4(&ip));
+    } else if (err != ERR_INPROGRESS) {
+        log_e("dns_gethostbyname: %d", err);
+        dns_pending.state = DNS_RESOLVE_FAILED;
+    }
+    return dns_resolve_poll(addr);
+}
+
+
+int dns_resolve_poll(uint32_t *addr)
+{
+    int state = dns_pending.state;
+    if (state == DNS_RESOLVE_DONE) {
+        *addr = dns_pending.addr;
+        dns_cache_store(dns_pending.host, *addr);
+    }
+    return state;
+}
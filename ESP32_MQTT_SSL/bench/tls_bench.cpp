@@ -0,0 +1,373 @@
+/* Connect, handshake and MQTT throughput of WiFiClientSecure against a
+ * local broker, e.g. mosquitto with a TLS listener:
+ *
+ *   tls_bench --host localhost --port 8883 --ca certs/ca.crt
+ *
+ * Each connect is timed per phase (TCP, TLS handshake) and the heap it
+ * takes is read from the malloc wrappers in host_heap.cpp, which see every
+ * allocation mbedtls makes. The first handshake is a full one, later ones
+ * resume the session. Over the last connection a QoS 0 PUBLISH stream is
+ * sent to a topic the client subscribed to, timing the writes and the
+ * return of every message.
+ *
+ * --matrix instead makes one fresh connection for every max fragment
+ * length and buffer size combination and reports its heap.
+ */
+
+#include "Arduino.h"
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "WiFiClientSecure.h"
+#include "host_heap.h"
+
+struct bench_options {
+    const char *host = "localhost";
+    uint16_t port = 8883;
+    std::string ca;
+    std::string cert;
+    std::string key;
+    const char *psk_identity = NULL;
+    const char *psk = NULL;
+    int connects = 5;
+    int messages = 1000;
+    size_t size = 64;
+    uint16_t mfl = 0;
+    size_t rx = WIFICLIENTSECURE_RX_BUFFER_SIZE;
+    size_t tx = WIFICLIENTSECURE_TX_BUFFER_SIZE;
+    bool coalesce = false;
+    bool matrix = false;
+};
+
+struct connect_result {
+    bool ok;
+    uint32_t tcp_us;
+    uint32_t handshake_us;
+    size_t heap_peak;       // malloc peak over the connect, all allocations
+    size_t heap_held;       // still allocated once connected
+    uint32_t client_peak;   // what ssl_client measured from the free heap
+};
+
+static bool read_file(const char *path, std::string *out)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Can't open %s\n", path);
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    out->clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        out->append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+static void configure(WiFiClientSecure &client, const bench_options &options, uint16_t mfl, size_t rx, size_t tx)
+{
+    if (!options.ca.empty()) {
+        client.setCACert(options.ca.c_str());
+    }
+    if (!options.cert.empty()) {
+        client.setCertificate(options.cert.c_str());
+        client.setPrivateKey(options.key.c_str());
+    }
+    if (options.psk != NULL && !client.setPreSharedKey(options.psk_identity, options.psk)) {
+        exit(2);
+    }
+    client.setBufferSizes(rx, tx);
+    client.setMaxFragmentLength(mfl);
+    client.setWriteCoalescing(options.coalesce);
+}
+
+static connect_result timed_connect(WiFiClientSecure &client, const bench_options &options)
+{
+    connect_result result = {};
+    size_t heap_before = host_heap_get().current;
+
+    host_heap_reset_peak();
+    unsigned long start = micros();
+    if (!client.connectAsync(options.host, options.port)) {
+        return result;
+    }
+    int state;
+    while ((state = client.poll()) != SSL_STATE_CONNECTED && state != SSL_STATE_FAILED) {
+        if (state == SSL_STATE_HANDSHAKE && result.tcp_us == 0) {
+            result.tcp_us = micros() - start;
+        }
+        usleep(50);
+    }
+    result.handshake_us = micros() - start - result.tcp_us;
+    result.ok = state == SSL_STATE_CONNECTED;
+    result.heap_peak = host_heap_get().peak - heap_before;
+    result.heap_held = host_heap_get().current - heap_before;
+    result.client_peak = client.peakHeapUsed();
+    return result;
+}
+
+// MQTT 3.1.1, just the packets the benchmark needs
+
+static void mqtt_put_length(std::vector<uint8_t> &packet, size_t length)
+{
+    do {
+        uint8_t digit = length % 128;
+        length /= 128;
+        packet.push_back(length > 0 ? digit | 0x80 : digit);
+    } while (length > 0);
+}
+
+static void mqtt_put_string(std::vector<uint8_t> &packet, const std::string &s)
+{
+    packet.push_back(s.size() >> 8);
+    packet.push_back(s.size() & 0xff);
+    packet.insert(packet.end(), s.begin(), s.end());
+}
+
+static std::vector<uint8_t> mqtt_packet(uint8_t type, const std::vector<uint8_t> &body)
+{
+    std::vector<uint8_t> packet;
+    packet.push_back(type);
+    mqtt_put_length(packet, body.size());
+    packet.insert(packet.end(), body.begin(), body.end());
+    return packet;
+}
+
+static bool read_exact(WiFiClientSecure &client, uint8_t *buf, size_t size, unsigned long timeout_ms)
+{
+    unsigned long start = millis();
+    size_t got = 0;
+    while (got < size) {
+        int n = client.read(buf + got, size - got);
+        if (n > 0) {
+            got += n;
+            continue;
+        }
+        if (!client.connected() || millis() - start > timeout_ms) {
+            return false;
+        }
+        usleep(50);
+    }
+    return true;
+}
+
+// Reads one packet, returns its type byte or -1
+static int mqtt_read(WiFiClientSecure &client, std::vector<uint8_t> &body)
+{
+    uint8_t type, digit;
+    size_t length = 0, multiplier = 1;
+
+    if (!read_exact(client, &type, 1, 5000)) {
+        return -1;
+    }
+    do {
+        if (!read_exact(client, &digit, 1, 5000)) {
+            return -1;
+        }
+        length += (digit & 0x7f) * multiplier;
+        multiplier *= 128;
+    } while (digit & 0x80);
+    body.resize(length);
+    if (length > 0 && !read_exact(client, body.data(), length, 5000)) {
+        return -1;
+    }
+    return type;
+}
+
+static bool send_packet(WiFiClientSecure &client, const std::vector<uint8_t> &packet)
+{
+    return client.write(packet.data(), packet.size()) == packet.size();
+}
+
+static bool mqtt_throughput(WiFiClientSecure &client, const bench_options &options)
+{
+    std::string id = "tls_bench_" + std::to_string(getpid());
+    std::string topic = "tls_bench/" + std::to_string(getpid());
+    std::vector<uint8_t> body;
+
+    // CONNECT, clean session, 60 s keep alive
+    body = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60};
+    mqtt_put_string(body, id);
+    if (!send_packet(client, mqtt_packet(0x10, body)) || mqtt_read(client, body) != 0x20 || body.size() < 2 || body[1] != 0) {
+        fprintf(stderr, "MQTT connect refused\n");
+        return false;
+    }
+
+    body = {0, 1};
+    mqtt_put_string(body, topic);
+    body.push_back(0);
+    if (!send_packet(client, mqtt_packet(0x82, body)) || mqtt_read(client, body) != 0x90) {
+        fprintf(stderr, "MQTT subscribe failed\n");
+        return false;
+    }
+
+    std::vector<uint8_t> publish;
+    mqtt_put_string(publish, topic);
+    publish.resize(publish.size() + options.size, 'x');
+    publish = mqtt_packet(0x30, publish);
+
+    unsigned long start = micros();
+    for (int i = 0; i < options.messages; i++) {
+        if (!send_packet(client, publish)) {
+            fprintf(stderr, "Write failed after %d messages\n", i);
+            return false;
+        }
+    }
+    client.flush();
+    unsigned long write_us = micros() - start;
+
+    int received = 0;
+    while (received < options.messages) {
+        int type = mqtt_read(client, body);
+        if (type < 0) {
+            fprintf(stderr, "Only %d of %d messages came back\n", received, options.messages);
+            return false;
+        }
+        if ((type & 0xf0) == 0x30) {
+            received++;
+        }
+    }
+    unsigned long total_us = micros() - start;
+
+    send_packet(client, {0xe0, 0});
+    client.flush();
+
+    double bytes = (double)options.messages * publish.size();
+    printf("write: %d x %zu bytes in %.1f ms, %.1f KB/s\n", options.messages, options.size,
+           write_us / 1000.0, bytes / 1024 / (write_us / 1e6));
+    printf("round trip: %.1f ms, %.1f KB/s, %.0f messages/s\n", total_us / 1000.0,
+           bytes / 1024 / (total_us / 1e6), options.messages / (total_us / 1e6));
+    return true;
+}
+
+static int run_connects(const bench_options &options)
+{
+    WiFiClientSecure client;
+    configure(client, options, options.mfl, options.rx, options.tx);
+
+    printf("%-8s %9s %13s %9s %10s %10s %12s\n", "connect", "tcp_ms", "handshake_ms", "resumed",
+           "heap_peak", "heap_held", "client_peak");
+    for (int i = 0; i < options.connects; i++) {
+        uint32_t resumed = client.resumedHandshakes();
+        connect_result result = timed_connect(client, options);
+        if (!result.ok) {
+            fprintf(stderr, "Connect %d failed\n", i + 1);
+            return 1;
+        }
+        printf("%-8d %9.2f %13.2f %9s %10zu %10zu %12u\n", i + 1, result.tcp_us / 1000.0,
+               result.handshake_us / 1000.0, client.resumedHandshakes() > resumed ? "yes" : "no",
+               result.heap_peak, result.heap_held, result.client_peak);
+        if (i + 1 < options.connects) {
+            client.stop();
+        }
+    }
+    bool ok = options.messages <= 0 || mqtt_throughput(client, options);
+    client.stop();
+    return ok ? 0 : 1;
+}
+
+static int run_matrix(const bench_options &options)
+{
+    static const uint16_t fragment_lengths[] = {0, 512, 1024, 2048, 4096};
+    static const size_t buffers[][2] = {{512, 1024}, {1024, 2048}, {4096, 4096}};
+    int failures = 0;
+
+    printf("%-6s %-10s %10s %10s %12s %13s\n", "mfl", "rx/tx", "heap_peak", "heap_held", "client_peak", "handshake_ms");
+    for (uint16_t mfl : fragment_lengths) {
+        for (const size_t *sizes : buffers) {
+            WiFiClientSecure client;
+            configure(client, options, mfl, sizes[0], sizes[1]);
+            connect_result result = timed_connect(client, options);
+            char label[24];
+            snprintf(label, sizeof(label), "%zu/%zu", sizes[0], sizes[1]);
+            if (!result.ok) {
+                printf("%-6u %-10s %10s\n", mfl, label, "failed");
+                failures++;
+                continue;
+            }
+            printf("%-6u %-10s %10zu %10zu %12u %13.2f\n", mfl, label, result.heap_peak, result.heap_held,
+                   result.client_peak, result.handshake_us / 1000.0);
+            client.stop();
+        }
+    }
+    return failures ? 1 : 0;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: tls_bench [--host H] [--port P] [--ca FILE] [--cert FILE --key FILE]\n"
+            "                 [--psk IDENTITY:HEX] [--connects N] [--messages N] [--size BYTES]\n"
+            "                 [--mfl 0|512|1024|2048|4096] [--rx BYTES] [--tx BYTES] [--coalesce]\n"
+            "                 [--matrix]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--coalesce") {
+            options.coalesce = true;
+        } else if (arg == "--matrix") {
+            options.matrix = true;
+        } else if (!has_value) {
+            usage();
+        } else if (arg == "--host") {
+            options.host = argv[++i];
+        } else if (arg == "--port") {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "--ca") {
+            if (!read_file(argv[++i], &options.ca)) {
+                return 2;
+            }
+        } else if (arg == "--cert") {
+            if (!read_file(argv[++i], &options.cert)) {
+                return 2;
+            }
+        } else if (arg == "--key") {
+            if (!read_file(argv[++i], &options.key)) {
+                return 2;
+            }
+        } else if (arg == "--psk") {
+            char *colon = strchr(argv[++i], ':');
+            if (colon == NULL) {
+                usage();
+            }
+            *colon = '\0';
+            options.psk_identity = argv[i];
+            options.psk = colon + 1;
+        } else if (arg == "--connects") {
+            options.connects = atoi(argv[++i]);
+        } else if (arg == "--messages") {
+            options.messages = atoi(argv[++i]);
+        } else if (arg == "--size") {
+            options.size = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--mfl") {
+            options.mfl = atoi(argv[++i]);
+        } else if (arg == "--rx") {
+            options.rx = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--tx") {
+            options.tx = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage();
+        }
+    }
+    if (options.cert.empty() != options.key.empty() || options.connects < 1) {
+        usage();
+    }
+    if (options.psk != NULL) {
+        // PSK replaces the certificates
+        options.ca.clear();
+        options.cert.clear();
+        options.key.clear();
+    }
+    // Certificates are checked against time(), which counts from boot
+    // until the clock is set, as on the ESP32
+    configTime(0, 0, "pool.ntp.org");
+    return options.matrix ? run_matrix(options) : run_connects(options);
+}
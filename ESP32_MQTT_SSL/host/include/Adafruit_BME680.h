@@ -0,0 +1,70 @@
+/* Stand-in for the Adafruit BME680 library. A reading takes as long as
+ * the chip would for the oversampling and heater settings, and returns a
+ * smooth daily cycle in time(), or the values pinned with host_bme680_set().
+ */
+
+#ifndef HOST_ADAFRUIT_BME680_H
+#define HOST_ADAFRUIT_BME680_H
+#include <stdint.h>
+#include "Wire.h"
+#include "SPI.h"
+#include "Adafruit_Sensor.h"
+
+#define BME680_DEFAULT_ADDRESS 0x77
+
+#define BME680_OS_NONE 0
+#define BME680_OS_1X 1
+#define BME680_OS_2X 2
+#define BME680_OS_4X 3
+#define BME680_OS_8X 4
+#define BME680_OS_16X 5
+
+#define BME680_FILTER_SIZE_0 0
+#define BME680_FILTER_SIZE_1 1
+#define BME680_FILTER_SIZE_3 2
+#define BME680_FILTER_SIZE_7 3
+#define BME680_FILTER_SIZE_15 4
+#define BME680_FILTER_SIZE_31 5
+#define BME680_FILTER_SIZE_63 6
+#define BME680_FILTER_SIZE_127 7
+
+class Adafruit_BME680
+{
+public:
+    Adafruit_BME680(TwoWire *wire = &Wire) {}
+    Adafruit_BME680(int8_t cs_pin, SPIClass *spi = &SPI) {}
+
+    bool begin(uint8_t address = BME680_DEFAULT_ADDRESS, bool init_settings = true);
+    bool setTemperatureOversampling(uint8_t os);
+    bool setPressureOversampling(uint8_t os);
+    bool setHumidityOversampling(uint8_t os);
+    bool setIIRFilterSize(uint8_t size);
+    bool setGasHeater(uint16_t heater_temp, uint16_t heater_time);
+
+    bool performReading();
+    unsigned long beginReading();
+    bool endReading();
+    int remainingReadingMillis();
+
+    float readTemperature();
+    float readPressure();
+    float readHumidity();
+    uint32_t readGas();
+
+    float temperature = 0;
+    uint32_t pressure = 0;
+    float humidity = 0;
+    uint32_t gas_resistance = 0;
+
+private:
+    bool _found = false;
+    uint8_t _os_temperature = BME680_OS_NONE;
+    uint8_t _os_pressure = BME680_OS_NONE;
+    uint8_t _os_humidity = BME680_OS_NONE;
+    uint16_t _heater_temp = 0;
+    uint16_t _heater_time = 0;
+    unsigned long _reading_end = 0;  // millis() the conversion is done, 0 if none running
+
+    unsigned long conversionMillis();
+};
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_ADAFRUIT_SENSOR_H
+#define HOST_ADAFRUIT_SENSOR_H
+
+class Adafruit_Sensor
+{
+public:
+    virtual ~Adafruit_Sensor() {}
+};
+#endif
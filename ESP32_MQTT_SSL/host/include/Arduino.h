@@ -0,0 +1,65 @@
+/* Host stand-in for the ESP32 Arduino core, enough to build the client
+ * library and run the sketches on Linux. ARDUINO is deliberately left
+ * undefined, so ssl_client.cpp keeps using ssl_client_host.h.
+ *
+ * Time is virtual: it runs with the real clock but jumps over sleeps,
+ * see host.h.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+// Same levels as the core: 1 errors, 2 warnings, 3 info, 4 debug, 5 verbose
+#ifndef CORE_DEBUG_LEVEL
+#define CORE_DEBUG_LEVEL 1
+#endif
+
+#define host_log(level, tag, format, ...) \
+    do { if (CORE_DEBUG_LEVEL >= level) fprintf(stderr, "[" tag "] " format "\n", ##__VA_ARGS__); } while (0)
+#define log_e(format, ...) host_log(1, "E", format, ##__VA_ARGS__)
+#define log_w(format, ...) host_log(2, "W", format, ##__VA_ARGS__)
+#define log_i(format, ...) host_log(3, "I", format, ##__VA_ARGS__)
+#define log_d(format, ...) host_log(4, "D", format, ##__VA_ARGS__)
+#define log_v(format, ...) host_log(5, "V", format, ##__VA_ARGS__)
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+bool setCpuFrequencyMhz(uint32_t cpu_freq_mhz);
+uint32_t getCpuFrequencyMhz();
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_sleep.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "WString.h"
+#include "Print.h"
+#include "Client.h"
+#include "IPAddress.h"
+#include "HardwareSerial.h"
+#endif
@@ -0,0 +1,44 @@
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+#include <stdio.h>
+#include "Stream.h"
+
+// Writes go to stdout, nothing is ever received
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) {}
+    void end() {}
+    size_t write(uint8_t c) override
+    {
+        return fwrite(&c, 1, 1, stdout);
+    }
+    size_t write(const uint8_t *buf, size_t size) override
+    {
+        return fwrite(buf, 1, size, stdout);
+    }
+    using Print::write;
+    int available() override
+    {
+        return 0;
+    }
+    int read() override
+    {
+        return -1;
+    }
+    int peek() override
+    {
+        return -1;
+    }
+    void flush() override
+    {
+        fflush(stdout);
+    }
+    operator bool() const
+    {
+        return true;
+    }
+};
+
+extern HardwareSerial Serial;
+#endif
@@ -0,0 +1,43 @@
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+#include <stdint.h>
+#include <string.h>
+
+// IPv4 only, kept in network byte order like the core
+class IPAddress
+{
+public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        uint8_t bytes[4] = {a, b, c, d};
+        memcpy(&_address, bytes, sizeof(_address));
+    }
+    IPAddress(uint32_t address) : _address(address) {}
+
+    operator uint32_t() const
+    {
+        return _address;
+    }
+    bool operator==(const IPAddress &other) const
+    {
+        return _address == other._address;
+    }
+    uint8_t operator[](int index) const
+    {
+        return ((const uint8_t *)&_address)[index];
+    }
+    uint8_t *raw_address()
+    {
+        return (uint8_t *)&_address;
+    }
+
+private:
+    uint32_t _address;
+};
+
+// <netinet/in.h> has its own, all ones; WiFi.config() takes either as DHCP
+#ifndef INADDR_NONE
+static const IPAddress INADDR_NONE(0, 0, 0, 0);
+#endif
+#endif
@@ -0,0 +1,70 @@
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class String;
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size)
+    {
+        size_t n = 0;
+        while (size-- && write(*buf++)) {
+            n++;
+        }
+        return n;
+    }
+    size_t write(const char *str)
+    {
+        return str ? write((const uint8_t *)str, strlen(str)) : 0;
+    }
+    size_t write(const char *buf, size_t size)
+    {
+        return write((const uint8_t *)buf, size);
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char *str)
+    {
+        return write(str);
+    }
+    size_t print(const String &s);
+    size_t print(char c)
+    {
+        return write((uint8_t)c);
+    }
+    size_t print(long value, int base = 10);
+    size_t print(unsigned long value, int base = 10);
+    size_t print(int value, int base = 10)
+    {
+        return print((long)value, base);
+    }
+    size_t print(unsigned int value, int base = 10)
+    {
+        return print((unsigned long)value, base);
+    }
+    size_t print(double value, int digits = 2);
+    size_t println()
+    {
+        return write("\r\n");
+    }
+    template <typename T>
+    size_t println(const T &value)
+    {
+        size_t n = print(value);
+        return n + println();
+    }
+    template <typename T>
+    size_t println(const T &value, int format)
+    {
+        size_t n = print(value, format);
+        return n + println();
+    }
+    virtual void flush() {}
+};
+#endif
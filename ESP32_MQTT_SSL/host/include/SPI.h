@@ -0,0 +1,11 @@
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+class SPIClass
+{
+public:
+    void begin() {}
+};
+
+extern SPIClass SPI;
+#endif
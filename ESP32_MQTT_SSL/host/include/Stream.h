@@ -0,0 +1,30 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+#include "Print.h"
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout)
+    {
+        _timeout = timeout;
+    }
+    unsigned long getTimeout()
+    {
+        return _timeout;
+    }
+    size_t readBytes(uint8_t *buf, size_t length);
+    size_t readBytes(char *buf, size_t length)
+    {
+        return readBytes((uint8_t *)buf, length);
+    }
+
+protected:
+    unsigned long _timeout = 1000;
+    int timedRead();
+};
+#endif
@@ -0,0 +1,133 @@
+/* Arduino String over std::string, for the libraries that still pass it
+ * around. The sketches themselves don't use it.
+ */
+
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+#include <stdlib.h>
+#include <string>
+
+class String
+{
+public:
+    String(const char *s = "") : _s(s ? s : "") {}
+    String(const char *s, size_t length) : _s(s, length) {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(char c) : _s(1, c) {}
+    explicit String(int value, unsigned char base = 10) : _s(format((long)value, base)) {}
+    explicit String(unsigned int value, unsigned char base = 10) : _s(format((unsigned long)value, base)) {}
+    explicit String(long value, unsigned char base = 10) : _s(format(value, base)) {}
+    explicit String(unsigned long value, unsigned char base = 10) : _s(format(value, base)) {}
+    explicit String(double value, unsigned int digits = 2);
+
+    const char *c_str() const
+    {
+        return _s.c_str();
+    }
+    unsigned int length() const
+    {
+        return _s.length();
+    }
+    bool reserve(unsigned int size)
+    {
+        _s.reserve(size);
+        return true;
+    }
+    char charAt(unsigned int index) const
+    {
+        return index < _s.length() ? _s[index] : 0;
+    }
+    char operator[](unsigned int index) const
+    {
+        return charAt(index);
+    }
+    bool concat(const String &other)
+    {
+        _s += other._s;
+        return true;
+    }
+    bool concat(const char *s)
+    {
+        _s += s ? s : "";
+        return true;
+    }
+    bool concat(char c)
+    {
+        _s += c;
+        return true;
+    }
+    String &operator+=(const String &other)
+    {
+        concat(other);
+        return *this;
+    }
+    String &operator+=(const char *s)
+    {
+        concat(s);
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        concat(c);
+        return *this;
+    }
+    friend String operator+(String lhs, const String &rhs)
+    {
+        return lhs += rhs;
+    }
+    bool equals(const String &other) const
+    {
+        return _s == other._s;
+    }
+    bool operator==(const String &other) const
+    {
+        return _s == other._s;
+    }
+    bool operator==(const char *s) const
+    {
+        return _s == (s ? s : "");
+    }
+    bool operator!=(const String &other) const
+    {
+        return _s != other._s;
+    }
+    bool startsWith(const String &prefix) const
+    {
+        return _s.compare(0, prefix._s.length(), prefix._s) == 0;
+    }
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        size_t pos = _s.find(c, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    int indexOf(const String &s, unsigned int from = 0) const
+    {
+        size_t pos = _s.find(s._s, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    String substring(unsigned int from, unsigned int to = (unsigned int)-1) const
+    {
+        if (from >= _s.length() || to <= from) {
+            return String();
+        }
+        return String(_s.substr(from, to - from));
+    }
+    long toInt() const
+    {
+        return atol(_s.c_str());
+    }
+    float toFloat() const
+    {
+        return (float)atof(_s.c_str());
+    }
+
+private:
+    std::string _s;
+
+    static std::string format(long value, unsigned char base)
+    {
+        return value < 0 && base == 10 ? "-" + format((unsigned long)-value, base) : format((unsigned long)value, base);
+    }
+    static std::string format(unsigned long value, unsigned char base);
+};
+#endif
@@ -0,0 +1,61 @@
+/* Station mode WiFi with the timing of a real join: WiFi.begin() starts
+ * it and status() turns WL_CONNECTED once the emulated scan, association
+ * and DHCP time has passed. Joining a given BSSID and channel with a
+ * static address skips scan and DHCP. Traffic goes over the host's own
+ * network whatever the emulated address is.
+ */
+
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "esp_wifi.h"
+
+typedef enum {
+    WL_NO_SHIELD = 255,
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+#define WIFI_OFF WIFI_MODE_NULL
+#define WIFI_STA WIFI_MODE_STA
+#define WIFI_AP WIFI_MODE_AP
+#define WIFI_AP_STA WIFI_MODE_APSTA
+
+class WiFiClass
+{
+public:
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0,
+                      const uint8_t *bssid = NULL, bool connect = true);
+    bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet,
+                IPAddress dns1 = (uint32_t)0, IPAddress dns2 = (uint32_t)0);
+    bool disconnect(bool wifioff = false, bool eraseap = false);
+    bool mode(wifi_mode_t mode);
+    wifi_mode_t getMode();
+    bool setHostname(const char *hostname);
+    const char *getHostname();
+
+    wl_status_t status();
+    uint8_t waitForConnectResult(unsigned long timeout_ms = 60000);
+    bool isConnected()
+    {
+        return status() == WL_CONNECTED;
+    }
+
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t dns_no = 0);
+    uint8_t *BSSID();
+    int32_t channel();
+    int8_t RSSI();
+    String SSID();
+};
+
+extern WiFiClass WiFi;
+#endif
@@ -0,0 +1,16 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+#include <stdint.h>
+
+// Only there to be passed around, the sensor is emulated above the bus
+class TwoWire
+{
+public:
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0)
+    {
+        return true;
+    }
+};
+
+extern TwoWire Wire;
+#endif
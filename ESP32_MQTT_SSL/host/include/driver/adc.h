@@ -0,0 +1,6 @@
+#ifndef HOST_DRIVER_ADC_H
+#define HOST_DRIVER_ADC_H
+
+static inline void adc_power_off() {}
+static inline void adc_power_release() {}
+#endif
@@ -0,0 +1,11 @@
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+
+// RTC memory is ordinary memory on the host: it lasts as long as the process
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_FAST_ATTR
+#define RTC_SLOW_ATTR
+#endif
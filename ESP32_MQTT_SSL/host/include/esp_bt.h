@@ -0,0 +1,9 @@
+#ifndef HOST_ESP_BT_H
+#define HOST_ESP_BT_H
+#include "esp_err.h"
+
+static inline esp_err_t esp_bt_controller_disable()
+{
+    return ESP_OK;
+}
+#endif
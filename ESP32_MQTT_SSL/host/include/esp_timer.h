@@ -0,0 +1,6 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+#include <stdint.h>
+
+int64_t esp_timer_get_time();  // virtual microseconds since start
+#endif
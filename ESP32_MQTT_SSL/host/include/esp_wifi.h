@@ -0,0 +1,24 @@
+#ifndef HOST_ESP_WIFI_H
+#define HOST_ESP_WIFI_H
+#include <stdint.h>
+#include "esp_err.h"
+
+#define ESP_ERR_WIFI_NOT_CONNECT (ESP_ERR_WIFI_BASE + 15)
+
+typedef enum {
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    int8_t rssi;
+} wifi_ap_record_t;
+
+// ESP_OK once associated, before an address is assigned
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+#endif
@@ -0,0 +1,49 @@
+/* Controls of the host emulation, for the sketch runner and tests.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Virtual clock: real time since start plus everything slept
+
+int64_t host_clock_us();
+void host_clock_advance(int64_t us);  // what a sleep does
+
+typedef struct host_sleep_stats {
+    uint32_t light_sleeps;
+    uint32_t deep_sleeps;
+    int64_t slept_us;
+} host_sleep_stats;
+
+host_sleep_stats host_sleep_get();
+
+// Thrown by esp_deep_sleep_start(), the runner catches it and boots again
+struct host_deep_sleep {
+};
+
+// WiFi
+
+typedef struct host_wifi_stats {
+    uint32_t joins;         // with scan and DHCP
+    uint32_t fast_joins;    // to a given BSSID and channel with a static address
+    int64_t radio_on_us;    // from WiFi.begin() until the radio is turned off
+} host_wifi_stats;
+
+void host_wifi_set_available(bool available);  // false: no access point in range
+void host_wifi_set_timing(uint32_t join_ms, uint32_t dhcp_ms, uint32_t fast_join_ms);
+host_wifi_stats host_wifi_get();
+
+// BME680
+
+void host_bme680_set(float temperature, float humidity, float pressure_pa, float gas_ohm);  // NAN allowed
+void host_bme680_auto();  // back to the synthetic daily cycle
+
+// Flash: path NULL keeps the partition in memory for the life of the process
+bool host_partition_add(const char *label, size_t size, const char *path);
+
+// Broker of the sketch runner: the configured one unless --broker replaced it
+const char *host_broker_host(const char *configured);
+uint16_t host_broker_port(uint16_t configured);
+#endif
@@ -0,0 +1,20 @@
+/* Process-wide allocation tracking for host builds. Linking host_heap.cpp
+ * replaces malloc, calloc, realloc and free, so every allocation counts,
+ * including those mbedtls makes through its default calloc.
+ */
+
+#ifndef HOST_HEAP_H
+#define HOST_HEAP_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct host_heap_stats {
+    size_t current;         // bytes allocated now
+    size_t peak;            // highest value of current since the last reset
+    size_t blocks;          // blocks allocated now
+    uint64_t allocations;   // malloc, calloc and growing reallocs so far
+} host_heap_stats;
+
+host_heap_stats host_heap_get();
+void host_heap_reset_peak();
+#endif
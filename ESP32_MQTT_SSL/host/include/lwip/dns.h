@@ -0,0 +1,32 @@
+/* The part of the lwIP resolver dns_cache.cpp uses. By default names are
+ * looked up synchronously with getaddrinfo(); tests install their own
+ * resolver to answer late, fail or count queries.
+ */
+
+#ifndef HOST_LWIP_DNS_H
+#define HOST_LWIP_DNS_H
+#include <stdint.h>
+
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_VAL -6
+#define ERR_ARG -16
+
+typedef struct ip4_addr {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef struct ip_addr {
+    ip4_addr_t u_addr;
+} ip_addr_t;
+
+#define ip_2_ip4(ipaddr) (&(ipaddr)->u_addr)
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+typedef err_t (*host_dns_resolver)(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
+void host_dns_set_resolver(host_dns_resolver resolver);  // NULL restores getaddrinfo()
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifndef lwip_socket
+#define lwip_socket socket
+#define lwip_connect connect
+#define lwip_getsockopt getsockopt
+#define lwip_setsockopt setsockopt
+#endif
+#endif
@@ -0,0 +1,162 @@
+#include "Arduino.h"
+#include <stdarg.h>
+#include "Wire.h"
+#include "SPI.h"
+
+HardwareSerial Serial;
+TwoWire Wire;
+SPIClass SPI;
+
+static uint32_t cpu_frequency_mhz = 240;
+
+bool setCpuFrequencyMhz(uint32_t cpu_freq_mhz)
+{
+    if (cpu_freq_mhz != 80 && cpu_freq_mhz != 160 && cpu_freq_mhz != 240) {
+        log_e("Bad frequency: %u MHz", cpu_freq_mhz);
+        return false;
+    }
+    cpu_frequency_mhz = cpu_freq_mhz;
+    return true;
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+    return cpu_frequency_mhz;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
+
+
+size_t Print::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0) {
+        return 0;
+    }
+    if ((size_t)len < sizeof(buf)) {
+        return write((const uint8_t *)buf, len);
+    }
+
+    char *big = (char *)malloc(len + 1);
+    if (big == NULL) {
+        return 0;
+    }
+    va_start(args, format);
+    vsnprintf(big, len + 1, format, args);
+    va_end(args);
+    size_t n = write((const uint8_t *)big, len);
+    free(big);
+    return n;
+}
+
+size_t Print::print(const String &s)
+{
+    return write((const uint8_t *)s.c_str(), s.length());
+}
+
+size_t Print::print(long value, int base)
+{
+    if (base == 10) {
+        return printf("%ld", value);
+    }
+    return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    char buf[8 * sizeof(value) + 1];
+    char *p = buf + sizeof(buf) - 1;
+
+    if (base < 2) {
+        base = 10;
+    }
+    *p = '\0';
+    do {
+        unsigned digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value);
+    return write(p);
+}
+
+size_t Print::print(double value, int digits)
+{
+    return printf("%.*f", digits, value);
+}
+
+
+int Stream::timedRead()
+{
+    unsigned long start = millis();
+    do {
+        int c = read();
+        if (c >= 0) {
+            return c;
+        }
+        yield();
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(uint8_t *buf, size_t length)
+{
+    size_t count = 0;
+    while (count < length) {
+        int c = timedRead();
+        if (c < 0) {
+            break;
+        }
+        buf[count++] = (uint8_t)c;
+    }
+    return count;
+}
+
+
+String::String(double value, unsigned int digits)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    _s = buf;
+}
+
+std::string String::format(unsigned long value, unsigned char base)
+{
+    std::string digits;
+
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        unsigned digit = value % base;
+        digits.insert(digits.begin(), digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value);
+    return digits;
+}
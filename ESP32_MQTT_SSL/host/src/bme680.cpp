@@ -0,0 +1,154 @@
+#include "Arduino.h"
+#include <mutex>
+#include "Adafruit_BME680.h"
+#include "host.h"
+
+static struct {
+    std::mutex mutex;
+    bool pinned = false;
+    float temperature, humidity, pressure, gas;
+} bme680;
+
+bool Adafruit_BME680::begin(uint8_t address, bool init_settings)
+{
+    _found = address == 0x76 || address == 0x77;
+    if (_found && init_settings) {
+        setTemperatureOversampling(BME680_OS_8X);
+        setHumidityOversampling(BME680_OS_2X);
+        setPressureOversampling(BME680_OS_4X);
+        setIIRFilterSize(BME680_FILTER_SIZE_3);
+        setGasHeater(320, 150);
+    }
+    return _found;
+}
+
+bool Adafruit_BME680::setTemperatureOversampling(uint8_t os)
+{
+    _os_temperature = os;
+    return os <= BME680_OS_16X;
+}
+
+bool Adafruit_BME680::setPressureOversampling(uint8_t os)
+{
+    _os_pressure = os;
+    return os <= BME680_OS_16X;
+}
+
+bool Adafruit_BME680::setHumidityOversampling(uint8_t os)
+{
+    _os_humidity = os;
+    return os <= BME680_OS_16X;
+}
+
+bool Adafruit_BME680::setIIRFilterSize(uint8_t size)
+{
+    return size <= BME680_FILTER_SIZE_127;
+}
+
+bool Adafruit_BME680::setGasHeater(uint16_t heater_temp, uint16_t heater_time)
+{
+    _heater_temp = heater_temp;
+    _heater_time = heater_time;
+    return true;
+}
+
+// Measurement duration from the Bosch driver, plus the heater time
+unsigned long Adafruit_BME680::conversionMillis()
+{
+    static const uint8_t cycles[] = {0, 1, 2, 4, 8, 16};
+    uint32_t meas_cycles = cycles[_os_temperature] + cycles[_os_pressure] + cycles[_os_humidity];
+    uint32_t duration_us = meas_cycles * 1963 + 477 * 4 + 477 * 5 + 1000;
+
+    return (duration_us + 999) / 1000 + 1 + (_heater_temp && _heater_time ? _heater_time : 0);
+}
+
+unsigned long Adafruit_BME680::beginReading()
+{
+    if (!_found) {
+        return 0;
+    }
+    if (_reading_end == 0) {
+        _reading_end = millis() + conversionMillis();
+    }
+    return _reading_end;
+}
+
+int Adafruit_BME680::remainingReadingMillis()
+{
+    if (_reading_end == 0) {
+        return -1;
+    }
+    long remaining = (long)(_reading_end - millis());
+    return remaining > 0 ? (int)remaining : 0;
+}
+
+bool Adafruit_BME680::endReading()
+{
+    if (beginReading() == 0) {
+        return false;
+    }
+    int remaining = remainingReadingMillis();
+    if (remaining > 0) {
+        delay(remaining);
+    }
+    _reading_end = 0;
+
+    std::lock_guard<std::mutex> lock(bme680.mutex);
+    if (bme680.pinned) {
+        temperature = bme680.temperature;
+        humidity = bme680.humidity;
+        pressure = (uint32_t)bme680.pressure;
+        gas_resistance = _heater_temp && _heater_time ? (uint32_t)bme680.gas : 0;
+        return true;
+    }
+
+    // A day long cycle, warmest in the afternoon, with a little jitter
+    double day = fmod((double)time(nullptr), 86400.0) / 86400.0;
+    double jitter = sin(time(nullptr) * 12.9898) * 0.05;
+    temperature = 21.0 + 3.0 * sin(2 * M_PI * (day - 0.375)) + jitter;
+    humidity = 50.0 - 10.0 * sin(2 * M_PI * (day - 0.375)) + jitter * 10;
+    pressure = (uint32_t)(101325 + 150 * sin(2 * M_PI * day / 3));
+    gas_resistance = _heater_temp && _heater_time ? (uint32_t)(60000 + 5000 * sin(2 * M_PI * day) + jitter * 2000) : 0;
+    return true;
+}
+
+bool Adafruit_BME680::performReading()
+{
+    return endReading();
+}
+
+float Adafruit_BME680::readTemperature()
+{
+    return performReading() ? temperature : NAN;
+}
+
+float Adafruit_BME680::readPressure()
+{
+    return performReading() ? (float)pressure : 0;
+}
+
+float Adafruit_BME680::readHumidity()
+{
+    return performReading() ? humidity : NAN;
+}
+
+uint32_t Adafruit_BME680::readGas()
+{
+    return performReading() ? gas_resistance : 0;
+}
+
+void host_bme680_set(float temperature, float humidity, float pressure_pa, float gas_ohm)
+{
+    std::lock_guard<std::mutex> lock(bme680.mutex);
+    bme680.pinned = true;
+    bme680.temperature = temperature;
+    bme680.humidity = humidity;
+    bme680.pressure = pressure_pa;
+    bme680.gas = gas_ohm;
+}
+
+void host_bme680_auto()
+{
+    std::lock_guard<std::mutex> lock(bme680.mutex);
+    bme680.pinned = false;
+}
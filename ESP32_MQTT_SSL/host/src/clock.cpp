@@ -0,0 +1,144 @@
+/* The virtual clock runs with the real monotonic clock, plus whatever the
+ * sketch slept: sleeping skips ahead instead of waiting, so wake cycles
+ * run back to back while time and millis() see the full sleep. delay()
+ * and task waits stay real, they overlap with real network I/O.
+ */
+
+#include "Arduino.h"
+#include <atomic>
+#include <sys/time.h>
+#include <unistd.h>
+#include <sched.h>
+#include "esp_timer.h"
+#include "host.h"
+
+static std::atomic<int64_t> skipped_us{0};
+static std::atomic<int64_t> epoch_offset_us{0};  // 0 until configTime()
+static std::atomic<uint64_t> sleep_timer_us{0};
+static std::atomic<int> wakeup_cause{ESP_SLEEP_WAKEUP_UNDEFINED};
+static std::atomic<uint32_t> light_sleeps{0};
+static std::atomic<uint32_t> deep_sleeps{0};
+static std::atomic<int64_t> slept_us{0};
+
+static int64_t monotonic_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t host_clock_us()
+{
+    // A local static, time() may be called before this file's globals are set
+    static const int64_t start_us = monotonic_us();
+    return monotonic_us() - start_us + skipped_us.load();
+}
+
+void host_clock_advance(int64_t us)
+{
+    skipped_us += us;
+}
+
+unsigned long micros()
+{
+    return (unsigned long)host_clock_us();
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(host_clock_us() / 1000);
+}
+
+int64_t esp_timer_get_time()
+{
+    return host_clock_us();
+}
+
+void delay(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    usleep(us);
+}
+
+void yield()
+{
+    sched_yield();
+}
+
+/* Seconds since boot until configTime(), then wall clock time that keeps
+   going through virtual sleeps. Replaces the C library's time() for the
+   whole process, mbedtls included. */
+extern "C" time_t time(time_t *t)
+{
+    time_t now = (time_t)((host_clock_us() + epoch_offset_us.load()) / 1000000);
+    if (t != NULL) {
+        *t = now;
+    }
+    return now;
+}
+
+// SNTP answers at once: the clock is set to the real time of day
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2, const char *server3)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    epoch_offset_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - host_clock_us();
+}
+
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    sleep_timer_us = time_in_us;
+    return ESP_OK;
+}
+
+static void host_sleep()
+{
+    host_clock_advance(sleep_timer_us);
+    slept_us += sleep_timer_us;
+    wakeup_cause = ESP_SLEEP_WAKEUP_TIMER;
+}
+
+esp_err_t esp_light_sleep_start()
+{
+    if (sleep_timer_us == 0) {
+        log_e("Light sleep without a wakeup source");
+        return ESP_ERR_INVALID_STATE;
+    }
+    fflush(stdout);
+    host_sleep();
+    light_sleeps++;
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start()
+{
+    fflush(stdout);
+    host_sleep();
+    deep_sleeps++;
+    throw host_deep_sleep();
+}
+
+void esp_deep_sleep(uint64_t time_in_us)
+{
+    esp_sleep_enable_timer_wakeup(time_in_us);
+    esp_deep_sleep_start();
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return (esp_sleep_wakeup_cause_t)wakeup_cause.load();
+}
+
+host_sleep_stats host_sleep_get()
+{
+    host_sleep_stats stats;
+    stats.light_sleeps = light_sleeps;
+    stats.deep_sleeps = deep_sleeps;
+    stats.slept_us = slept_us;
+    return stats;
+}
@@ -0,0 +1,115 @@
+#include "Arduino.h"
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+struct host_task {
+    const char *name;
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t notifications = 0;
+};
+
+static thread_local host_task *current_task = NULL;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    host_task *task = new host_task;
+    task->name = name;
+    if (created_task != NULL) {
+        *created_task = task;
+    }
+    std::thread([task, code, parameters]() {
+        current_task = task;
+        code(parameters);
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    return xTaskCreatePinnedToCore(code, name, stack_depth, parameters, priority, created_task, tskNO_AFFINITY);
+}
+
+// Threads not started by xTaskCreate(), like main() running loop(), get a task on first use
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    if (current_task == NULL) {
+        current_task = new host_task;
+        current_task->name = "loopTask";
+    }
+    return current_task;
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return pdMS_TO_TICKS(millis());
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    delay(ticks * portTICK_PERIOD_MS);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->notifications++;
+    }
+    task->notified.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    host_task *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    auto pending = [task]() {
+        return task->notifications > 0;
+    };
+
+    if (ticks_to_wait == portMAX_DELAY) {
+        task->notified.wait(lock, pending);
+    } else {
+        task->notified.wait_for(lock, std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS), pending);
+    }
+    uint32_t value = task->notifications;
+    if (value > 0) {
+        task->notifications = clear_on_exit ? 0 : value - 1;
+    }
+    return value;
+}
+
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new host_semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    return buffer;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    if (ticks_to_wait == portMAX_DELAY) {
+        semaphore->mutex.lock();
+        return pdTRUE;
+    }
+    return semaphore->mutex.try_lock_for(std::chrono::milliseconds(ticks_to_wait * portTICK_PERIOD_MS)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    semaphore->mutex.unlock();
+    return pdTRUE;
+}
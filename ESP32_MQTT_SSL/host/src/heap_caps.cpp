@@ -0,0 +1,50 @@
+#include <malloc.h>
+#include "esp_heap_caps.h"
+#include "host_heap.h"
+
+// Defined when host_heap.cpp is linked in
+__attribute__((weak)) host_heap_stats host_heap_get();
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    size_t used, peak, blocks;
+
+    if (host_heap_get) {
+        host_heap_stats stats = host_heap_get();
+        used = stats.current;
+        peak = stats.peak;
+        blocks = stats.blocks;
+    } else {
+        struct mallinfo2 mi = mallinfo2();
+        used = mi.uordblks;
+        peak = used;
+        blocks = 0;
+    }
+
+    info->total_allocated_bytes = used;
+    info->total_free_bytes = used < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - used : 0;
+    info->largest_free_block = info->total_free_bytes;
+    info->minimum_free_bytes = peak < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - peak : 0;
+    info->allocated_blocks = blocks;
+    info->free_blocks = 1;
+    info->total_blocks = blocks + 1;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+    return info.total_free_bytes;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, caps);
+    return info.minimum_free_bytes;
+}
+
+uint32_t esp_get_free_heap_size()
+{
+    return heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
@@ -0,0 +1,113 @@
+#include <malloc.h>
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include "host_heap.h"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static std::atomic<size_t> heap_current{0};
+static std::atomic<size_t> heap_peak{0};
+static std::atomic<size_t> heap_blocks{0};
+static std::atomic<uint64_t> heap_allocations{0};
+
+static void heap_add(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    heap_blocks.fetch_add(1, std::memory_order_relaxed);
+    size_t current = heap_current.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed) + malloc_usable_size(ptr);
+    size_t peak = heap_peak.load(std::memory_order_relaxed);
+    while (current > peak && !heap_peak.compare_exchange_weak(peak, current, std::memory_order_relaxed)) {
+    }
+}
+
+static void heap_remove(void *ptr)
+{
+    if (ptr != NULL) {
+        heap_blocks.fetch_sub(1, std::memory_order_relaxed);
+        heap_current.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    heap_add(ptr);
+    return ptr;
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    heap_add(ptr);
+    return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    size_t before = ptr ? malloc_usable_size(ptr) : 0;
+    heap_remove(ptr);
+    void *moved = __libc_realloc(ptr, size);
+    if (moved == NULL && size != 0) {
+        heap_add(ptr);  // the old block is still there
+        return NULL;
+    }
+    if (size > before) {
+        heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    heap_add(moved);
+    return moved;
+}
+
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    heap_add(ptr);
+    return ptr;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    *ptr = memalign(alignment, size);
+    return *ptr != NULL || size == 0 ? 0 : ENOMEM;
+}
+
+extern "C" void free(void *ptr)
+{
+    heap_remove(ptr);
+    __libc_free(ptr);
+}
+
+host_heap_stats host_heap_get()
+{
+    host_heap_stats stats;
+    stats.current = heap_current.load(std::memory_order_relaxed);
+    stats.peak = heap_peak.load(std::memory_order_relaxed);
+    stats.blocks = heap_blocks.load(std::memory_order_relaxed);
+    stats.allocations = heap_allocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void host_heap_reset_peak()
+{
+    heap_peak.store(heap_current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
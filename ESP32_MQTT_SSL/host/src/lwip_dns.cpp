@@ -0,0 +1,33 @@
+#include <string.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <lwip/dns.h>
+
+static host_dns_resolver dns_resolver = NULL;
+
+static err_t getaddrinfo_resolver(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg)
+{
+    struct addrinfo hints, *result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(hostname, NULL, &hints, &result) != 0) {
+        return ERR_VAL;
+    }
+    addr->u_addr.addr = ((struct sockaddr_in *)result->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(result);
+    return ERR_OK;
+}
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg)
+{
+    if (hostname == NULL || addr == NULL) {
+        return ERR_ARG;
+    }
+    return (dns_resolver ? dns_resolver : getaddrinfo_resolver)(hostname, addr, found, callback_arg);
+}
+
+void host_dns_set_resolver(host_dns_resolver resolver)
+{
+    dns_resolver = resolver;
+}
@@ -0,0 +1,120 @@
+#include "Arduino.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <mutex>
+#include <vector>
+#include "esp_partition.h"
+#include "host.h"
+
+struct host_partition {
+    esp_partition_t partition;
+    std::vector<uint8_t> data;
+    int fd;  // -1: memory only
+};
+
+static std::mutex partitions_mutex;
+static std::vector<host_partition *> partitions;
+
+bool host_partition_add(const char *label, size_t size, const char *path)
+{
+    if (strlen(label) >= sizeof(esp_partition_t::label) || size == 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+        log_e("Bad partition %s of %u bytes", label, (unsigned)size);
+        return false;
+    }
+
+    host_partition *p = new host_partition;
+    memset(&p->partition, 0, sizeof(p->partition));
+    p->partition.type = ESP_PARTITION_TYPE_DATA;
+    p->partition.subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS;
+    p->partition.size = size;
+    strcpy(p->partition.label, label);
+    p->data.assign(size, 0xff);
+    p->fd = -1;
+
+    if (path != NULL) {
+        p->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (p->fd < 0) {
+            log_e("Can't open %s", path);
+            delete p;
+            return false;
+        }
+        // What the file has is kept, the rest reads as erased
+        ssize_t n = pread(p->fd, p->data.data(), size, 0);
+        if (n < 0 || pwrite(p->fd, p->data.data(), size, 0) != (ssize_t)size) {
+            log_e("Can't use %s", path);
+            close(p->fd);
+            delete p;
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+    partitions.push_back(p);
+    return true;
+}
+
+static host_partition *find(const esp_partition_t *partition)
+{
+    return (host_partition *)((char *)partition - offsetof(host_partition, partition));
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    std::lock_guard<std::mutex> lock(partitions_mutex);
+
+    for (host_partition *p : partitions) {
+        if ((type == ESP_PARTITION_TYPE_ANY || type == p->partition.type) &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || subtype == p->partition.subtype) &&
+            (label == NULL || strcmp(label, p->partition.label) == 0)) {
+            return &p->partition;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    host_partition *p = find(partition);
+
+    if (src_offset > p->data.size() || size > p->data.size() - src_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(dst, p->data.data() + src_offset, size);
+    return ESP_OK;
+}
+
+static esp_err_t store(host_partition *p, size_t offset, size_t size)
+{
+    if (p->fd >= 0 && pwrite(p->fd, p->data.data() + offset, size, offset) != (ssize_t)size) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    host_partition *p = find(partition);
+    const uint8_t *bytes = (const uint8_t *)src;
+
+    if (dst_offset > p->data.size() || size > p->data.size() - dst_offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (size_t i = 0; i < size; i++) {
+        p->data[dst_offset + i] &= bytes[i];
+    }
+    return store(p, dst_offset, size);
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    host_partition *p = find(partition);
+
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset > p->data.size() || size > p->data.size() - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(p->data.data() + offset, 0xff, size);
+    return store(p, offset, size);
+}
@@ -0,0 +1,248 @@
+/* main() for a sketch built for the host: setup() once, then loop() for
+ * the given number of wake cycles. Every loop() call is one wake: its
+ * real duration is the time awake, since sleeping only moves the virtual
+ * clock, and the allocations it made are counted when host_heap.cpp is
+ * linked in. A deep sleep ends the cycle and boots setup() again.
+ *
+ *   esp32_mqtt_ssl --wakes 20 --flash spiffs.bin --csv cycles.csv
+ *
+ * A sketch whose loop() doesn't sleep, like ESP32_PubSubClient_SSL, is
+ * called back to back; --loop-ms moves the clock on after every call.
+ *
+ * --alloc-limit holds the wakes after boot that keep the radio off to a
+ * number of allocations. Wakes that upload join WiFi and connect TLS and
+ * MQTT again, and the handshake allocates inside mbedtls; they are counted
+ * and reported apart, not limited, but at least one has to run so the
+ * upload path was exercised. Publishing on an open connection is held to
+ * zero allocations by test/tls_alloc_test.
+ */
+
+#include "Arduino.h"
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "host.h"
+#include "host_heap.h"
+
+void setup();
+void loop();
+
+// --broker, for secrets_local.h.in
+static const char *broker_host;
+static uint16_t broker_port;
+static bool broker_asked;
+
+const char *host_broker_host(const char *configured)
+{
+    broker_asked = true;
+    return broker_host != NULL ? broker_host : configured;
+}
+
+uint16_t host_broker_port(uint16_t configured)
+{
+    return broker_port != 0 ? broker_port : configured;
+}
+
+// Defined when host_heap.cpp is linked in
+__attribute__((weak)) host_heap_stats host_heap_get();
+
+struct cycle_result {
+    int64_t awake_us;
+    int64_t allocations;   // -1 without host_heap.cpp
+    int64_t heap_bytes;
+    bool boot;             // setup() ran in this cycle
+    bool reconnect;        // WiFi was joined, so TLS and MQTT connected again
+    bool deep_sleep;       // it ended in deep sleep
+};
+
+static int64_t real_us()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: %s [--wakes N] [--flash FILE] [--flash-size BYTES] [--csv FILE]\n"
+            "          [--wifi-ms JOIN,DHCP,FAST] [--alloc-limit N] [--broker HOST:PORT]\n"
+            "          [--loop-ms MS]\n",
+            program_invocation_short_name);
+    exit(2);
+}
+
+static cycle_result run_cycle(bool boot)
+{
+    cycle_result result = {};
+    host_heap_stats before = {};
+    host_wifi_stats wifi_before = host_wifi_get();
+
+    result.boot = boot;
+    if (host_heap_get) {
+        before = host_heap_get();
+    }
+    int64_t start = real_us();
+    try {
+        if (boot) {
+            setup();
+        }
+        loop();
+    } catch (const host_deep_sleep &) {
+        result.deep_sleep = true;
+    }
+    result.awake_us = real_us() - start;
+    host_wifi_stats wifi_after = host_wifi_get();
+    result.reconnect = wifi_after.joins + wifi_after.fast_joins > wifi_before.joins + wifi_before.fast_joins;
+    if (host_heap_get) {
+        host_heap_stats after = host_heap_get();
+        result.allocations = after.allocations - before.allocations;
+        result.heap_bytes = after.current;
+    } else {
+        result.allocations = -1;
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int wakes = 10;
+    const char *flash = NULL;
+    size_t flash_size = 64 * 1024;
+    const char *csv = NULL;
+    long alloc_limit = -1;
+    int64_t loop_ms = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+        } else if (arg == "--wakes") {
+            wakes = atoi(argv[++i]);
+        } else if (arg == "--flash") {
+            flash = argv[++i];
+        } else if (arg == "--flash-size") {
+            flash_size = strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--csv") {
+            csv = argv[++i];
+        } else if (arg == "--wifi-ms") {
+            unsigned join, dhcp, fast;
+            if (sscanf(argv[++i], "%u,%u,%u", &join, &dhcp, &fast) != 3) {
+                usage();
+            }
+            host_wifi_set_timing(join, dhcp, fast);
+        } else if (arg == "--alloc-limit") {
+            alloc_limit = atol(argv[++i]);
+        } else if (arg == "--loop-ms") {
+            loop_ms = atoll(argv[++i]);
+        } else if (arg == "--broker") {
+            // The host name stays in argv for the life of the process
+            char *colon = strrchr(argv[++i], ':');
+            if (colon == NULL || (broker_port = atoi(colon + 1)) == 0) {
+                usage();
+            }
+            *colon = '\0';
+            broker_host = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (wakes < 1 || !host_partition_add("spiffs", flash_size, flash)) {
+        usage();
+    }
+
+    // Reserved, so the runner's own allocations stay out of the counts
+    std::vector<cycle_result> results;
+    results.reserve(wakes);
+    bool boot = true;
+    for (int wake = 0; wake < wakes; wake++) {
+        results.push_back(run_cycle(boot));
+        host_clock_advance(loop_ms * 1000);
+        // A deep sleep boots again, setup() is part of the next wake
+        boot = results.back().deep_sleep;
+    }
+
+    FILE *out = csv != NULL ? fopen(csv, "w") : NULL;
+    if (csv != NULL && out == NULL) {
+        fprintf(stderr, "can't write %s\n", csv);
+        return 2;
+    }
+    if (out != NULL) {
+        fprintf(out, "wake,boot,reconnect,awake_ms,allocations,heap_bytes\n");
+    }
+
+    std::vector<int64_t> awake;
+    int quiet_wakes = 0;
+    int64_t max_allocations = 0;  // of those, the ones --alloc-limit holds
+    int upload_wakes = 0;
+    int64_t max_upload_allocations = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const cycle_result &r = results[i];
+        if (out != NULL) {
+            fprintf(out, "%zu,%d,%d,%.3f,%lld,%lld\n", i, r.boot, r.reconnect, r.awake_us / 1000.0,
+                    (long long)r.allocations, (long long)r.heap_bytes);
+        }
+        // Boots set up the tasks, the client and the first connection
+        if (r.boot) {
+            continue;
+        }
+        awake.push_back(r.awake_us);
+        if (r.reconnect) {
+            upload_wakes++;
+            max_upload_allocations = std::max(max_upload_allocations, r.allocations);
+        } else {
+            quiet_wakes++;
+            max_allocations = std::max(max_allocations, r.allocations);
+        }
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+
+    host_sleep_stats sleep = host_sleep_get();
+    host_wifi_stats wifi = host_wifi_get();
+    fprintf(stderr, "\n%d wakes, %u light sleeps, %u deep sleeps, %.1f s slept\n", wakes, sleep.light_sleeps,
+            sleep.deep_sleeps, sleep.slept_us / 1e6);
+    fprintf(stderr, "wifi: %u joins, %u fast joins, radio on %.1f s\n", wifi.joins, wifi.fast_joins,
+            wifi.radio_on_us / 1e6);
+    fprintf(stderr, "boot: %.1f ms awake", results[0].awake_us / 1000.0);
+    if (host_heap_get) {
+        fprintf(stderr, ", %lld allocations", (long long)results[0].allocations);
+    }
+    fputc('\n', stderr);
+    if (!awake.empty()) {
+        std::sort(awake.begin(), awake.end());
+        fprintf(stderr, "wakes after boot: awake median %.1f ms, max %.1f ms", awake[awake.size() / 2] / 1000.0,
+                awake.back() / 1000.0);
+        fputc('\n', stderr);
+    }
+    if (host_heap_get) {
+        fprintf(stderr, "%d wakes with the radio off: allocations max %lld\n", quiet_wakes,
+                (long long)max_allocations);
+        fprintf(stderr, "%d upload wakes: allocations max %lld, reconnecting included\n", upload_wakes,
+                (long long)max_upload_allocations);
+    }
+
+    int status = 0;
+    if (broker_host != NULL && !broker_asked) {
+        fprintf(stderr, "FAIL: --broker given, but the sketch's secrets_local.h has its own broker\n");
+        status = 1;
+    }
+    if (alloc_limit >= 0 && host_heap_get) {
+        if (quiet_wakes == 0 || upload_wakes == 0) {
+            fprintf(stderr, "FAIL: --alloc-limit needs wakes after boot with and without an upload, "
+                            "run more wakes\n");
+            status = 1;
+        } else if (max_allocations > alloc_limit) {
+            fprintf(stderr, "FAIL: a wake made %lld allocations, the limit is %ld\n", (long long)max_allocations,
+                    alloc_limit);
+            status = 1;
+        }
+    }
+    // The sketch's tasks never return, so don't wait for them
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
@@ -0,0 +1,236 @@
+#include "WiFi.h"
+#include <mutex>
+#include "host.h"
+
+// DHCP hands out these; a static configuration replaces them
+static const IPAddress dhcp_ip(192, 168, 1, 50);
+static const IPAddress dhcp_gateway(192, 168, 1, 1);
+static const IPAddress dhcp_subnet(255, 255, 255, 0);
+static uint8_t ap_bssid[6] = {0x02, 0x00, 0x5e, 0x10, 0x00, 0x01};
+static const int32_t ap_channel = 6;
+
+static struct {
+    std::mutex mutex;
+    bool available = true;
+    uint32_t join_ms = 1200;      // scan, authentication and association
+    uint32_t dhcp_ms = 400;
+    uint32_t fast_join_ms = 150;  // association only
+    wifi_mode_t mode = WIFI_MODE_NULL;
+    bool joining = false;
+    int64_t associated_at = 0;    // virtual us
+    int64_t connected_at = 0;
+    int64_t radio_on_since = -1;  // -1: radio off
+    IPAddress ip, gateway, subnet, dns;  // static configuration, 0 for DHCP
+    host_wifi_stats stats = {};
+    char hostname[33] = "esp32";
+} wifi;
+
+WiFiClass WiFi;
+
+static void radio_on(int64_t now)
+{
+    if (wifi.radio_on_since < 0) {
+        wifi.radio_on_since = now;
+    }
+}
+
+static void radio_off(int64_t now)
+{
+    if (wifi.radio_on_since >= 0) {
+        wifi.stats.radio_on_us += now - wifi.radio_on_since;
+        wifi.radio_on_since = -1;
+    }
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    int64_t now = host_clock_us();
+
+    if (wifi.mode == WIFI_MODE_NULL) {
+        wifi.mode = WIFI_MODE_STA;
+    }
+    radio_on(now);
+    if (!connect) {
+        return WL_DISCONNECTED;
+    }
+
+    // Knowing the access point and the address skips the scan and DHCP
+    bool fast = channel == ap_channel && bssid != NULL && memcmp(bssid, ap_bssid, sizeof(ap_bssid)) == 0 &&
+                (uint32_t)wifi.ip != 0;
+    wifi.joining = true;
+    if (fast) {
+        wifi.stats.fast_joins++;
+        wifi.associated_at = now + wifi.fast_join_ms * 1000LL;
+        wifi.connected_at = wifi.associated_at;
+    } else {
+        wifi.stats.joins++;
+        wifi.associated_at = now + wifi.join_ms * 1000LL;
+        wifi.connected_at = wifi.associated_at + ((uint32_t)wifi.ip != 0 ? 0 : wifi.dhcp_ms * 1000LL);
+    }
+    return WL_DISCONNECTED;
+}
+
+bool WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+
+    if ((uint32_t)local_ip == 0 || (uint32_t)local_ip == 0xffffffff) {
+        wifi.ip = wifi.gateway = wifi.subnet = wifi.dns = (uint32_t)0;
+        return true;
+    }
+    wifi.ip = local_ip;
+    wifi.gateway = gateway;
+    wifi.subnet = subnet;
+    wifi.dns = (uint32_t)dns1 != 0 ? dns1 : gateway;
+    return true;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+
+    wifi.joining = false;
+    if (wifioff) {
+        wifi.mode = WIFI_MODE_NULL;
+        radio_off(host_clock_us());
+    }
+    return true;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+
+    wifi.mode = mode;
+    if (mode == WIFI_MODE_NULL) {
+        wifi.joining = false;
+        radio_off(host_clock_us());
+    }
+    return true;
+}
+
+wifi_mode_t WiFiClass::getMode()
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    return wifi.mode;
+}
+
+bool WiFiClass::setHostname(const char *hostname)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    snprintf(wifi.hostname, sizeof(wifi.hostname), "%s", hostname);
+    return true;
+}
+
+const char *WiFiClass::getHostname()
+{
+    return wifi.hostname;
+}
+
+wl_status_t WiFiClass::status()
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+
+    if (!wifi.joining) {
+        return wifi.mode == WIFI_MODE_NULL ? WL_IDLE_STATUS : WL_DISCONNECTED;
+    }
+    if (!wifi.available) {
+        return WL_NO_SSID_AVAIL;
+    }
+    return host_clock_us() >= wifi.connected_at ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+uint8_t WiFiClass::waitForConnectResult(unsigned long timeout_ms)
+{
+    unsigned long start = millis();
+    wl_status_t state;
+
+    while ((state = status()) == WL_DISCONNECTED && millis() - start < timeout_ms) {
+        delay(100);
+    }
+    return state;
+}
+
+IPAddress WiFiClass::localIP()
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    return (uint32_t)wifi.ip != 0 ? wifi.ip : dhcp_ip;
+}
+
+IPAddress WiFiClass::gatewayIP()
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    return (uint32_t)wifi.ip != 0 ? wifi.gateway : dhcp_gateway;
+}
+
+IPAddress WiFiClass::subnetMask()
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    return (uint32_t)wifi.ip != 0 ? wifi.subnet : dhcp_subnet;
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t dns_no)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    return (uint32_t)wifi.ip != 0 ? wifi.dns : dhcp_gateway;
+}
+
+uint8_t *WiFiClass::BSSID()
+{
+    return ap_bssid;
+}
+
+int32_t WiFiClass::channel()
+{
+    return ap_channel;
+}
+
+int8_t WiFiClass::RSSI()
+{
+    return status() == WL_CONNECTED ? -55 : 0;
+}
+
+String WiFiClass::SSID()
+{
+    return String("host");
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+
+    if (!wifi.joining || !wifi.available || host_clock_us() < wifi.associated_at) {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    memset(ap_info, 0, sizeof(*ap_info));
+    memcpy(ap_info->bssid, ap_bssid, sizeof(ap_bssid));
+    strcpy((char *)ap_info->ssid, "host");
+    ap_info->primary = ap_channel;
+    ap_info->rssi = -55;
+    return ESP_OK;
+}
+
+void host_wifi_set_available(bool available)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    wifi.available = available;
+}
+
+void host_wifi_set_timing(uint32_t join_ms, uint32_t dhcp_ms, uint32_t fast_join_ms)
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    wifi.join_ms = join_ms;
+    wifi.dhcp_ms = dhcp_ms;
+    wifi.fast_join_ms = fast_join_ms;
+}
+
+host_wifi_stats host_wifi_get()
+{
+    std::lock_guard<std::mutex> lock(wifi.mutex);
+    host_wifi_stats stats = wifi.stats;
+    if (wifi.radio_on_since >= 0) {
+        stats.radio_on_us += host_clock_us() - wifi.radio_on_since;
+    }
+    return stats;
+}
@@ -0,0 +1,27 @@
+/* Minimal checks for the host tests: every failed CHECK is reported and
+ * makes check_result() nonzero, the test goes on.
+ */
+
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(condition)                                                                \
+    do {                                                                                \
+        if (!(condition)) {                                                             \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            check_failures++;                                                           \
+        }                                                                               \
+    } while (0)
+
+static inline int check_result()
+{
+    if (check_failures > 0) {
+        fprintf(stderr, "%d checks failed\n", check_failures);
+        return 1;
+    }
+    return 0;
+}
+#endif
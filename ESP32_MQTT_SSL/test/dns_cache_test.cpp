@@ -0,0 +1,156 @@
+/* The resolver and address cache behind WiFiClientSecure::connect(host),
+ * against a stub lwIP resolver that answers when the test says so.
+ */
+
+#include <string.h>
+#include <string>
+#include <arpa/inet.h>
+#include <lwip/dns.h>
+#include "dns_cache.h"
+#include "host.h"
+#include "check.h"
+
+static int queries;
+static dns_found_callback pending_found;
+static void *pending_arg;
+
+// "fail" is refused at once, everything else is answered later
+static err_t stub_resolver(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg)
+{
+    queries++;
+    if (strcmp(hostname, "fail") == 0) {
+        return ERR_VAL;
+    }
+    pending_found = found;
+    pending_arg = callback_arg;
+    return ERR_INPROGRESS;
+}
+
+static void answer(const char *hostname, uint32_t addr)
+{
+    ip_addr_t ip;
+    ip.u_addr.addr = addr;
+    pending_found(hostname, &ip, pending_arg);
+}
+
+static void test_resolve()
+{
+    uint32_t addr = 0;
+
+    CHECK(dns_resolve_start("broker", &addr) == DNS_RESOLVE_PENDING);
+    CHECK(dns_resolve_poll(&addr) == DNS_RESOLVE_PENDING);
+    answer("broker", 0x0a000001);
+    CHECK(dns_resolve_poll(&addr) == DNS_RESOLVE_DONE);
+    CHECK(addr == 0x0a000001);
+
+    // Cached now, no query
+    int before = queries;
+    addr = 0;
+    CHECK(dns_resolve_start("broker", &addr) == DNS_RESOLVE_DONE);
+    CHECK(addr == 0x0a000001);
+    CHECK(queries == before);
+
+    // Refused at once, or answered with nothing
+    CHECK(dns_resolve_start("fail", &addr) == DNS_RESOLVE_FAILED);
+    CHECK(dns_resolve_start("nxdomain", &addr) == DNS_RESOLVE_PENDING);
+    pending_found("nxdomain", NULL, pending_arg);
+    CHECK(dns_resolve_poll(&addr) == DNS_RESOLVE_FAILED);
+    CHECK(!dns_cache_lookup("nxdomain", &addr));
+
+    // Names that don't fit the cache aren't looked up
+    before = queries;
+    std::string long_name(DNS_CACHE_HOST_LEN, 'a');
+    CHECK(dns_resolve_start(long_name.c_str(), &addr) == DNS_RESOLVE_FAILED);
+    CHECK(queries == before);
+}
+
+static void test_abandoned()
+{
+    uint32_t addr = 0;
+
+    // A lookup given up on answers while the next one is in flight
+    CHECK(dns_resolve_start("old", &addr) == DNS_RESOLVE_PENDING);
+    dns_found_callback old_found = pending_found;
+    void *old_arg = pending_arg;
+    CHECK(dns_resolve_start("new", &addr) == DNS_RESOLVE_PENDING);
+
+    ip_addr_t ip;
+    ip.u_addr.addr = 0x0b000001;
+    old_found("old", &ip, old_arg);
+    CHECK(dns_resolve_poll(&addr) == DNS_RESOLVE_PENDING);
+    CHECK(!dns_cache_lookup("old", &addr));
+    answer("new", 0x0b000002);
+    CHECK(dns_resolve_poll(&addr) == DNS_RESOLVE_DONE);
+    CHECK(addr == 0x0b000002);
+}
+
+static void test_expiry()
+{
+    uint32_t addr = 0;
+
+    dns_cache_set_ttl(60);
+    dns_cache_store("short", 0x0c000001);
+    host_clock_advance(59 * 1000000LL);
+    CHECK(dns_cache_lookup("short", &addr));
+    host_clock_advance(2 * 1000000LL);
+    CHECK(!dns_cache_lookup("short", &addr));
+
+    int before = queries;
+    CHECK(dns_resolve_start("short", &addr) == DNS_RESOLVE_PENDING);
+    CHECK(queries == before + 1);
+    answer("short", 0x0c000002);
+    CHECK(dns_resolve_poll(&addr) == DNS_RESOLVE_DONE);
+    CHECK(addr == 0x0c000002);
+
+    dns_cache_invalidate("short");
+    CHECK(!dns_cache_lookup("short", &addr));
+
+    // TTL 0 turns the cache off and empties it
+    dns_cache_store("kept", 0x0c000003);
+    dns_cache_set_ttl(0);
+    CHECK(!dns_cache_lookup("kept", &addr));
+    dns_cache_store("kept", 0x0c000003);
+    CHECK(!dns_cache_lookup("kept", &addr));
+    dns_cache_set_ttl(DNS_CACHE_TTL);
+}
+
+static void test_eviction()
+{
+    uint32_t addr = 0;
+
+    // A new name takes the entry closest to expiry
+    dns_cache_store("first", 1);
+    host_clock_advance(1000000);
+    for (int i = 1; i < DNS_CACHE_ENTRIES; i++) {
+        dns_cache_store(("other" + std::to_string(i)).c_str(), 1 + i);
+    }
+    dns_cache_store("last", 100);
+    CHECK(!dns_cache_lookup("first", &addr));
+    CHECK(dns_cache_lookup("last", &addr) && addr == 100);
+    CHECK(dns_cache_lookup("other1", &addr) && addr == 2);
+
+    // Storing a known name again updates it in place
+    dns_cache_store("last", 101);
+    CHECK(dns_cache_lookup("last", &addr) && addr == 101);
+    CHECK(dns_cache_lookup("other1", &addr));
+}
+
+static void test_getaddrinfo()
+{
+    uint32_t addr = 0;
+
+    host_dns_set_resolver(NULL);
+    CHECK(dns_resolve_start("127.0.0.1", &addr) == DNS_RESOLVE_DONE);
+    CHECK(addr == htonl(0x7f000001));
+}
+
+int main()
+{
+    host_dns_set_resolver(stub_resolver);
+    test_resolve();
+    test_abandoned();
+    test_expiry();
+    test_eviction();
+    test_getaddrinfo();
+    return check_result();
+}
@@ -0,0 +1,329 @@
+/* FlashLog on the host partition: records come back in order and survive
+ * a reset, a full log drops its oldest segment, and what a reset left
+ * halfway (a record without its state, a segment without its header, a
+ * damaged record) is skipped instead of read. The partitions are files, a
+ * reset opens the file again under a new label.
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "flash_log.h"
+#include "host.h"
+#include "check.h"
+
+// Exposes where the next record goes, to break it
+class TestLog : public FlashLog
+{
+public:
+    size_t headAddress()
+    {
+        return _head * FLASH_LOG_SEGMENT_SIZE + _head_offset;
+    }
+    const esp_partition_t *partition()
+    {
+        return _partition;
+    }
+};
+
+static char path[] = "/tmp/flash_log_testXXXXXX";
+
+static size_t make_record(uint32_t index, uint8_t *data)
+{
+    size_t length = 20 + index % 50;
+
+    memcpy(data, &index, sizeof(index));
+    for (size_t i = sizeof(index); i < length; i++) {
+        data[i] = (uint8_t)(index + i);
+    }
+    return length;
+}
+
+static bool append(FlashLog &log, uint32_t index)
+{
+    uint8_t data[80];
+    return log.append(data, make_record(index, data));
+}
+
+// Pops count records, which must be index, index + 1, ...
+static void expect(FlashLog &log, uint32_t index, uint32_t count)
+{
+    uint8_t data[80], expected[80];
+
+    for (uint32_t i = index; i < index + count; i++) {
+        size_t length = log.peek(data, sizeof(data));
+        if (length != make_record(i, expected) || memcmp(data, expected, length) != 0) {
+            uint32_t got = 0;
+            memcpy(&got, data, length >= sizeof(got) ? sizeof(got) : 0);
+            fprintf(stderr, "expected record %u, got %u of %zu bytes\n", i, got, length);
+            CHECK(false);
+            return;
+        }
+        CHECK(log.pop());
+    }
+}
+
+// A new partition on the same file, as after a reset
+static bool reopen(FlashLog &log, size_t size)
+{
+    static int resets = 0;
+    char label[16];
+
+    snprintf(label, sizeof(label), "reset%d", resets++);
+    return host_partition_add(label, size, path) && log.begin(label);
+}
+
+// An erased partition on the file
+static bool erased(FlashLog &log, size_t size)
+{
+    return truncate(path, 0) == 0 && reopen(log, size);
+}
+
+static void test_order()
+{
+    FlashLog log;
+    uint8_t data[80];
+
+    CHECK(host_partition_add("order", 4 * FLASH_LOG_SEGMENT_SIZE, NULL));
+    CHECK(log.begin("order"));
+    CHECK(log.pending() == 0);
+    CHECK(log.peek(data, sizeof(data)) == 0);
+    CHECK(!log.pop());
+
+    for (uint32_t i = 0; i < 100; i++) {
+        CHECK(append(log, i));
+    }
+    CHECK(log.pending() == 100);
+    expect(log, 0, 60);
+    // Appends while reading go behind
+    for (uint32_t i = 100; i < 150; i++) {
+        CHECK(append(log, i));
+    }
+    expect(log, 60, 90);
+    CHECK(log.pending() == 0);
+    CHECK(log.peek(data, sizeof(data)) == 0);
+    CHECK(log.dropped() == 0);
+
+    // Too big for a segment, or empty
+    static uint8_t big[FLASH_LOG_MAX_RECORD + 1];
+    CHECK(log.append(big, FLASH_LOG_MAX_RECORD));
+    CHECK(!log.append(big, FLASH_LOG_MAX_RECORD + 1));
+    CHECK(!log.append(big, 0));
+    CHECK(log.peek(big, sizeof(big)) == FLASH_LOG_MAX_RECORD);
+    CHECK(log.pop());
+
+    // A buffer too small drops the record rather than stalling the log
+    CHECK(append(log, 40));
+    CHECK(append(log, 1));
+    CHECK(log.peek(data, 30) == 21);
+    CHECK(log.dropped() == 1);
+    CHECK(log.pop());
+    CHECK(log.pending() == 0);
+}
+
+static void test_wrap()
+{
+    FlashLog log;
+    const uint32_t count = 1000;
+
+    CHECK(host_partition_add("wrap", 4 * FLASH_LOG_SEGMENT_SIZE, NULL));
+    CHECK(log.begin("wrap"));
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(append(log, i));
+    }
+    printf("wrap: %u records, %u pending, %u dropped, %u erases\n", count, log.pending(), log.dropped(),
+           log.erases());
+    CHECK(log.pending() + log.dropped() == count);
+    CHECK(log.dropped() > 0);
+    // At most the segment being written and the one erased for it are short
+    CHECK(log.pending() * (FLASH_LOG_RECORD_HEADER + 69) >= 2 * (FLASH_LOG_SEGMENT_SIZE - FLASH_LOG_SEGMENT_HEADER));
+    // The newest records, oldest first
+    expect(log, log.dropped(), log.pending());
+    CHECK(log.pending() == 0);
+}
+
+static void test_reset()
+{
+    const size_t size = 3 * FLASH_LOG_SEGMENT_SIZE;
+    FlashLog before;
+
+    CHECK(erased(before, size));
+    for (uint32_t i = 0; i < 300; i++) {
+        CHECK(append(before, i));
+    }
+    uint32_t first = before.dropped();
+    expect(before, first, 10);
+    uint32_t pending = before.pending();
+
+    FlashLog after;
+    CHECK(reopen(after, size));
+    CHECK(after.pending() == pending);
+    CHECK(after.dropped() == 0);
+    // New records go behind the old ones, also once the log wraps again
+    for (uint32_t i = 300; i < 400; i++) {
+        CHECK(append(after, i));
+    }
+    first = 400 - after.pending();
+    CHECK(first > before.dropped() + 10);
+    expect(after, first, after.pending());
+
+    FlashLog again;
+    CHECK(reopen(again, size));
+    CHECK(again.pending() == 0);
+    CHECK(append(again, 400));
+    expect(again, 400, 1);
+}
+
+// A reset during append(): the header and some of the data are written,
+// the state isn't
+static void test_torn_record()
+{
+    const size_t size = 3 * FLASH_LOG_SEGMENT_SIZE;
+    TestLog log;
+    uint8_t data[80];
+
+    CHECK(erased(log, size));
+    for (uint32_t i = 0; i < 5; i++) {
+        CHECK(append(log, i));
+    }
+    size_t length = make_record(5, data);
+    uint8_t header[FLASH_LOG_RECORD_HEADER] = {(uint8_t)length, 0, 0xff, 0x5a};
+    CHECK(esp_partition_write(log.partition(), log.headAddress(), header, sizeof(header)) == ESP_OK);
+    CHECK(esp_partition_write(log.partition(), log.headAddress() + sizeof(header), data, length / 2) == ESP_OK);
+
+    TestLog after;
+    CHECK(reopen(after, size));
+    CHECK(after.pending() == 5);
+    // The segment is closed, the next record starts a new one
+    CHECK(append(after, 5));
+    CHECK(after.headAddress() == FLASH_LOG_SEGMENT_SIZE + FLASH_LOG_SEGMENT_HEADER + FLASH_LOG_RECORD_HEADER + length);
+    expect(after, 0, 6);
+    CHECK(after.pending() == 0);
+    CHECK(after.peek(data, sizeof(data)) == 0);
+}
+
+// A reset between erasing the oldest segment for reuse and writing its
+// header: its records are gone as they would have been, the rest stay
+static void test_torn_segment()
+{
+    const size_t size = 3 * FLASH_LOG_SEGMENT_SIZE;
+    TestLog log;
+    uint32_t count = 0;
+    uint32_t in_first = 0;
+
+    CHECK(erased(log, size));
+    while (log.headAddress() < 2 * FLASH_LOG_SEGMENT_SIZE) {
+        CHECK(append(log, count++));
+        if (log.headAddress() < FLASH_LOG_SEGMENT_SIZE) {
+            in_first = count;
+        }
+    }
+    CHECK(esp_partition_erase_range(log.partition(), 0, FLASH_LOG_SEGMENT_SIZE) == ESP_OK);
+
+    TestLog after;
+    CHECK(reopen(after, size));
+    CHECK(after.pending() == count - in_first);
+    CHECK(after.dropped() == 0);
+    // Segment 2 fills up and 0 is taken again without dropping anything
+    while (after.headAddress() >= FLASH_LOG_SEGMENT_SIZE) {
+        CHECK(append(after, count++));
+    }
+    CHECK(after.dropped() == 0);
+    expect(after, in_first, count - in_first);
+    CHECK(after.pending() == 0);
+}
+
+// A record whose data changed: it and what follows in its segment are lost,
+// the next segment still counts
+static void test_damaged_record()
+{
+    const size_t size = 3 * FLASH_LOG_SEGMENT_SIZE;
+    TestLog log;
+    uint8_t data[80];
+    uint32_t count = 0;
+    size_t third = 0;
+
+    CHECK(erased(log, size));
+    while (log.headAddress() < FLASH_LOG_SEGMENT_SIZE) {
+        if (count == 2) {
+            third = log.headAddress();
+        }
+        CHECK(append(log, count++));
+    }
+    uint32_t in_first = count - 1;
+    for (uint32_t i = 0; i < 5; i++) {
+        CHECK(append(log, count++));
+    }
+    uint8_t zero = 0;
+    CHECK(esp_partition_write(log.partition(), third + FLASH_LOG_RECORD_HEADER + 6, &zero, 1) == ESP_OK);
+
+    FlashLog after;
+    CHECK(reopen(after, size));
+    CHECK(after.pending() == 2 + count - in_first);
+    expect(after, 0, 2);
+    expect(after, in_first, count - in_first);
+    CHECK(after.pending() == 0);
+    CHECK(after.peek(data, sizeof(data)) == 0);
+}
+
+// Every segment is erased in turn, however the records come and go
+static void test_wear()
+{
+    const uint32_t segments = 8;
+    FlashLog log;
+    uint8_t data[80];
+    uint32_t counts[segments] = {};
+
+    CHECK(host_partition_add("wear", segments * FLASH_LOG_SEGMENT_SIZE, NULL));
+    CHECK(log.begin("wear"));
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "wear");
+    uint32_t last = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < 20000; i++) {
+        CHECK(append(log, i));
+        if (i % 3 != 0) {
+            CHECK(log.peek(data, sizeof(data)) > 0);
+            CHECK(log.pop());
+        }
+        // The segment sequence numbers tell which one was started
+        uint32_t header[2];
+        for (uint32_t s = 0; s < segments; s++) {
+            esp_partition_read(partition, s * FLASH_LOG_SEGMENT_SIZE, header, sizeof(header));
+            if (header[1] == last + 1) {
+                counts[s]++;
+                last++;
+            }
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    uint32_t least = counts[0], most = counts[0];
+    for (uint32_t s = 1; s < segments; s++) {
+        least = counts[s] < least ? counts[s] : least;
+        most = counts[s] > most ? counts[s] : most;
+    }
+    printf("wear: %u erases, %u to %u per segment, %.1f records per erase, %.0f ns per record\n", log.erases(), least,
+           most, 20000.0 / log.erases(), std::chrono::duration<double, std::nano>(elapsed).count() / 20000);
+    CHECK(most - least <= 1);
+}
+
+int main()
+{
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    close(fd);
+
+    test_order();
+    test_wrap();
+    test_reset();
+    test_torn_record();
+    test_torn_segment();
+    test_damaged_record();
+    test_wear();
+    unlink(path);
+    return check_result();
+}
@@ -0,0 +1,116 @@
+/* The gas heater schedule: every Nth reading and the one after a request,
+ * which may come from another thread. Then the sketch's readings on the
+ * mock BME680, with the heater on every wake and on every Nth, and the
+ * time a wake saves on average.
+ */
+
+#include "Arduino.h"
+#include <thread>
+#include "Adafruit_BME680.h"
+#include "gas_schedule.h"
+#include "host.h"
+#include "check.h"
+
+static void test_cadence()
+{
+    GasSchedule every_sixth(6);
+    for (int i = 0; i < 30; i++) {
+        CHECK(every_sixth.next() == (i % 6 == 0));
+    }
+
+    // A request is served by the next reading and the count starts over
+    GasSchedule requested(6);
+    CHECK(requested.next());
+    CHECK(!requested.next() && !requested.next());
+    requested.request();
+    requested.request();
+    CHECK(requested.next());
+    for (int i = 1; i < 6; i++) {
+        CHECK(!requested.next());
+    }
+    CHECK(requested.next());
+
+    GasSchedule always(1), never_zero(0);
+    for (int i = 0; i < 5; i++) {
+        CHECK(always.next() && never_zero.next());
+    }
+}
+
+// Requests from another thread are neither lost nor served twice
+static void test_request_thread()
+{
+    GasSchedule schedule(1000000);
+    int served = 0;
+
+    CHECK(schedule.next());
+    std::thread requester([&schedule] {
+        for (int i = 0; i < 100; i++) {
+            schedule.request();
+            delay(1);
+        }
+    });
+    for (int i = 0; i < 2000; i++) {
+        served += schedule.next();
+        delayMicroseconds(200);
+    }
+    requester.join();
+    served += schedule.next();
+    CHECK(served >= 1 && served <= 100);
+    CHECK(!schedule.next());
+}
+
+// Readings as get_BME680_readings() takes them; returns ms per reading
+static double readings_ms(Adafruit_BME680 &bme, uint32_t every_n, int readings, int *gas_readings)
+{
+    GasSchedule schedule(every_n);
+    bool heater_on = true;
+    unsigned long start = millis();
+
+    bme.setGasHeater(320, 150);
+    *gas_readings = 0;
+    for (int i = 0; i < readings; i++) {
+        bool gas = schedule.next();
+        if (gas != heater_on) {
+            bme.setGasHeater(gas ? 320 : 0, gas ? 150 : 0);
+            heater_on = gas;
+        }
+        CHECK(bme.beginReading() != 0);
+        int remaining = bme.remainingReadingMillis();
+        if (remaining > 0) {
+            delay(remaining);
+        }
+        CHECK(bme.endReading());
+        CHECK((bme.gas_resistance != 0) == gas);
+        *gas_readings += gas;
+    }
+    return (double)(millis() - start) / readings;
+}
+
+static void test_time_saved()
+{
+    Adafruit_BME680 bme;
+    const int readings = 12;
+    int gas_always, gas_sixth;
+
+    CHECK(bme.begin());
+    bme.setTemperatureOversampling(BME680_OS_8X);
+    bme.setHumidityOversampling(BME680_OS_2X);
+    bme.setPressureOversampling(BME680_OS_4X);
+    host_bme680_set(21.5, 40, 100000, 50000);
+
+    double always_ms = readings_ms(bme, 1, readings, &gas_always);
+    double sixth_ms = readings_ms(bme, 6, readings, &gas_sixth);
+    printf("gas on every reading: %.1f ms, on every 6th: %.1f ms, %.1f ms saved per wake\n", always_ms, sixth_ms,
+           always_ms - sixth_ms);
+    CHECK(gas_always == readings && gas_sixth == readings / 6);
+    // Five of six readings skip the 150 ms heating
+    CHECK(always_ms - sixth_ms > 150 * 5 / 6 - 10);
+}
+
+int main()
+{
+    test_cadence();
+    test_request_thread();
+    test_time_saved();
+    return check_result();
+}
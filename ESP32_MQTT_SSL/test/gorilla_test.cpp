@@ -0,0 +1,163 @@
+/* Gorilla round trip fuzz: random series, from steady readings to jumps
+ * in time, NaN, infinities and arbitrary bit patterns, encoded into
+ * buffers of random size. Whatever add() accepted must decode bit for bit,
+ * which telemetry_decode_test.py checks from the vectors file. Also prints
+ * the compression ratio and speed on a day of realistic readings.
+ */
+
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "telemetry.h"
+#include "check.h"
+
+static const int iterations = 400;
+static const size_t max_records = 120;
+
+static FILE *vectors;
+
+static void write_vector(const uint8_t *payload, size_t len, const sensor_data *records, uint16_t count)
+{
+    if (vectors == NULL) {
+        return;
+    }
+    fprintf(vectors, "gorilla %u ", count);
+    for (size_t i = 0; i < len; i++) {
+        fprintf(vectors, "%02x", payload[i]);
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t bits[4];
+        memcpy(bits, &records[i].temperature, sizeof(uint32_t));
+        memcpy(bits + 1, &records[i].humidity, sizeof(uint32_t));
+        memcpy(bits + 2, &records[i].pressure, sizeof(uint32_t));
+        memcpy(bits + 3, &records[i].gasResistance, sizeof(uint32_t));
+        fprintf(vectors, " %lld,%u,%08x,%08x,%08x,%08x", (long long)records[i].timestamp, records[i].fresh, bits[0],
+                bits[1], bits[2], bits[3]);
+    }
+    fprintf(vectors, "\n");
+}
+
+static std::vector<sensor_data> random_series(std::mt19937 &random)
+{
+    std::vector<sensor_data> records(1 + random() % max_records);
+    uint32_t timestamp = random();
+    float values[4] = {20.0f, 50.0f, 1000.0f, 100.0f};
+
+    for (sensor_data &r : records) {
+        // Mostly regular, sometimes late or early, rarely anywhere
+        uint32_t kind = random() % 10;
+        timestamp += kind == 0 ? random() : kind == 1 ? random() % 5000 - 2500 : 20 + random() % 3 - 1;
+        r.timestamp = timestamp;
+        for (float &v : values) {
+            uint32_t change = random() % 20;
+            if (change == 0) {
+                v = NAN;
+            } else if (change == 1) {
+                uint32_t bits = random();
+                memcpy(&v, &bits, sizeof(v));
+            } else if (change == 2) {
+                v = random() % 2 ? INFINITY : -INFINITY;
+            } else if (change < 10) {
+                v = (isnan(v) || isinf(v) ? 1.0f : v) + ((int)(random() % 200) - 100) / 100.0f;
+            }
+        }
+        r.temperature = values[0];
+        r.humidity = values[1];
+        r.pressure = values[2];
+        r.gasResistance = values[3];
+        r.fresh = SENSOR_FRESH_ALL;
+    }
+    return records;
+}
+
+static void test_fuzz()
+{
+    std::mt19937 random(1);
+    uint8_t payload[2048];
+
+    for (int i = 0; i < iterations; i++) {
+        std::vector<sensor_data> records = random_series(random);
+        size_t size = 4 + random() % 1500;
+        bool batch = random() % 5 != 0;
+        GorillaTelemetryEncoder encoder;
+        uint16_t added = 0;
+
+        memset(payload, 0xa5, sizeof(payload));
+        encoder.begin(payload, size, batch);
+        while (added < records.size() && encoder.add(records[added])) {
+            added++;
+        }
+        // Once full it stays full
+        CHECK(added == records.size() || !encoder.add(records[added]));
+        size_t len = encoder.end();
+        CHECK(encoder.count() == added);
+        CHECK(len <= size);
+        CHECK(payload[size] == 0xa5);
+        CHECK(batch || added <= 1);
+        if (added > 0) {
+            write_vector(payload, len, records.data(), added);
+        }
+    }
+}
+
+static void bench()
+{
+    std::vector<sensor_data> records(4320);  // a day every 20 s
+    uint8_t payload[1536];
+    size_t gorilla_bytes = 0;
+    size_t packed_bytes = 0;
+    const int runs = 20;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        sensor_data &r = records[i];
+        r.timestamp = 1760000000 + 20 * i + (i % 50 == 0 ? 1 : 0);
+        r.temperature = roundf((21.5f + 3.0f * sinf(i / 700.0f)) * 100) / 100;
+        r.humidity = roundf((48.0f + 10.0f * cosf(i / 500.0f)) * 100) / 100;
+        r.pressure = roundf((1013.25f + 2.0f * sinf(i / 1300.0f)) * 50) / 50;
+        r.gasResistance = roundf((80.0f + 5.0f * sinf(i / 90.0f)) * 1000) / 1000;
+        r.fresh = SENSOR_FRESH_ALL;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        GorillaTelemetryEncoder gorilla;
+        gorilla_bytes = 0;
+        for (size_t next = 0; next < records.size(); next += gorilla.count()) {
+            gorilla.begin(payload, sizeof(payload), true);
+            while (next + gorilla.count() < records.size() && gorilla.add(records[next + gorilla.count()])) {
+            }
+            gorilla_bytes += gorilla.end();
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double gorilla_ns = std::chrono::duration<double, std::nano>(elapsed).count() / runs / records.size();
+
+    PackedTelemetryEncoder packed;
+    for (size_t next = 0; next < records.size(); next += packed.count()) {
+        packed.begin(payload, sizeof(payload), true);
+        while (next + packed.count() < records.size() && packed.add(records[next + packed.count()])) {
+        }
+        packed_bytes += packed.end();
+    }
+
+    printf("gorilla: %.2f bytes per record, %.1fx smaller than packed, %.0f ns per record\n",
+           (double)gorilla_bytes / records.size(), (double)packed_bytes / gorilla_bytes, gorilla_ns);
+    CHECK(gorilla_bytes * 2 < packed_bytes);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && (vectors = fopen(argv[1], "w")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    test_fuzz();
+    bench();
+    if (vectors != NULL) {
+        fclose(vectors);
+    }
+    return check_result();
+}
@@ -0,0 +1,269 @@
+/* The host emulation itself: virtual time, WiFi join timing, FreeRTOS
+ * notifications and mutexes, the BME680 mock, flash partitions and the
+ * heap figures.
+ */
+
+#include "Arduino.h"
+#include <unistd.h>
+#include <atomic>
+#include "WiFi.h"
+#include "Adafruit_BME680.h"
+#include "esp_heap_caps.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+#include "host.h"
+#include "check.h"
+
+static void test_sleep()
+{
+    host_sleep_stats before = host_sleep_get();
+    unsigned long start = millis();
+    int64_t timer_start = esp_timer_get_time();
+    time_t time_start = time(nullptr);
+
+    CHECK(esp_sleep_enable_timer_wakeup(20 * 1000000ULL) == ESP_OK);
+    CHECK(esp_light_sleep_start() == ESP_OK);
+
+    // The clock moved on by the sleep, the process didn't wait for it
+    CHECK(millis() - start >= 20000);
+    CHECK(millis() - start < 21000);
+    CHECK(esp_timer_get_time() - timer_start >= 20 * 1000000LL);
+    CHECK(time(nullptr) - time_start >= 20);
+    CHECK(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER);
+
+    host_sleep_stats after = host_sleep_get();
+    CHECK(after.light_sleeps == before.light_sleeps + 1);
+    CHECK(after.slept_us - before.slept_us == 20 * 1000000LL);
+
+    bool woke = false;
+    try {
+        esp_deep_sleep(1000000);
+    } catch (const host_deep_sleep &) {
+        woke = true;
+    }
+    CHECK(woke);
+    CHECK(host_sleep_get().deep_sleeps == before.deep_sleeps + 1);
+}
+
+static void test_time()
+{
+    // Seconds since boot until SNTP has set the clock
+    CHECK(time(nullptr) < 1510592825);
+    configTime(0, 0, "pool.ntp.org");
+    time_t now = time(nullptr);
+    CHECK(now >= 1510592825);
+    CHECK(llabs((long long)now - (long long)::time(nullptr)) <= 1);
+}
+
+static void test_wifi()
+{
+    host_wifi_set_timing(60, 40, 10);
+    host_wifi_stats before = host_wifi_get();
+    wifi_ap_record_t ap;
+
+    // Full join: scan and association, then DHCP
+    WiFi.mode(WIFI_STA);
+    unsigned long start = millis();
+    WiFi.begin("host", "pass");
+    CHECK(WiFi.status() == WL_DISCONNECTED);
+    CHECK(esp_wifi_sta_get_ap_info(&ap) == ESP_ERR_WIFI_NOT_CONNECT);
+    while (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        delay(1);
+    }
+    unsigned long associated = millis() - start;
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(1);
+    }
+    unsigned long connected = millis() - start;
+    CHECK(associated >= 60 && associated < 100);
+    CHECK(connected >= 100 && connected < 200);
+    CHECK(WiFi.localIP() == IPAddress(192, 168, 1, 50));
+    CHECK(ap.primary == WiFi.channel());
+
+    // Fast join: known access point and a static address skip both
+    IPAddress ip = WiFi.localIP(), gateway = WiFi.gatewayIP(), subnet = WiFi.subnetMask(), dns = WiFi.dnsIP();
+    uint8_t bssid[6];
+    memcpy(bssid, WiFi.BSSID(), sizeof(bssid));
+    WiFi.disconnect(true);
+    CHECK(WiFi.status() != WL_CONNECTED);
+    WiFi.mode(WIFI_STA);
+    WiFi.config(ip, gateway, subnet, dns);
+    start = millis();
+    WiFi.begin("host", "pass", WiFi.channel(), bssid);
+    while (WiFi.status() != WL_CONNECTED && millis() - start < 1000) {
+        delay(1);
+    }
+    CHECK(millis() - start >= 10 && millis() - start < 60);
+
+    host_wifi_stats after = host_wifi_get();
+    CHECK(after.joins == before.joins + 1);
+    CHECK(after.fast_joins == before.fast_joins + 1);
+    CHECK(after.radio_on_us > before.radio_on_us);
+
+    // The radio is off while sleeping with WiFi off
+    WiFi.disconnect(true);
+    int64_t radio_on = host_wifi_get().radio_on_us;
+    esp_sleep_enable_timer_wakeup(1000000);
+    esp_light_sleep_start();
+    CHECK(host_wifi_get().radio_on_us == radio_on);
+
+    host_wifi_set_available(false);
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+    WiFi.begin("host", "pass");
+    CHECK(WiFi.waitForConnectResult(300) == WL_NO_SSID_AVAIL);
+    WiFi.disconnect(true);
+    host_wifi_set_available(true);
+}
+
+static TaskHandle_t main_task;
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+static std::atomic<int> rounds{0};
+static std::atomic<bool> lock_timed_out{false};
+
+static void echo_task(void *)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (rounds == 0) {
+            // The test holds the lock for now
+            lock_timed_out = xSemaphoreTake(lock, pdMS_TO_TICKS(20)) == pdFALSE;
+        }
+        rounds++;
+        xTaskNotifyGive(main_task);
+    }
+}
+
+static void test_tasks()
+{
+    TaskHandle_t echo;
+
+    main_task = xTaskGetCurrentTaskHandle();
+    lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+    CHECK(xSemaphoreTake(lock, portMAX_DELAY) == pdTRUE);
+    CHECK(xTaskCreatePinnedToCore(echo_task, "echo", 4096, NULL, 1, &echo, 0) == pdPASS);
+
+    // Nothing pending: the wait times out
+    CHECK(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10)) == 0);
+    for (int i = 0; i < 100; i++) {
+        xTaskNotifyGive(echo);
+        CHECK(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) == 1);
+    }
+    CHECK(rounds == 100);
+    CHECK(lock_timed_out);
+    xSemaphoreGive(lock);
+
+    // Notifications given before the wait are counted, not lost
+    xTaskNotifyGive(main_task);
+    xTaskNotifyGive(main_task);
+    CHECK(ulTaskNotifyTake(pdFALSE, 0) == 2);
+    CHECK(ulTaskNotifyTake(pdTRUE, 0) == 1);
+}
+
+static void test_bme680()
+{
+    Adafruit_BME680 bme;
+
+    CHECK(!bme.begin(0x12));
+    CHECK(bme.begin());
+    bme.setTemperatureOversampling(BME680_OS_8X);
+    bme.setHumidityOversampling(BME680_OS_2X);
+    bme.setPressureOversampling(BME680_OS_4X);
+    bme.setGasHeater(320, 150);
+
+    // Heater time plus (8 + 2 + 4) oversampling cycles
+    unsigned long start = millis();
+    unsigned long end = bme.beginReading();
+    CHECK(end - start >= 150 + 27 && end - start <= 150 + 35);
+    CHECK(bme.remainingReadingMillis() > 150);
+
+    host_bme680_set(21.5, 40, 100000, 50000);
+    CHECK(bme.endReading());
+    CHECK(millis() >= end);
+    CHECK(bme.temperature == 21.5f);
+    CHECK(bme.humidity == 40);
+    CHECK(bme.pressure == 100000);
+    CHECK(bme.gas_resistance == 50000);
+    CHECK(bme.remainingReadingMillis() == -1);
+
+    // Without the heater it is quick and has no gas reading
+    bme.setGasHeater(0, 0);
+    start = millis();
+    CHECK(bme.performReading());
+    CHECK(millis() - start < 60);
+    CHECK(bme.gas_resistance == 0);
+
+    host_bme680_auto();
+    CHECK(bme.performReading());
+    CHECK(bme.temperature > 10 && bme.temperature < 30);
+    CHECK(bme.pressure > 90000 && bme.pressure < 110000);
+}
+
+static void test_partition()
+{
+    char path[] = "/tmp/host_test_flashXXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    CHECK(!host_partition_add("odd", 1000, NULL));
+    CHECK(host_partition_add("flash", 2 * SPI_FLASH_SEC_SIZE, path));
+    const esp_partition_t *p = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "flash");
+    CHECK(p != NULL);
+    CHECK(esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "none") == NULL);
+    if (p == NULL) {
+        return;
+    }
+    CHECK(p->size == 2 * SPI_FLASH_SEC_SIZE);
+
+    // Erased flash reads 0xff, writes only clear bits
+    uint8_t byte;
+    CHECK(esp_partition_read(p, 100, &byte, 1) == ESP_OK && byte == 0xff);
+    byte = 0xf0;
+    CHECK(esp_partition_write(p, 100, &byte, 1) == ESP_OK);
+    byte = 0x3c;
+    CHECK(esp_partition_write(p, 100, &byte, 1) == ESP_OK);
+    CHECK(esp_partition_read(p, 100, &byte, 1) == ESP_OK && byte == 0x30);
+
+    CHECK(esp_partition_write(p, p->size - 1, "ab", 2) == ESP_ERR_INVALID_SIZE);
+    CHECK(esp_partition_read(p, p->size, &byte, 1) == ESP_ERR_INVALID_SIZE);
+    CHECK(esp_partition_erase_range(p, 100, SPI_FLASH_SEC_SIZE) == ESP_ERR_INVALID_ARG);
+    CHECK(esp_partition_erase_range(p, SPI_FLASH_SEC_SIZE, 2 * SPI_FLASH_SEC_SIZE) == ESP_ERR_INVALID_SIZE);
+
+    CHECK(esp_partition_write(p, SPI_FLASH_SEC_SIZE + 10, "x", 1) == ESP_OK);
+    CHECK(esp_partition_erase_range(p, SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) == ESP_OK);
+    CHECK(esp_partition_read(p, SPI_FLASH_SEC_SIZE + 10, &byte, 1) == ESP_OK && byte == 0xff);
+
+    // The file keeps the contents for the next run
+    CHECK(host_partition_add("again", 2 * SPI_FLASH_SEC_SIZE, path));
+    const esp_partition_t *again = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, "again");
+    CHECK(again != NULL && esp_partition_read(again, 100, &byte, 1) == ESP_OK && byte == 0x30);
+    unlink(path);
+}
+
+static void test_heap()
+{
+    multi_heap_info_t before, after;
+
+    heap_caps_get_info(&before, MALLOC_CAP_8BIT);
+    void *block = malloc(10000);
+    heap_caps_get_info(&after, MALLOC_CAP_8BIT);
+    CHECK(block != NULL);
+    CHECK(before.total_free_bytes - after.total_free_bytes >= 10000);
+    CHECK(after.allocated_blocks == before.allocated_blocks + 1);
+    CHECK(heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT) <= after.total_free_bytes);
+    free(block);
+    CHECK(heap_caps_get_free_size(MALLOC_CAP_8BIT) == before.total_free_bytes);
+}
+
+int main()
+{
+    test_time();
+    test_sleep();
+    test_wifi();
+    test_tasks();
+    test_bme680();
+    test_partition();
+    test_heap();
+    return check_result();
+}
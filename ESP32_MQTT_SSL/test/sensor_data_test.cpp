@@ -0,0 +1,145 @@
+/* packed_sensor_data: every stored value survives a trip through
+ * sensor_data unchanged, readings come back within half a step over the
+ * ranges sensor_data.h gives, values beyond are clamped, and fields that
+ * weren't measured or read as NaN stay not measured.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "sensor_data.h"
+#include "check.h"
+
+static sensor_data reading(float temperature, float humidity, float pressure, float gas)
+{
+    sensor_data data = {(time_t)SAMPLE_EPOCH + 1000, temperature, humidity, pressure, gas, SENSOR_FRESH_ALL};
+    return data;
+}
+
+static bool same(const packed_sensor_data &a, const packed_sensor_data &b)
+{
+    return a.timestamp == b.timestamp && a.temperature == b.temperature && a.humidity == b.humidity &&
+           a.pressure == b.pressure && a.gas == b.gas;
+}
+
+// Every 16 bit value of every field, none included
+static void test_lossless()
+{
+    int mismatches = 0;
+
+    for (uint32_t v = 0; v <= UINT16_MAX; v++) {
+        packed_sensor_data packed = {v * 65537, (int16_t)v, (uint16_t)v, (uint16_t)v, (uint16_t)v};
+        packed_sensor_data again = pack_sensor_data(unpack_sensor_data(packed));
+        if (!same(packed, again)) {
+            if (mismatches++ < 5) {
+                printf("%u: %d %u %u %u came back as %d %u %u %u\n", v, packed.temperature, packed.humidity,
+                       packed.pressure, packed.gas, again.temperature, again.humidity, again.pressure, again.gas);
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+static void test_precision()
+{
+    float worst[4] = {};
+
+    for (float t = -40.0f; t <= 85.0f; t += 0.0137f) {
+        sensor_data back = unpack_sensor_data(pack_sensor_data(reading(t, 50.0f, 1000.0f, 100.0f)));
+        worst[0] = fmaxf(worst[0], fabsf(back.temperature - t));
+    }
+    for (float h = 0.0f; h <= 100.0f; h += 0.0113f) {
+        sensor_data back = unpack_sensor_data(pack_sensor_data(reading(20.0f, h, 1000.0f, 100.0f)));
+        worst[1] = fmaxf(worst[1], fabsf(back.humidity - h));
+    }
+    for (float p = 300.0f; p <= 1100.0f; p += 0.0171f) {
+        sensor_data back = unpack_sensor_data(pack_sensor_data(reading(20.0f, 50.0f, p, 100.0f)));
+        worst[2] = fmaxf(worst[2], fabsf(back.pressure - p));
+    }
+    // KOhm, from 2 Ohm to 4 GOhm. Step 0 is 0 Ohm, so 1 Ohm is a step off.
+    for (float g = 0.002f; g <= 4.0e6f; g *= 1.0007f) {
+        sensor_data back = unpack_sensor_data(pack_sensor_data(reading(20.0f, 50.0f, 1000.0f, g)));
+        worst[3] = fmaxf(worst[3], fabsf(back.gasResistance - g) / g);
+    }
+    printf("worst error: %.4f C, %.4f %%, %.4f hPa, %.4f %% of gas resistance\n", worst[0], worst[1], worst[2],
+           worst[3] * 100);
+    // Half a step, and float rounding on top
+    CHECK(worst[0] <= 0.005f + 1e-5f);
+    CHECK(worst[1] <= 0.005f + 1e-5f);
+    CHECK(worst[2] <= 0.01f + 1e-4f);
+    CHECK(worst[3] <= exp2f(0.5f / 2048) - 1 + 1e-5f);
+    sensor_data one_ohm = unpack_sensor_data(pack_sensor_data(reading(20.0f, 50.0f, 1000.0f, 0.001f)));
+    CHECK(fabsf(one_ohm.gasResistance - 0.001f) / 0.001f <= exp2f(1.0f / 2048) - 1 + 1e-5f);
+}
+
+static void test_clamping()
+{
+    sensor_data high = unpack_sensor_data(pack_sensor_data(reading(400.0f, 700.0f, 2000.0f, 1.0e7f)));
+    CHECK(high.fresh == SENSOR_FRESH_ALL);
+    CHECK(high.temperature == 327.67f);
+    CHECK(high.humidity == 655.34f);
+    CHECK(high.pressure == 1310.68f);
+    CHECK(high.gasResistance > 4.29e6f && high.gasResistance < 4.3e6f);
+
+    sensor_data low = unpack_sensor_data(pack_sensor_data(reading(-400.0f, -5.0f, -1.0f, -1.0f)));
+    CHECK(low.fresh == SENSOR_FRESH_ALL);
+    CHECK(low.temperature == -327.67f);
+    CHECK(low.humidity == 0.0f);
+    CHECK(low.pressure == 0.0f);
+    CHECK(low.gasResistance == 0.0f);
+
+    // Below 1 Ohm is 0, which stays a measured 0
+    sensor_data zero = unpack_sensor_data(pack_sensor_data(reading(0.0f, 0.0f, 0.0f, 0.0005f)));
+    CHECK(zero.fresh == SENSOR_FRESH_ALL);
+    CHECK(zero.temperature == 0.0f && zero.gasResistance == 0.0f);
+
+    sensor_data infinite = unpack_sensor_data(pack_sensor_data(reading(INFINITY, -INFINITY, INFINITY, INFINITY)));
+    CHECK(infinite.fresh == SENSOR_FRESH_ALL);
+    CHECK(infinite.temperature == 327.67f && infinite.humidity == 0.0f);
+}
+
+static void test_not_measured()
+{
+    for (uint8_t fresh = 0; fresh <= SENSOR_FRESH_ALL; fresh++) {
+        sensor_data data = reading(20.0f, 50.0f, 1000.0f, 100.0f);
+        data.fresh = fresh;
+        sensor_data back = unpack_sensor_data(pack_sensor_data(data));
+        CHECK(back.fresh == fresh);
+        CHECK(isnan(back.temperature) == !(fresh & SENSOR_FRESH_TEMPERATURE));
+        CHECK(isnan(back.humidity) == !(fresh & SENSOR_FRESH_HUMIDITY));
+        CHECK(isnan(back.pressure) == !(fresh & SENSOR_FRESH_PRESSURE));
+        CHECK(isnan(back.gasResistance) == !(fresh & SENSOR_FRESH_GAS));
+    }
+
+    // A NaN reading isn't clamped to a value
+    sensor_data back = unpack_sensor_data(pack_sensor_data(reading(NAN, NAN, NAN, NAN)));
+    CHECK(back.fresh == 0);
+    CHECK(isnan(back.temperature) && isnan(back.humidity) && isnan(back.pressure) && isnan(back.gasResistance));
+}
+
+static void test_timestamps()
+{
+    sensor_data data = reading(20.0f, 50.0f, 1000.0f, 100.0f);
+
+    data.timestamp = SAMPLE_EPOCH;
+    CHECK(pack_sensor_data(data).timestamp == 0);
+    data.timestamp = (time_t)SAMPLE_EPOCH + UINT32_MAX;
+    CHECK(unpack_sensor_data(pack_sensor_data(data)).timestamp == data.timestamp);
+    data.timestamp = 1760000000;
+    CHECK(unpack_sensor_data(pack_sensor_data(data)).timestamp == 1760000000);
+    // Before the clock was set
+    data.timestamp = 20;
+    CHECK(pack_sensor_data(data).timestamp == 0);
+}
+
+int main()
+{
+    printf("sensor_data %zu bytes, packed_sensor_data %zu bytes\n", sizeof(sensor_data), sizeof(packed_sensor_data));
+    CHECK(2 * sizeof(packed_sensor_data) <= sizeof(sensor_data));
+    test_lossless();
+    test_precision();
+    test_clamping();
+    test_not_measured();
+    test_timestamps();
+    return check_result();
+}
@@ -0,0 +1,55 @@
+/* A host build of a sketch against the loopback server answering as a
+ * broker, so its wake cycles are tested without one:
+ *
+ *   sketch_wakes_test build/.../esp32_mqtt_ssl --wakes 50 --alloc-limit 0
+ *
+ * runs the sketch with the given arguments and --broker pointing at the
+ * server, and checks that it succeeds and published. What a wake has to
+ * do, like uploading after boot, the runner's own options check.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "tls_server.h"
+#include "check.h"
+
+int main(int argc, char **argv)
+{
+    TlsServer server;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SKETCH [ARGS...]\n", argv[0]);
+        return 2;
+    }
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    server.setMqtt(true);
+
+    std::string broker = "localhost:" + std::to_string(server.port());
+    std::vector<char *> args(argv + 1, argv + argc);
+    args.push_back((char *)"--broker");
+    args.push_back((char *)broker.c_str());
+    args.push_back(NULL);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(args[0], args.data());
+        perror(args[0]);
+        _exit(127);
+    }
+    int status = -1;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    tls_server_stats stats = server.stats();
+    printf("broker: %u connections, %u handshakes (%u resumed), %u publishes\n", stats.connections, stats.handshakes,
+           stats.resumed, stats.publishes);
+    CHECK(stats.handshakes >= 1);
+    CHECK(stats.publishes > 0);
+    server.stop();
+    return check_result();
+}
@@ -0,0 +1,202 @@
+/* SpscRing between two threads, as between the sensor and the network
+ * task: every record arrives once, in order and whole, also while the
+ * consumer looks at records it hasn't shifted yet. Built a second time with
+ * ThreadSanitizer where the compiler has it. Then the latency from push to
+ * shift at a steady sample rate, against a mutex-guarded queue.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include "sensor_data.h"
+#include "spsc_ring.h"
+#include "check.h"
+
+typedef std::chrono::steady_clock steady;
+
+static packed_sensor_data record(uint32_t index)
+{
+    packed_sensor_data r = {index, (int16_t)index, (uint16_t)~index, (uint16_t)(index * 7), (uint16_t)(index >> 16)};
+    return r;
+}
+
+static bool whole(const packed_sensor_data &r, uint32_t index)
+{
+    packed_sensor_data expected = record(index);
+    return r.timestamp == expected.timestamp && r.temperature == expected.temperature &&
+           r.humidity == expected.humidity && r.pressure == expected.pressure && r.gas == expected.gas;
+}
+
+static void test_single_thread()
+{
+    SpscRing<packed_sensor_data, 4> ring;
+
+    CHECK(ring.isEmpty() && !ring.isFull());
+    // Round and round, past the 2N the positions run over
+    for (uint32_t i = 0; i < 20; i++) {
+        CHECK(ring.push(record(3 * i)));
+        CHECK(ring.push(record(3 * i + 1)));
+        CHECK(ring.push(record(3 * i + 2)));
+        CHECK(ring.size() == 3);
+        CHECK(whole(ring.first(), 3 * i) && whole(ring[1], 3 * i + 1) && whole(ring.last(), 3 * i + 2));
+        CHECK(whole(ring.shift(), 3 * i));
+        CHECK(whole(ring.shift(), 3 * i + 1));
+        CHECK(whole(ring.shift(), 3 * i + 2));
+        CHECK(ring.isEmpty());
+    }
+    // Full refuses instead of overwriting
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(ring.push(record(i)));
+    }
+    CHECK(ring.isFull());
+    CHECK(!ring.push(record(4)));
+    CHECK(whole(ring.first(), 0) && whole(ring.last(), 3));
+}
+
+static void test_threads(uint32_t count)
+{
+    static SpscRing<packed_sensor_data, 300> ring;
+    uint32_t expected = 0;
+    uint32_t errors = 0;
+    uint32_t full = 0;
+
+    std::thread producer([count, &full] {
+        for (uint32_t i = 0; i < count;) {
+            if (ring.push(record(i))) {
+                i++;
+            } else {
+                full++;
+                std::this_thread::yield();
+            }
+        }
+    });
+    while (expected < count) {
+        size_t size = ring.size();
+        if (size == 0) {
+            std::this_thread::yield();
+        }
+        // Read in place first, as the encoders do, then shift
+        for (size_t k = 0; k < size; k++) {
+            if (!whole(ring[k], expected + k)) {
+                errors++;
+            }
+        }
+        if (size > 0 && !whole(ring.last(), expected + size - 1)) {
+            errors++;
+        }
+        for (size_t k = 0; k < size; k++) {
+            if (!whole(ring.shift(), expected++)) {
+                errors++;
+            }
+        }
+    }
+    producer.join();
+    printf("threads: %u records, %u errors, ring full %u times\n", count, errors, full);
+    CHECK(errors == 0);
+    CHECK(ring.isEmpty());
+}
+
+// A queue as the ring replaces it, behind a mutex
+class LockedQueue
+{
+public:
+    bool push(const packed_sensor_data &value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_queue.size() == 300) {
+            return false;
+        }
+        _queue.push_back(value);
+        return true;
+    }
+    bool pop(packed_sensor_data *value)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_queue.empty()) {
+            return false;
+        }
+        *value = _queue.front();
+        _queue.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex _mutex;
+    std::deque<packed_sensor_data> _queue;
+};
+
+class RingQueue
+{
+public:
+    bool push(const packed_sensor_data &value)
+    {
+        return _ring.push(value);
+    }
+    bool pop(packed_sensor_data *value)
+    {
+        if (_ring.isEmpty()) {
+            return false;
+        }
+        *value = _ring.shift();
+        return true;
+    }
+
+private:
+    SpscRing<packed_sensor_data, 300> _ring;
+};
+
+// Pushes a record every period, the consumer polls and notes how long each
+// one took to arrive. Both give up the CPU while they wait, as the tasks do.
+template <typename Queue>
+static void bench_latency(const char *name, uint32_t count)
+{
+    static Queue queue;
+    const auto period = std::chrono::microseconds(50);
+    std::vector<steady::time_point> pushed(count);
+    std::vector<double> latency_ns(count);
+
+    std::thread producer([&] {
+        auto next = steady::now();
+        for (uint32_t i = 0; i < count; i++) {
+            std::this_thread::sleep_until(next);
+            pushed[i] = steady::now();
+            while (!queue.push(record(i))) {
+                std::this_thread::yield();
+            }
+            next += period;
+        }
+    });
+    for (uint32_t received = 0; received < count;) {
+        packed_sensor_data r;
+        if (queue.pop(&r)) {
+            latency_ns[r.timestamp] = std::chrono::duration<double, std::nano>(steady::now() - pushed[r.timestamp]).count();
+            received++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    std::sort(latency_ns.begin(), latency_ns.end());
+    printf("%-8s push to shift: median %6.0f ns, 99%% %7.0f ns, 99.9%% %7.0f ns, max %8.0f ns\n", name,
+           latency_ns[count / 2], latency_ns[count * 99 / 100], latency_ns[count * 999 / 1000], latency_ns[count - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    // Fewer under ThreadSanitizer, which is a lot slower
+    uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    test_single_thread();
+    test_threads(count);
+    if (argc <= 1) {
+        bench_latency<RingQueue>("ring", 20000);
+        bench_latency<LockedQueue>("mutex", 20000);
+    }
+    return check_result();
+}
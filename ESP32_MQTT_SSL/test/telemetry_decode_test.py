@@ -0,0 +1,70 @@
+"""Decodes the payloads the telemetry tests wrote with tools/mqtt_decode.py
+and compares them with the records they were made from.
+
+Each line of a vectors file is a format, the record count, the payload in
+hex and then timestamp,fresh and the bits of the four floats per record.
+Binary formats must come back bit for bit, JSON to its printed precision.
+Fields that weren't measured are missing in JSON and CBOR and empty (NaN)
+in the others.
+"""
+
+import math
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "..", "..", "tools"))
+import mqtt_decode  # noqa: E402
+
+VALUES = mqtt_decode.FIELDS[1:]
+
+
+def check_value(fmt, name, fresh, expected, record):
+    if fmt in ("json", "cbor") and not fresh:
+        return name not in record
+    value = record.get(name)
+    if not fresh or math.isnan(expected):
+        return value is None
+    if value is None:
+        return False
+    if fmt == "json":
+        return math.isclose(value, expected, rel_tol=1e-6, abs_tol=1e-30)
+    return struct.pack("<f", value) == struct.pack("<f", expected)
+
+
+def check_line(line):
+    fmt, count, payload, *expected = line.split()
+    records = mqtt_decode.decode_payload(bytes.fromhex(payload))
+    if len(records) != int(count) or len(expected) != int(count):
+        return "%d records, expected %s" % (len(records), count)
+    for i, (record, fields) in enumerate(zip(records, expected)):
+        timestamp, fresh, *bits = fields.split(",")
+        if record.get("timestamp") != int(timestamp):
+            return "record %d: timestamp %s, expected %s" % (i, record.get("timestamp"), timestamp)
+        for f, (name, value_bits) in enumerate(zip(VALUES, bits)):
+            expected_value = struct.unpack("<f", struct.pack("<I", int(value_bits, 16)))[0]
+            if not check_value(fmt, name, int(fresh) >> f & 1, expected_value, record):
+                return "record %d: %s %s, expected %r" % (i, name, record.get(name), expected_value)
+    return None
+
+
+def main(paths):
+    failures = 0
+    payloads = 0
+    for path in paths:
+        with open(path) as vectors:
+            for number, line in enumerate(vectors, 1):
+                payloads += 1
+                try:
+                    error = check_line(line)
+                except ValueError as e:
+                    error = str(e)
+                if error:
+                    failures += 1
+                    print("%s:%d: %s" % (path, number, error))
+    print("%d payloads, %d failed" % (payloads, failures))
+    return 1 if failures or not payloads else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,102 @@
+/* The publish path of the wake cycle makes no heap allocations once the
+ * connection is up: MQTT packets written byte by byte and in one piece,
+ * coalesced and flushed, and the answers read back, counted by host_heap.
+ * The client runs in a forked child so the server threads' allocations
+ * don't count.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "tls_test.h"
+#include "host_heap.h"
+#include "check.h"
+
+static const int warm_up_cycles = 3;
+static const int cycles = 200;
+
+// A PUBLISH of about the size send_sensor_data() makes
+static void publish_cycle(WiFiClientSecure &client, const uint8_t *packet, size_t len, bool bytewise)
+{
+    static uint8_t back[2048];
+    size_t received = 0;
+    unsigned long start = millis();
+
+    if (bytewise) {
+        for (size_t i = 0; i < len; i++) {
+            client.write(packet[i]);
+        }
+    } else {
+        client.write(packet, len);
+    }
+    while (received < len && millis() - start < 3000) {
+        int n = client.read(back + received, len - received);
+        if (n > 0) {
+            received += n;
+        } else if (!client.connected()) {
+            break;
+        } else {
+            delay(1);
+        }
+    }
+    CHECK(received == len && memcmp(back, packet, len) == 0);
+}
+
+static int run_client(TlsServer &server, bool bytewise)
+{
+    WiFiClientSecure client;
+    uint8_t packet[1200] = {0x30, 0xad, 0x09, 0x00, 21};
+
+    memcpy(packet + 5, "home/ESP32/out/sensor", 21);
+    for (size_t i = 26; i < sizeof(packet); i++) {
+        packet[i] = (uint8_t)i;
+    }
+    client.setCACert(server.caPem());
+    client.setWriteCoalescing(true);
+    CHECK(client.connect(localhost, server.port()));
+    for (int i = 0; i < warm_up_cycles; i++) {
+        publish_cycle(client, packet, sizeof(packet), bytewise);
+    }
+
+    uint64_t before = host_heap_get().allocations;
+    for (int i = 0; i < cycles; i++) {
+        publish_cycle(client, packet, sizeof(packet), bytewise);
+        CHECK(client.connected());
+        CHECK(client.available() == 0);
+    }
+    uint64_t allocations = host_heap_get().allocations - before;
+    printf("%s: %llu allocations in %d cycles\n", bytewise ? "bytewise" : "whole", (unsigned long long)allocations,
+           cycles);
+    CHECK(allocations == 0);
+    client.stop();
+    return check_result();
+}
+
+static void test_cycles(TlsServer &server, bool bytewise)
+{
+    int status = -1;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int failures = run_client(server, bytewise);
+        fflush(stdout);
+        _exit(failures);
+    }
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main()
+{
+    TlsServer server;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    test_cycles(server, true);
+    test_cycles(server, false);
+    server.stop();
+    return check_result();
+}
@@ -0,0 +1,122 @@
+/* Write coalescing: what reaches the server per MQTT publish when the
+ * packet is written a byte at a time, as write(uint8_t) callers do, with
+ * coalescing off, flushed on MQTT packet boundaries and flushed by hand.
+ */
+
+#include <vector>
+#include "tls_test.h"
+#include "check.h"
+
+static std::vector<uint8_t> mqtt_publish(const char *topic, size_t payload_len)
+{
+    std::vector<uint8_t> packet;
+    size_t topic_len = strlen(topic);
+    size_t remaining = 2 + topic_len + payload_len;
+
+    packet.push_back(0x30);
+    do {
+        uint8_t digit = remaining & 0x7F;
+        remaining >>= 7;
+        packet.push_back(remaining > 0 ? digit | 0x80 : digit);
+    } while (remaining > 0);
+    packet.push_back(topic_len >> 8);
+    packet.push_back(topic_len & 0xFF);
+    packet.insert(packet.end(), topic, topic + topic_len);
+    for (size_t i = 0; i < payload_len; i++) {
+        packet.push_back('0' + i % 10);
+    }
+    return packet;
+}
+
+// Reads back everything the server echoed, so it has counted it all
+static bool drain(WiFiClientSecure &client, size_t len)
+{
+    uint8_t buf[1024];
+    unsigned long start = millis();
+
+    while (len > 0 && millis() - start < 3000) {
+        int n = client.read(buf, len < sizeof(buf) ? len : sizeof(buf));
+        if (n > 0) {
+            len -= n;
+        } else if (!client.connected()) {
+            return false;
+        } else {
+            delay(1);
+        }
+    }
+    return len == 0;
+}
+
+static tls_server_stats publish(TlsServer &server, WiFiClientSecure &client, const std::vector<uint8_t> &packet,
+                                int count, bool flush)
+{
+    server.resetStats();
+    for (int i = 0; i < count; i++) {
+        for (uint8_t byte : packet) {
+            client.write(byte);
+        }
+        if (flush) {
+            client.flush();
+        }
+    }
+    CHECK(drain(client, packet.size() * count));
+    return server.stats();
+}
+
+static void report(const char *name, const tls_server_stats &stats, int count)
+{
+    printf("%-12s %8.1f records %8.1f bytes per publish\n", name, (double)stats.records / count,
+           (double)stats.record_bytes / count);
+}
+
+int main()
+{
+    const int count = 20;
+    std::vector<uint8_t> small = mqtt_publish("sensors/host/bme680", 120);
+    std::vector<uint8_t> large = mqtt_publish("sensors/host/batch", 3000);
+    TlsServer server;
+    WiFiClientSecure client;
+    tls_server_stats stats;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    client.setCACert(server.caPem());
+    CHECK(client.connect(localhost, server.port()));
+
+    client.setWriteCoalescing(false);
+    stats = publish(server, client, small, count, false);
+    report("off", stats, count);
+    CHECK(stats.records == small.size() * count);
+    size_t uncoalesced_bytes = stats.record_bytes;
+
+    client.setWriteCoalescing(true);
+    stats = publish(server, client, small, count, false);
+    report("mqtt", stats, count);
+    CHECK(stats.records == (uint32_t)count);
+    CHECK(stats.record_bytes * 10 < uncoalesced_bytes);
+
+    client.setWriteCoalescing(true, false);
+    stats = publish(server, client, small, count, true);
+    report("flush", stats, count);
+    CHECK(stats.records == (uint32_t)count);
+
+    // A packet larger than the buffer goes out in buffer sized records
+    client.setWriteCoalescing(true);
+    stats = publish(server, client, large, count, false);
+    report("mqtt large", stats, count);
+    CHECK(stats.records == count * ((large.size() + 1023) / 1024));
+
+    // Turning it off sends what is buffered
+    client.setWriteCoalescing(true, false);
+    server.resetStats();
+    client.write(small.data(), small.size());
+    client.setWriteCoalescing(false);
+    CHECK(drain(client, small.size()));
+    CHECK(server.stats().records == 1);
+
+    client.stop();
+    server.stop();
+    return check_result();
+}
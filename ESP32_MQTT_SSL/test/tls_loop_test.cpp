@@ -0,0 +1,106 @@
+/* What MQTTClient::loop() costs per call on an idle connection, the way
+ * the sketch calls it while it waits: with the client's readiness check as
+ * it was, an mbedtls_ssl_read() in every connected() and available(), and
+ * as it is, a select() on the socket that only enters mbedtls when bytes
+ * arrived. Both run over the loopback server answering as a broker.
+ */
+
+#include <MQTT.h>
+#include "tls_test.h"
+#include "check.h"
+
+static const int calls = 20000;  // well within the 10 s keep alive
+
+// connected(), available() and read() before the receive buffer
+class DataToReadClient : public WiFiClientSecure
+{
+public:
+    int available()
+    {
+        if (!_connected) {
+            return 0;
+        }
+        if (_tx_len > 0) {
+            flush();
+            if (!_connected) {
+                return 0;
+            }
+        }
+        int res = data_to_read(sslclient);
+        if (res < 0) {
+            stop();
+        }
+        return res;
+    }
+
+    int read(uint8_t *buf, size_t size)
+    {
+        if (!available()) {
+            return -1;
+        }
+        int res = get_ssl_receive(sslclient, buf, size);
+        if (res < 0) {
+            stop();
+        }
+        return res;
+    }
+
+    int read()
+    {
+        uint8_t c;
+        return read(&c, 1) > 0 ? c : -1;
+    }
+
+    uint8_t connected()
+    {
+        uint8_t dummy = 0;
+        read(&dummy, 0);
+        return _connected;
+    }
+};
+
+// Microseconds per loop() call
+static double loop_cost(TlsServer &server, WiFiClientSecure &net)
+{
+    MQTTClient mqtt(256);
+    bool looped = true;
+
+    net.setCACert(server.caPem());
+    CHECK(net.connect(localhost, server.port()));
+    mqtt.begin("localhost", server.port(), net);
+    CHECK(mqtt.connect("loop_test", "", "", true));
+    CHECK(mqtt.subscribe("loop_test/in"));
+
+    unsigned long start = micros();
+    for (int i = 0; i < calls; i++) {
+        looped &= mqtt.loop();
+    }
+    double per_call = (double)(micros() - start) / calls;
+
+    CHECK(looped);
+    CHECK(mqtt.connected());
+    CHECK(mqtt.publish("loop_test/out", "still there", 11, false, 1));
+    mqtt.disconnect();
+    net.stop();
+    return per_call;
+}
+
+int main()
+{
+    TlsServer server;
+    DataToReadClient before;
+    WiFiClientSecure after;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    server.setMqtt(true);
+    double before_us = loop_cost(server, before);
+    double after_us = loop_cost(server, after);
+    printf("idle MQTTClient::loop(): %.3f us per call with data_to_read(), %.3f us with select()\n", before_us,
+           after_us);
+    CHECK(server.stats().publishes == 2);
+    server.stop();
+    return check_result();
+}
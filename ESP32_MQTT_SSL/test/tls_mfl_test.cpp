@@ -0,0 +1,169 @@
+/* Heap per connection over maximum fragment lengths and buffer sizes.
+ * Each configuration connects from a forked child, so the peak counts the
+ * client alone and not the server threads sharing the heap. It is the
+ * table of tls_bench --matrix without a broker, with checks. Then the
+ * retry without the extension when a server refuses it, blocking and
+ * asynchronous.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include "tls_test.h"
+#include "host_heap.h"
+#include "check.h"
+
+typedef struct mfl_config {
+    uint16_t mfl;   // 0 leaves the extension out
+    size_t rx_size;
+    size_t tx_size;
+} mfl_config;
+
+typedef struct mfl_result {
+    bool connected;
+    bool echoed;
+    uint32_t client_peak;   // peakHeapUsed(), the handshake alone
+    size_t process_peak;    // everything the connection allocated
+} mfl_result;
+
+static mfl_result measure(TlsServer &server, const mfl_config &config)
+{
+    mfl_result result = {};
+    int fds[2];
+
+    if (pipe(fds) != 0) {
+        return result;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        static uint8_t payload[6000];
+        WiFiClientSecure client;
+
+        close(fds[0]);
+        for (size_t i = 0; i < sizeof(payload); i++) {
+            payload[i] = (uint8_t)(i * 7);
+        }
+        client.setCACert(server.caPem());
+        client.setMaxFragmentLength(config.mfl);
+        client.setBufferSizes(config.rx_size, config.tx_size);
+        size_t base = host_heap_get().current;
+        host_heap_reset_peak();
+        result.connected = client.connect(localhost, server.port());
+        result.echoed = result.connected && tls_echo(client, payload, sizeof(payload));
+        result.client_peak = client.peakHeapUsed();
+        result.process_peak = host_heap_get().peak - base;
+        client.stop();
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    if (pid < 0 || read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+        result = mfl_result();
+    }
+    close(fds[0]);
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+    return result;
+}
+
+// The buffers in use stay as they are
+static void test_resize_connected(TlsServer &server)
+{
+    WiFiClientSecure client;
+
+    client.setCACert(server.caPem());
+    CHECK(client.setBufferSizes(1024, 1024));
+    CHECK(client.connect(localhost, server.port()));
+    CHECK(!client.setBufferSizes(4096, 4096));
+    CHECK(tls_echo(client, "same buffers"));
+    client.stop();
+    CHECK(client.setBufferSizes(4096, 4096));
+}
+
+static int poll_until_done(WiFiClientSecure &client)
+{
+    unsigned long start = millis();
+    int state;
+
+    while ((state = client.poll()) == SSL_STATE_CONNECTING || state == SSL_STATE_HANDSHAKE) {
+        if (millis() - start > 5000) {
+            break;
+        }
+        delay(1);
+    }
+    return state;
+}
+
+static void test_fallback(TlsServer &server)
+{
+    WiFiClientSecure blocking, async;
+
+    server.setRefuseMaxFragment(true);
+    server.resetStats();
+    blocking.setCACert(server.caPem());
+    blocking.setMaxFragmentLength(512);
+    CHECK(blocking.connect(localhost, server.port()));
+    CHECK(tls_echo(blocking, "without mfl"));
+    blocking.stop();
+    CHECK(server.stats().connections == 2 && server.stats().handshakes == 1);
+    CHECK(server.stats().max_fragment == 0);
+
+    // poll() retries the same way, the caller only sees the connection
+    server.resetStats();
+    async.setCACert(server.caPem());
+    async.setMaxFragmentLength(512);
+    CHECK(async.connectAsync(localhost, server.port()));
+    CHECK(poll_until_done(async) == SSL_STATE_CONNECTED);
+    CHECK(async.connected());
+    CHECK(tls_echo(async, "without mfl"));
+    async.stop();
+    CHECK(server.stats().connections == 2 && server.stats().handshakes == 1);
+
+    // And the next attempts leave the extension out from the start
+    server.resetStats();
+    CHECK(async.connectAsync(localhost, server.port()));
+    CHECK(poll_until_done(async) == SSL_STATE_CONNECTED);
+    async.stop();
+    CHECK(server.stats().connections == 1 && server.stats().handshakes == 1);
+    server.setRefuseMaxFragment(false);
+}
+
+int main()
+{
+    static const uint16_t lengths[] = {0, 512, 1024, 2048, 4096};
+    static const size_t buffers[][2] = {{512, 1024}, {4096, 4096}, {16384, 16384}};
+    TlsServer server;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    printf("%6s %6s %6s %12s %12s\n", "mfl", "rx", "tx", "handshake", "connection");
+    for (uint16_t mfl : lengths) {
+        size_t smallest = 0;
+        size_t largest = 0;
+
+        for (const size_t *sizes : buffers) {
+            mfl_config config = {mfl, sizes[0], sizes[1]};
+            mfl_result result = measure(server, config);
+
+            CHECK(result.connected);
+            CHECK(result.echoed);
+            CHECK(server.stats().max_fragment == mfl);
+            printf("%6u %6zu %6zu %12u %12zu\n", mfl, sizes[0], sizes[1], result.client_peak,
+                   result.process_peak);
+            if (smallest == 0) {
+                smallest = result.process_peak;
+            }
+            largest = result.process_peak;
+        }
+        // The client buffers are allocated whole, whatever the server sends
+        CHECK(largest > smallest + 2 * (16384 - 4096));
+    }
+    test_resize_connected(server);
+    test_fallback(server);
+    server.stop();
+    return check_result();
+}
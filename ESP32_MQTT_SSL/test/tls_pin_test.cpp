@@ -0,0 +1,162 @@
+/* Public key and fingerprint pinning: the server's own key or certificate
+ * hash is enough to connect without a CA, anything else is refused, and a
+ * pin that doesn't parse blocks connecting until it is replaced or
+ * cleared. The pins are taken from the server's certificate with OpenSSL.
+ */
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <string>
+#include <vector>
+#include "tls_test.h"
+#include "check.h"
+
+struct server_pins {
+    std::string public_key_pem;
+    std::vector<uint8_t> public_key_der;
+    std::string sha256;  // "AA:BB:..."
+    std::string sha1;
+};
+
+static std::string hex(const uint8_t *bytes, size_t len)
+{
+    std::string text;
+    char byte[4];
+
+    for (size_t i = 0; i < len; i++) {
+        snprintf(byte, sizeof(byte), i == 0 ? "%02X" : ":%02X", bytes[i]);
+        text += byte;
+    }
+    return text;
+}
+
+static server_pins pins_of(TlsServer &server)
+{
+    server_pins pins;
+    BIO *in = BIO_new_mem_buf(server.caPem(), -1);
+    X509 *cert = PEM_read_bio_X509(in, NULL, NULL, NULL);
+    EVP_PKEY *key = X509_get_pubkey(cert);
+    uint8_t digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    BIO *out = BIO_new(BIO_s_mem());
+    PEM_write_bio_PUBKEY(out, key);
+    char *pem;
+    long pem_len = BIO_get_mem_data(out, &pem);
+    pins.public_key_pem.assign(pem, pem_len);
+    BIO_free(out);
+
+    uint8_t *der = NULL;
+    int der_len = i2d_PUBKEY(key, &der);
+    pins.public_key_der.assign(der, der + der_len);
+    OPENSSL_free(der);
+
+    X509_digest(cert, EVP_sha256(), digest, &len);
+    pins.sha256 = hex(digest, len);
+    X509_digest(cert, EVP_sha1(), digest, &len);
+    pins.sha1 = hex(digest, len);
+
+    EVP_PKEY_free(key);
+    X509_free(cert);
+    BIO_free(in);
+    return pins;
+}
+
+static bool connects(WiFiClientSecure &client, TlsServer &server)
+{
+    bool connected = client.connect(localhost, server.port()) && tls_echo(client, "pinned");
+    client.stop();
+    return connected;
+}
+
+static void test_matching_pins(TlsServer &server, const server_pins &pins, const char *other_ca)
+{
+    WiFiClientSecure by_pem, by_der, by_sha256, by_sha1;
+
+    CHECK(by_pem.setPinnedPublicKey(pins.public_key_pem.c_str()));
+    CHECK(connects(by_pem, server));
+    CHECK(by_der.setPinnedPublicKey(pins.public_key_der.data(), pins.public_key_der.size()));
+    CHECK(connects(by_der, server));
+    CHECK(by_sha256.setFingerprint(pins.sha256.c_str()));
+    CHECK(connects(by_sha256, server));
+    CHECK(by_sha1.setFingerprint(pins.sha1.c_str()));
+    CHECK(connects(by_sha1, server));
+
+    // A pin takes the place of the CA, a wrong CA doesn't matter then
+    WiFiClientSecure with_ca;
+    with_ca.setCACert(other_ca);
+    CHECK(with_ca.setFingerprint(pins.sha256.c_str()));
+    CHECK(connects(with_ca, server));
+}
+
+static void test_other_pins(TlsServer &server, const server_pins &pins, const server_pins &other)
+{
+    WiFiClientSecure other_key, other_sha256;
+
+    CHECK(other_key.setPinnedPublicKey(other.public_key_pem.c_str()));
+    CHECK(!connects(other_key, server));
+    CHECK(other_sha256.setFingerprint(other.sha256.c_str()));
+    CHECK(!connects(other_sha256, server));
+
+    // One digit off
+    std::string off = pins.sha256;
+    off[off.size() - 1] = off[off.size() - 1] == '0' ? '1' : '0';
+    WiFiClientSecure off_by_one;
+    CHECK(off_by_one.setFingerprint(off.c_str()));
+    CHECK(!connects(off_by_one, server));
+
+    // A session made under one pin isn't resumed under another
+    WiFiClientSecure repinned;
+    CHECK(repinned.setFingerprint(pins.sha256.c_str()));
+    CHECK(connects(repinned, server));
+    CHECK(repinned.setFingerprint(other.sha256.c_str()));
+    CHECK(!connects(repinned, server));
+}
+
+static void test_invalid_pins(TlsServer &server, const server_pins &pins)
+{
+    WiFiClientSecure client;
+    uint8_t garbage[32] = {0x30, 0x82};
+
+    client.setCACert(server.caPem());
+    CHECK(connects(client, server));
+
+    // Neither the CA nor no check at all takes over
+    CHECK(!client.setPinnedPublicKey("-----BEGIN PUBLIC KEY-----\nnot a key\n-----END PUBLIC KEY-----\n"));
+    CHECK(!connects(client, server));
+    CHECK(!client.setPinnedPublicKey(garbage, sizeof(garbage)));
+    CHECK(!connects(client, server));
+    CHECK(!client.setFingerprint("AA:BB:CC"));
+    CHECK(!connects(client, server));
+    CHECK(!client.setFingerprint(pins.sha256.substr(3).c_str()));
+    CHECK(!connects(client, server));
+
+    // Until a valid pin is set, or the pin is cleared on purpose
+    CHECK(client.setFingerprint(pins.sha1.c_str()));
+    CHECK(connects(client, server));
+    CHECK(!client.setFingerprint("zz"));
+    CHECK(!connects(client, server));
+    CHECK(client.setFingerprint(NULL));
+    CHECK(connects(client, server));
+}
+
+int main()
+{
+    TlsServer server, other;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA) || !other.start(TLS_SERVER_RSA)) {
+        return 1;
+    }
+    server_pins pins = pins_of(server);
+    server_pins other_pins = pins_of(other);
+
+    test_matching_pins(server, pins, other.caPem());
+    test_other_pins(server, pins, other_pins);
+    test_invalid_pins(server, pins);
+    other.stop();
+    server.stop();
+    return check_result();
+}
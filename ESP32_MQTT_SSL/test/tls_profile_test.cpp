@@ -0,0 +1,102 @@
+/* Cipher profiles: each one completes a handshake with a server it is
+ * meant for and refuses the others, a wrong pre-shared key fails, and
+ * setPreSharedKey() checks and copies what it is given. Prints the
+ * handshake time and bytes per profile.
+ */
+
+#include "tls_test.h"
+#include "check.h"
+
+static const char *psk_identity = "sensor1";
+static const char *psk_key = "1a2b3c4d5e6f708192a3b4c5d6e7f801";
+
+static bool handshake(const char *name, TlsServer &server, WiFiClientSecure &client)
+{
+    server.resetStats();
+    unsigned long start = micros();
+    bool connected = client.connect(localhost, server.port());
+    unsigned long handshake_us = micros() - start;
+
+    if (connected) {
+        connected = tls_echo(client, "profile");
+        client.stop();
+        printf("%-16s %8lu us %6llu bytes\n", name, handshake_us,
+               (unsigned long long)server.stats().handshake_bytes);
+    } else {
+        printf("%-16s refused after %lu us\n", name, handshake_us);
+    }
+    return connected;
+}
+
+static void test_certificates(TlsServer &ecdsa, TlsServer &rsa)
+{
+    WiFiClientSecure client;
+
+    client.setTimeouts(2000, 2000, 2000);
+    client.setCACert(ecdsa.caPem());
+    CHECK(handshake("default ecdsa", ecdsa, client));
+    client.setCipherProfile(SSL_PROFILE_ECDHE_ECDSA);
+    CHECK(handshake("ecdhe-ecdsa", ecdsa, client));
+
+    client.setCACert(rsa.caPem());
+    CHECK(!handshake("ecdhe-ecdsa rsa", rsa, client));
+    client.setCipherProfile(SSL_PROFILE_DEFAULT);
+    CHECK(handshake("default rsa", rsa, client));
+}
+
+static void test_psk(TlsServer &psk, TlsServer &ecdsa)
+{
+    WiFiClientSecure client;
+    char identity[16];
+
+    client.setTimeouts(2000, 2000, 2000);
+    // The identity is copied, the caller's buffer may go away
+    strcpy(identity, psk_identity);
+    CHECK(client.setPreSharedKey(identity, psk_key));
+    memset(identity, 'x', sizeof(identity) - 1);
+    CHECK(handshake("psk", psk, client));
+    CHECK(handshake("psk resumed", psk, client));
+    CHECK(client.resumedHandshakes() == 1);
+
+    CHECK(client.setPreSharedKey(psk_identity, "1a2b3c4d5e6f708192a3b4c5d6e7f800"));
+    CHECK(!handshake("psk wrong key", psk, client));
+    CHECK(client.setPreSharedKey("sensor2", psk_key));
+    CHECK(!handshake("psk wrong id", psk, client));
+    CHECK(client.setPreSharedKey(psk_identity, psk_key));
+    CHECK(!handshake("psk ecdsa", ecdsa, client));
+
+    // Separators are fine, anything else that isn't hex is not
+    CHECK(client.setPreSharedKey(psk_identity, "1a:2b:3c:4d:5e:6f:70:81:92:a3:b4:c5:d6:e7:f8:01"));
+    CHECK(handshake("psk separators", psk, client));
+    CHECK(!client.setPreSharedKey(psk_identity, "1a2b3g"));
+    CHECK(!client.setPreSharedKey(psk_identity, "1a2b3"));
+    CHECK(!client.setPreSharedKey(psk_identity, ""));
+    CHECK(!client.setPreSharedKey(psk_identity, NULL));
+    CHECK(!client.setPreSharedKey("", psk_key));
+    CHECK(!client.setPreSharedKey(NULL, psk_key));
+    std::string long_identity(SSL_PSK_IDENTITY_MAX + 1, 'i');
+    CHECK(!client.setPreSharedKey(long_identity.c_str(), psk_key));
+    std::string long_key(2 * 1024, 'a');
+    CHECK(!client.setPreSharedKey(psk_identity, long_key.c_str()));
+    // and leave the last good key in place
+    CHECK(handshake("psk kept", psk, client));
+}
+
+int main()
+{
+    TlsServer ecdsa;
+    TlsServer rsa;
+    TlsServer psk;
+
+    tls_test_init();
+    if (!ecdsa.start(TLS_SERVER_ECDSA) || !rsa.start(TLS_SERVER_RSA) ||
+        !psk.start(TLS_SERVER_PSK, psk_identity, psk_key)) {
+        return 1;
+    }
+    test_certificates(ecdsa, rsa);
+    test_psk(psk, ecdsa);
+    ecdsa.stop();
+    rsa.stop();
+    psk.stop();
+    return check_result();
+}
@@ -0,0 +1,115 @@
+/* Reads through the receive buffer: echoes of several records come back
+ * intact whether read a byte, a few bytes or a buffer at a time, peek()
+ * agrees with read(), and a server hanging up is noticed. Also prints
+ * what connected() and available() cost on an idle connection, the calls
+ * MQTTClient::loop() makes every time.
+ */
+
+#include <vector>
+#include "tls_test.h"
+#include "check.h"
+
+static const size_t echo_len = 12000;  // spans several records either way
+
+typedef enum { READ_BYTES, READ_SMALL, READ_BULK } read_pattern;
+
+static bool read_back(WiFiClientSecure &client, uint8_t *buf, size_t len, read_pattern pattern)
+{
+    size_t received = 0;
+    unsigned long start = millis();
+
+    while (received < len && millis() - start < 3000) {
+        int n;
+        if (pattern == READ_BYTES) {
+            int peeked = client.peek();
+            n = client.read();
+            if (n >= 0 && n != peeked) {
+                return false;
+            }
+            if (n >= 0) {
+                buf[received] = n;
+                n = 1;
+            }
+        } else {
+            size_t want = pattern == READ_SMALL ? 7 : 4096;
+            n = client.read(buf + received, want < len - received ? want : len - received);
+        }
+        if (n > 0) {
+            received += n;
+        } else if (!client.connected()) {
+            return false;
+        } else {
+            delay(1);
+        }
+    }
+    return received == len;
+}
+
+static void test_patterns(TlsServer &server, WiFiClientSecure &client)
+{
+    static const char *names[] = {"bytes", "small", "bulk"};
+    std::vector<uint8_t> sent(echo_len);
+    std::vector<uint8_t> back(echo_len);
+
+    for (size_t i = 0; i < sent.size(); i++) {
+        sent[i] = (uint8_t)(i * 31 + i / 256);
+    }
+    for (int pattern = READ_BYTES; pattern <= READ_BULK; pattern++) {
+        server.resetStats();
+        CHECK(client.write(sent.data(), sent.size()) == sent.size());
+        client.flush();
+        bool complete = read_back(client, back.data(), back.size(), (read_pattern)pattern);
+        CHECK(complete);
+        CHECK(back == sent);
+        CHECK(client.available() == 0);
+        printf("%s: %zu bytes in %u records\n", names[pattern], back.size(), server.stats().records);
+    }
+}
+
+static void test_idle_cost(WiFiClientSecure &client)
+{
+    const int calls = 100000;
+    unsigned long start = micros();
+
+    for (int i = 0; i < calls; i++) {
+        CHECK(client.connected());
+    }
+    unsigned long connected_us = micros() - start;
+    start = micros();
+    for (int i = 0; i < calls; i++) {
+        CHECK(client.available() == 0);
+    }
+    unsigned long available_us = micros() - start;
+    printf("idle connected(): %.3f us, available(): %.3f us per call\n", (double)connected_us / calls,
+           (double)available_us / calls);
+}
+
+static void test_hang_up(TlsServer &server, WiFiClientSecure &client)
+{
+    unsigned long start = millis();
+
+    server.stop();
+    while (client.connected() && millis() - start < 2000) {
+        delay(1);
+    }
+    CHECK(!client.connected());
+    CHECK(client.read() == -1);
+}
+
+int main()
+{
+    TlsServer server;
+    WiFiClientSecure client;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    client.setCACert(server.caPem());
+    client.setBufferSizes(1024, 1024);
+    CHECK(client.connect(localhost, server.port()));
+    test_patterns(server, client);
+    test_idle_cost(client);
+    test_hang_up(server, client);
+    return check_result();
+}
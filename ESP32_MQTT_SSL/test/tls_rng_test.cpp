@@ -0,0 +1,98 @@
+/* The shared random number generator: seeded once for any number of
+ * connections, reseeded after SSL_RNG_RESEED_BYTES or
+ * SSL_RNG_RESEED_INTERVAL_MS, and never handing out the same bytes twice.
+ */
+
+#include <set>
+#include <string>
+#include "ssl_client.h"
+#include "host.h"
+#include "tls_test.h"
+#include "check.h"
+
+static void test_connections(TlsServer &server)
+{
+    WiFiClientSecure client;
+    const int connections = 8;
+
+    client.setCACert(server.caPem());
+    for (int i = 0; i < connections; i++) {
+        // A new session each time, so every connect is a full handshake
+        client.clearSession();
+        CHECK(client.connect(localhost, server.port()));
+        CHECK(tls_echo(client, "random"));
+        client.stop();
+    }
+
+    CHECK(client.fullHandshakes() == connections);
+
+    const ssl_rng_stats *stats = ssl_rng_get_stats();
+    printf("%d connections: %u seeds, %u reseeds, %u us seeding, %u bytes drawn\n", connections, stats->seed_count,
+           stats->reseed_count, stats->seed_time_us, stats->bytes_since_seed);
+    CHECK(stats->seed_count == 1);
+    CHECK(stats->reseed_count == 0);
+    CHECK(stats->bytes_since_seed > 0);
+}
+
+static void test_reseed_by_bytes()
+{
+    const ssl_rng_stats *stats = ssl_rng_get_stats();
+    uint32_t reseeds = stats->reseed_count;
+    unsigned char block[1024];
+
+    while (stats->reseed_count == reseeds) {
+        uint32_t before = stats->bytes_since_seed;
+        CHECK(ssl_rng_random(NULL, block, sizeof(block)) == 0);
+        if (stats->reseed_count == reseeds) {
+            CHECK(stats->bytes_since_seed == before + sizeof(block));
+        }
+        if (before > SSL_RNG_RESEED_BYTES + sizeof(block)) {
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK(stats->reseed_count == reseeds + 1);
+    CHECK(stats->bytes_since_seed == sizeof(block));
+    CHECK(stats->seed_count == 1);
+}
+
+static void test_reseed_by_time()
+{
+    const ssl_rng_stats *stats = ssl_rng_get_stats();
+    uint32_t reseeds = stats->reseed_count;
+    unsigned char byte;
+
+    CHECK(ssl_rng_random(NULL, &byte, 1) == 0);
+    CHECK(stats->reseed_count == reseeds);
+    host_clock_advance(SSL_RNG_RESEED_INTERVAL_MS * 1000LL);
+    CHECK(ssl_rng_random(NULL, &byte, 1) == 0);
+    CHECK(stats->reseed_count == reseeds + 1);
+}
+
+static void test_distinct()
+{
+    std::set<std::string> seen;
+    unsigned char block[16];
+
+    for (int i = 0; i < 10000; i++) {
+        CHECK(ssl_rng_random(NULL, block, sizeof(block)) == 0);
+        seen.insert(std::string((const char *)block, sizeof(block)));
+    }
+    CHECK(seen.size() == 10000);
+}
+
+int main()
+{
+    TlsServer server;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    test_connections(server);
+    test_reseed_by_bytes();
+    test_reseed_by_time();
+    test_distinct();
+    server.stop();
+    return check_result();
+}
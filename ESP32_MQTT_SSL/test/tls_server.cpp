@@ -0,0 +1,340 @@
+#include "tls_server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+TlsServer::~TlsServer()
+{
+    stop();
+}
+
+static bool make_certificate(tls_server_mode mode, SSL_CTX *ctx, std::string *pem)
+{
+    EVP_PKEY *key = mode == TLS_SERVER_RSA ? EVP_RSA_gen(2048) : EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    bool ok = false;
+
+    if (key != NULL && cert != NULL) {
+        X509V3_CTX ext_ctx;
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        // An hour either way, the client checks against the virtual clock
+        X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME *name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509V3_set_ctx(&ext_ctx, cert, cert, NULL, NULL, 0);
+        X509_EXTENSION *san = X509V3_EXT_conf_nid(NULL, &ext_ctx, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+        if (san != NULL) {
+            X509_add_ext(cert, san, -1);
+            X509_EXTENSION_free(san);
+        }
+
+        BIO *bio = BIO_new(BIO_s_mem());
+        if (X509_sign(cert, key, EVP_sha256()) > 0 && SSL_CTX_use_certificate(ctx, cert) == 1 &&
+            SSL_CTX_use_PrivateKey(ctx, key) == 1 && PEM_write_bio_X509(bio, cert) == 1) {
+            char *data;
+            long length = BIO_get_mem_data(bio, &data);
+            pem->assign(data, length);
+            ok = true;
+        }
+        BIO_free(bio);
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+int TlsServer::clientHello(SSL *ssl, int *alert, void *arg)
+{
+    TlsServer *server = (TlsServer *)arg;
+    const unsigned char *ext;
+    size_t len;
+
+    if (server->_refuse_mfl && SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_max_fragment_length, &ext, &len) == 1) {
+        *alert = SSL_AD_HANDSHAKE_FAILURE;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
+    return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+unsigned int TlsServer::pskCallback(SSL *ssl, const char *identity, unsigned char *psk, unsigned int max_len)
+{
+    TlsServer *server = (TlsServer *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+    if (identity == NULL || server->_psk_identity != identity || server->_psk.size() > max_len) {
+        return 0;  // unknown identity, the handshake fails
+    }
+    memcpy(psk, server->_psk.data(), server->_psk.size());
+    return server->_psk.size();
+}
+
+bool TlsServer::start(tls_server_mode mode, const char *psk_identity, const char *psk)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+
+    _mode = mode;
+    _ctx = ctx;
+    _stats = {};
+    // A client that hangs up mid-echo must not end the test
+    signal(SIGPIPE, SIG_IGN);
+    // mbedtls 2 speaks TLS 1.2 at most, and the PSK suites are 1.2 ones
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"test", 4);
+    SSL_CTX_set_app_data(ctx, this);
+    SSL_CTX_set_msg_callback(ctx, countRecord);
+    SSL_CTX_set_msg_callback_arg(ctx, this);
+    SSL_CTX_set_client_hello_cb(ctx, clientHello, this);
+
+    if (mode == TLS_SERVER_PSK) {
+        if (psk_identity == NULL || psk == NULL || strlen(psk) % 2 != 0) {
+            return false;
+        }
+        _psk_identity = psk_identity;
+        _psk.clear();
+        for (size_t i = 0; psk[i] != '\0'; i += 2) {
+            char byte[3] = {psk[i], psk[i + 1], '\0'};
+            _psk.push_back((uint8_t)strtoul(byte, NULL, 16));
+        }
+        SSL_CTX_set_cipher_list(ctx, "PSK");
+        SSL_CTX_set_psk_server_callback(ctx, pskCallback);
+    } else if (!make_certificate(mode, ctx, &_ca_pem)) {
+        ERR_print_errors_fp(stderr);
+        return false;
+    }
+
+    struct sockaddr_in addr = {};
+    socklen_t addr_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listen_fd < 0 || bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(_listen_fd, 16) != 0 ||
+        getsockname(_listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        perror("tls_server");
+        return false;
+    }
+    _port = ntohs(addr.sin_port);
+    _stopping = false;
+    _acceptor = std::thread(&TlsServer::acceptLoop, this);
+    return true;
+}
+
+void TlsServer::stop()
+{
+    if (!_acceptor.joinable()) {
+        return;
+    }
+    _stopping = true;
+    _acceptor.join();
+    {
+        // Wakes connections blocked in a read
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (int fd : _open_fds) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    for (std::thread &connection : _connections) {
+        connection.join();
+    }
+    _connections.clear();
+    close(_listen_fd);
+    _listen_fd = -1;
+    SSL_CTX_free(_ctx);
+    _ctx = NULL;
+}
+
+void TlsServer::setTickets(bool enable)
+{
+    if (enable) {
+        SSL_CTX_clear_options(_ctx, SSL_OP_NO_TICKET);
+    } else {
+        SSL_CTX_set_options(_ctx, SSL_OP_NO_TICKET);
+    }
+}
+
+tls_server_stats TlsServer::stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void TlsServer::resetStats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats = {};
+}
+
+void TlsServer::countRecord(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl,
+                            void *arg)
+{
+    TlsServer *server = (TlsServer *)arg;
+    const uint8_t *header = (const uint8_t *)buf;
+
+    if (content_type != SSL3_RT_HEADER || len != SSL3_RT_HEADER_LENGTH) {
+        return;
+    }
+    size_t size = SSL3_RT_HEADER_LENGTH + (header[3] << 8 | header[4]);
+    std::lock_guard<std::mutex> lock(server->_mutex);
+    if (header[0] != SSL3_RT_APPLICATION_DATA) {
+        server->_stats.handshake_bytes += size;
+    } else if (!write_p) {
+        server->_stats.records++;
+        server->_stats.record_bytes += size;
+    }
+}
+
+// Length of the first MQTT packet in buf, 0 while it is incomplete
+static size_t mqtt_packet_length(const std::vector<uint8_t> &buf, size_t *header_len)
+{
+    size_t remaining = 0;
+
+    for (size_t i = 1; i < buf.size() && i <= 4; i++) {
+        remaining |= (size_t)(buf[i] & 0x7f) << (7 * (i - 1));
+        if ((buf[i] & 0x80) == 0) {
+            *header_len = i + 1;
+            return buf.size() >= i + 1 + remaining ? i + 1 + remaining : 0;
+        }
+    }
+    return 0;
+}
+
+void TlsServer::answerMqtt(SSL *ssl)
+{
+    std::vector<uint8_t> in;
+    unsigned char buf[4096];
+    int n;
+
+    while ((n = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+        in.insert(in.end(), buf, buf + n);
+        size_t header_len;
+        size_t len;
+        while ((len = mqtt_packet_length(in, &header_len)) > 0) {
+            const uint8_t *body = in.data() + header_len;
+            size_t body_len = len - header_len;
+            std::vector<uint8_t> reply;
+
+            switch (in[0] >> 4) {
+            case 1:  // CONNECT: accepted, no session present
+                reply = {0x20, 2, 0, 0};
+                break;
+            case 3: {  // PUBLISH
+                int qos = (in[0] >> 1) & 3;
+                size_t id_at = body_len >= 2 ? 2 + (body[0] << 8 | body[1]) : body_len;
+                if (qos > 0 && id_at + 2 <= body_len) {
+                    reply = {(uint8_t)(qos == 1 ? 0x40 : 0x50), 2, body[id_at], body[id_at + 1]};
+                }
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stats.publishes++;
+                break;
+            }
+            case 6:  // PUBREL
+                reply = {0x70, 2, body[0], body[1]};
+                break;
+            case 8: {  // SUBSCRIBE: every filter granted at the QoS asked for
+                reply = {0x90, 2, body[0], body[1]};
+                size_t i = 2;
+                while (i + 2 < body_len) {
+                    size_t filter_len = body[i] << 8 | body[i + 1];
+                    if (i + 2 + filter_len >= body_len) {
+                        break;
+                    }
+                    reply.push_back(body[i + 2 + filter_len] & 3);
+                    reply[1]++;
+                    i += 3 + filter_len;
+                }
+                break;
+            }
+            case 10:  // UNSUBSCRIBE
+                reply = {0xb0, 2, body[0], body[1]};
+                break;
+            case 12:  // PINGREQ
+                reply = {0xd0, 0};
+                break;
+            case 14:  // DISCONNECT
+                return;
+            }
+            in.erase(in.begin(), in.begin() + len);
+            if (!reply.empty() && SSL_write(ssl, reply.data(), reply.size()) != (int)reply.size()) {
+                return;
+            }
+        }
+    }
+}
+
+void TlsServer::acceptLoop()
+{
+    while (!_stopping) {
+        struct pollfd pfd = {_listen_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        int fd = accept(_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.connections++;
+        _open_fds.push_back(fd);
+        _connections.emplace_back(&TlsServer::serve, this, fd);
+    }
+}
+
+void TlsServer::serve(int fd)
+{
+    SSL *ssl = NULL;
+
+    if (_mode != TLS_SERVER_SILENT) {
+        ssl = SSL_new(_ctx);
+        SSL_set_fd(ssl, fd);
+    }
+    if (ssl != NULL && SSL_accept(ssl) == 1) {
+        int code = SSL_SESSION_get_max_fragment_length(SSL_get_session(ssl));
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stats.handshakes++;
+            _stats.resumed += SSL_session_reused(ssl) ? 1 : 0;
+            _stats.max_fragment = code >= TLSEXT_max_fragment_length_512 ? 256 << code : 0;
+        }
+
+        if (_mqtt) {
+            answerMqtt(ssl);
+        } else {
+            // Echo, record by record
+            unsigned char buf[16384];
+            int n;
+            while ((n = SSL_read(ssl, buf, sizeof(buf))) > 0) {
+                if (SSL_write(ssl, buf, n) != n) {
+                    break;
+                }
+            }
+        }
+        SSL_shutdown(ssl);
+    } else if (ssl == NULL) {
+        // Silent: hold the connection until the client or stop() ends it
+        char byte;
+        while (recv(fd, &byte, 1, 0) > 0) {
+        }
+    }
+    SSL_free(ssl);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (size_t i = 0; i < _open_fds.size(); i++) {
+        if (_open_fds[i] == fd) {
+            _open_fds.erase(_open_fds.begin() + i);
+            break;
+        }
+    }
+    close(fd);
+}
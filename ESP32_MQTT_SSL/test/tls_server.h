@@ -0,0 +1,97 @@
+/* Loopback TLS 1.2 server for the client tests, on OpenSSL so it is
+ * independent of the mbedtls under test. It echoes every record it
+ * receives, or with setMqtt() answers like an MQTT broker, and counts
+ * handshakes, resumptions and application records.
+ * The certificate is made at start, self-signed for localhost and
+ * 127.0.0.1; caPem() is what the client should trust.
+ */
+
+#ifndef TEST_TLS_SERVER_H
+#define TEST_TLS_SERVER_H
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ssl_st;
+struct ssl_ctx_st;
+
+typedef enum {
+    TLS_SERVER_ECDSA,   // P-256 certificate
+    TLS_SERVER_RSA,     // RSA 2048 certificate
+    TLS_SERVER_PSK,     // pre-shared key, no certificate
+    TLS_SERVER_SILENT   // accepts TCP connections and never answers, has a caPem() all the same
+} tls_server_mode;
+
+typedef struct tls_server_stats {
+    uint32_t connections;   // TCP connections accepted
+    uint32_t handshakes;    // completed ones, full or resumed
+    uint32_t resumed;
+    uint32_t records;       // application data records received
+    uint64_t record_bytes;  // their size on the wire, headers included
+    uint64_t handshake_bytes;  // all other records, sent and received
+    size_t max_fragment;    // negotiated by the last handshake, 0 if none
+    uint32_t publishes;     // MQTT PUBLISH packets received, with setMqtt()
+} tls_server_stats;
+
+class TlsServer
+{
+public:
+    ~TlsServer();
+
+    // psk is hex, like WiFiClientSecure::setPreSharedKey() takes it
+    bool start(tls_server_mode mode, const char *psk_identity = NULL, const char *psk = NULL);
+    void stop();
+    void setTickets(bool enable);  // off: resumption by session ID only
+    // Fails handshakes that ask for a max fragment length, as some brokers do
+    void setRefuseMaxFragment(bool refuse)
+    {
+        _refuse_mfl = refuse;
+    }
+    // Acknowledges MQTT packets instead of echoing: CONNECT, SUBSCRIBE,
+    // UNSUBSCRIBE, PINGREQ and QoS 1 and 2 publishes. Publishes go nowhere.
+    void setMqtt(bool enable)
+    {
+        _mqtt = enable;
+    }
+
+    uint16_t port()
+    {
+        return _port;
+    }
+    const char *caPem()
+    {
+        return _ca_pem.c_str();
+    }
+    tls_server_stats stats();
+    void resetStats();
+
+private:
+    void acceptLoop();
+    void serve(int fd);
+    void answerMqtt(struct ssl_st *ssl);
+    static int clientHello(struct ssl_st *ssl, int *alert, void *arg);
+    static unsigned int pskCallback(struct ssl_st *ssl, const char *identity, unsigned char *psk, unsigned int max_len);
+    static void countRecord(int write_p, int version, int content_type, const void *buf, size_t len,
+                            struct ssl_st *ssl, void *arg);
+
+    tls_server_mode _mode = TLS_SERVER_ECDSA;
+    struct ssl_ctx_st *_ctx = NULL;
+    int _listen_fd = -1;
+    uint16_t _port = 0;
+    std::string _ca_pem;
+    std::string _psk_identity;
+    std::vector<uint8_t> _psk;
+    std::atomic<bool> _refuse_mfl{false};
+    std::atomic<bool> _mqtt{false};
+    std::atomic<bool> _stopping{false};
+    std::thread _acceptor;
+    std::mutex _mutex;
+    std::vector<std::thread> _connections;
+    std::vector<int> _open_fds;
+    tls_server_stats _stats = {};
+};
+#endif
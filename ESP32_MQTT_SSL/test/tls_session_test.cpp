@@ -0,0 +1,94 @@
+/* Session resumption: reconnects of one client resume its session, by
+ * ticket or by session ID, a saved session resumes in a new client, and
+ * new credentials start over with a full handshake.
+ */
+
+#include "tls_test.h"
+#include "check.h"
+
+static void test_reconnects(TlsServer &server, bool tickets)
+{
+    WiFiClientSecure client;
+
+    server.setTickets(tickets);
+    server.resetStats();
+    client.setCACert(server.caPem());
+    for (int i = 0; i < 4; i++) {
+        unsigned long start = micros();
+        CHECK(client.connect(localhost, server.port()));
+        unsigned long handshake_us = micros() - start;
+        CHECK(tls_echo(client, "ping"));
+        client.stop();
+        printf("%s connect %d: %lu us\n", tickets ? "ticket" : "session ID", i, handshake_us);
+    }
+    CHECK(client.fullHandshakes() == 1);
+    CHECK(client.resumedHandshakes() == 3);
+
+    tls_server_stats stats = server.stats();
+    CHECK(stats.handshakes == 4);
+    CHECK(stats.resumed == 3);
+}
+
+static void test_saved_session(TlsServer &server)
+{
+    WiFiClientSecure first;
+    uint8_t saved[1024];
+    size_t saved_len;
+
+    server.setTickets(true);
+    server.resetStats();
+    first.setCACert(server.caPem());
+    CHECK(first.connect(localhost, server.port()));
+    first.stop();
+    saved_len = first.saveSession(saved, sizeof(saved));
+    CHECK(saved_len > 0);
+    CHECK(first.saveSession(saved, 8) == 0);
+
+    // What RTC memory keeps through a reset: the session in a new client,
+    // loaded after the credentials as the sketch does
+    WiFiClientSecure second;
+    second.setCACert(server.caPem());
+    CHECK(second.loadSession(saved, saved_len));
+    CHECK(second.connect(localhost, server.port()));
+    CHECK(tls_echo(second, "resumed"));
+    second.stop();
+    CHECK(second.fullHandshakes() == 0);
+    CHECK(second.resumedHandshakes() == 1);
+
+    // Garbage is refused, by the client before the server sees it
+    WiFiClientSecure third;
+    saved[saved_len / 2] ^= 0xff;
+    third.setCACert(server.caPem());
+    CHECK(!third.loadSession(saved, saved_len / 2));
+    CHECK(third.connect(localhost, server.port()));
+    third.stop();
+    CHECK(third.fullHandshakes() == 1);
+
+    // Setting credentials forgets the session
+    WiFiClientSecure fourth;
+    CHECK(fourth.loadSession(saved, 0) == false);
+    saved[saved_len / 2] ^= 0xff;
+    CHECK(fourth.loadSession(saved, saved_len));
+    fourth.setCACert(server.caPem());
+    CHECK(fourth.connect(localhost, server.port()));
+    fourth.stop();
+    CHECK(fourth.fullHandshakes() == 1);
+    CHECK(fourth.resumedHandshakes() == 0);
+
+    CHECK(server.stats().resumed == 1);
+}
+
+int main()
+{
+    TlsServer server;
+
+    tls_test_init();
+    if (!server.start(TLS_SERVER_ECDSA)) {
+        return 1;
+    }
+    test_reconnects(server, true);
+    test_reconnects(server, false);
+    test_saved_session(server);
+    server.stop();
+    return check_result();
+}
@@ -0,0 +1,47 @@
+/* Client side helpers for the tests against TlsServer.
+ */
+
+#ifndef TEST_TLS_TEST_H
+#define TEST_TLS_TEST_H
+#include "Arduino.h"
+#include "WiFiClientSecure.h"
+#include "tls_server.h"
+
+static const IPAddress localhost(127, 0, 0, 1);
+
+// Sends data and waits until the server has echoed all of it back
+static inline bool tls_echo(WiFiClientSecure &client, const uint8_t *data, size_t len, uint32_t timeout_ms = 3000)
+{
+    static uint8_t back[16384];
+    size_t received = 0;
+    unsigned long start = millis();
+
+    if (len > sizeof(back) || client.write(data, len) != len) {
+        return false;
+    }
+    client.flush();
+    while (received < len && millis() - start < timeout_ms) {
+        int n = client.read(back + received, len - received);
+        if (n > 0) {
+            received += n;
+        } else if (!client.connected()) {
+            return false;
+        } else {
+            delay(1);
+        }
+    }
+    return received == len && memcmp(back, data, len) == 0;
+}
+
+static inline bool tls_echo(WiFiClientSecure &client, const char *text)
+{
+    return tls_echo(client, (const uint8_t *)text, strlen(text));
+}
+
+// Certificates are checked against time(), which counts from boot until
+// the clock is set
+static inline void tls_test_init()
+{
+    configTime(0, 0, "pool.ntp.org");
+}
+#endif
@@ -0,0 +1,150 @@
+/* Connect and handshake timeouts: a server that never answers the
+ * handshake, a port nobody listens on and a listener whose backlog is
+ * full, each given up on after its own timeout and no later. Times are
+ * real, the client measures them with its own clock.
+ */
+
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
+#include "tls_test.h"
+#include "check.h"
+
+static const uint32_t connect_ms = 600;
+static const uint32_t handshake_ms = 400;
+static const uint32_t slack_ms = 300;
+
+static uint32_t elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+static uint32_t timed_connect(WiFiClientSecure &client, uint16_t port, bool *connected)
+{
+    auto start = std::chrono::steady_clock::now();
+    *connected = client.connect(localhost, port);
+    return elapsed_ms(start);
+}
+
+static void test_silent(TlsServer &silent)
+{
+    WiFiClientSecure client;
+    bool connected;
+
+    client.setTimeouts(connect_ms, handshake_ms, 1000);
+    client.setCACert(silent.caPem());
+    uint32_t ms = timed_connect(client, silent.port(), &connected);
+    printf("silent server: refused after %u ms\n", ms);
+    CHECK(!connected);
+    CHECK(ms >= handshake_ms && ms < handshake_ms + slack_ms);
+
+    // Asynchronously every poll() returns at once
+    CHECK(client.connectAsync(localhost, silent.port()));
+    auto start = std::chrono::steady_clock::now();
+    uint32_t longest_poll_ms = 0;
+    int state;
+    do {
+        auto poll_start = std::chrono::steady_clock::now();
+        state = client.poll();
+        uint32_t poll_ms = elapsed_ms(poll_start);
+        longest_poll_ms = poll_ms > longest_poll_ms ? poll_ms : longest_poll_ms;
+        delay(1);
+    } while (state != SSL_STATE_FAILED && state != SSL_STATE_CONNECTED && elapsed_ms(start) < 5000);
+    CHECK(state == SSL_STATE_FAILED);
+    CHECK(elapsed_ms(start) < handshake_ms + slack_ms);
+    CHECK(longest_poll_ms < 50);
+}
+
+static void test_closed_port()
+{
+    WiFiClientSecure client;
+    struct sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+    bool connected;
+
+    // A port that was just free and is closed again
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    close(fd);
+
+    client.setTimeouts(connect_ms, handshake_ms, 1000);
+    uint32_t ms = timed_connect(client, ntohs(addr.sin_port), &connected);
+    printf("closed port: refused after %u ms\n", ms);
+    CHECK(!connected);
+    CHECK(ms < 100);
+}
+
+// Fills the accept queue of a listener that never accepts, so further
+// SYNs are dropped as if the host had gone away. Returns the port, or 0
+// if the kernel kept taking connections.
+static uint16_t full_listener(int *listen_fd, std::vector<int> &queued)
+{
+    struct sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+
+    *listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(*listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(*listen_fd, 0) != 0) {
+        return 0;
+    }
+    getsockname(*listen_fd, (struct sockaddr *)&addr, &len);
+    for (int i = 0; i < 8; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+        queued.push_back(fd);
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (::poll(&pfd, 1, 200) == 0) {
+            return ntohs(addr.sin_port);
+        }
+    }
+    return 0;
+}
+
+static void test_full_backlog()
+{
+    WiFiClientSecure client;
+    std::vector<int> queued;
+    int listen_fd;
+    bool connected;
+
+    uint16_t port = full_listener(&listen_fd, queued);
+    if (port == 0) {
+        printf("full backlog: not reproducible here, skipped\n");
+    } else {
+        client.setTimeouts(connect_ms, handshake_ms, 1000);
+        uint32_t ms = timed_connect(client, port, &connected);
+        printf("full backlog: refused after %u ms\n", ms);
+        CHECK(!connected);
+        CHECK(ms >= connect_ms && ms < connect_ms + slack_ms);
+    }
+    for (int fd : queued) {
+        close(fd);
+    }
+    close(listen_fd);
+}
+
+int main()
+{
+    TlsServer silent;
+
+    tls_test_init();
+    if (!silent.start(TLS_SERVER_SILENT)) {
+        return 1;
+    }
+    test_silent(silent);
+    test_closed_port();
+    test_full_backlog();
+    silent.stop();
+    return check_result();
+}
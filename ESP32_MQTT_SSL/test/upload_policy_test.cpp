@@ -0,0 +1,162 @@
+/* The upload policy: which limit makes an upload due, and a day of 20 s
+ * wakes under several policies, with how long the radio is on per hour and
+ * how long readings wait for their upload. The temperature drifts over the
+ * day and jumps twice, as when a window is opened.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include "upload_policy.h"
+#include "check.h"
+
+static const uint32_t wake_s = 20;
+static const uint32_t day_s = 24 * 3600;
+// Radio on per upload: fast join on the cached lease, resumed handshake,
+// MQTT connect; and per batch message of up to 50 readings
+static const uint32_t link_ms = 150 + 350 + 100;
+static const uint32_t message_ms = 25;
+static const size_t records_per_message = 50;
+
+static upload_state buffer_state(size_t buffered, uint32_t oldest_age, float temperature, float uploaded)
+{
+    upload_state state = {buffered, oldest_age, (int16_t)lroundf(temperature * 100), (int16_t)lroundf(uploaded * 100),
+                          false};
+    return state;
+}
+
+static void test_limits()
+{
+    const upload_policy policy = {60, 900, 100};
+
+    // Nothing buffered, nothing to do, however long ago
+    CHECK(!upload_is_due(policy, buffer_state(0, 5000, 20.0f, 10.0f)));
+    // Unless a failed upload left blocks behind
+    upload_state backlog = buffer_state(0, 0, 20.0f, 20.0f);
+    backlog.backlog = true;
+    CHECK(upload_is_due(policy, backlog));
+
+    CHECK(!upload_is_due(policy, buffer_state(59, 899, 20.99f, 20.0f)));
+    CHECK(upload_is_due(policy, buffer_state(60, 0, 20.0f, 20.0f)));
+    CHECK(upload_is_due(policy, buffer_state(1, 900, 20.0f, 20.0f)));
+    CHECK(upload_is_due(policy, buffer_state(1, 0, 21.0f, 20.0f)));
+    CHECK(upload_is_due(policy, buffer_state(1, 0, 19.0f, 20.0f)));
+
+    // The first reading goes out at once, to show the device is up
+    upload_state first = buffer_state(1, 0, 20.0f, 0.0f);
+    first.uploaded_temperature = SAMPLE_NONE_SIGNED;
+    CHECK(upload_is_due(policy, first));
+    // A reading without temperature is no change
+    upload_state none = buffer_state(1, 0, 0.0f, 20.0f);
+    none.temperature = SAMPLE_NONE_SIGNED;
+    CHECK(!upload_is_due(policy, none));
+    none.uploaded_temperature = SAMPLE_NONE_SIGNED;
+    CHECK(!upload_is_due(policy, none));
+
+    // 0 turns a limit off
+    const upload_policy fill_only = {60, 0, 0};
+    CHECK(!upload_is_due(fill_only, buffer_state(59, 100000, 40.0f, 20.0f)));
+    const upload_policy every_wake = {1, 0, 0};
+    CHECK(upload_is_due(every_wake, buffer_state(1, 0, 20.0f, 20.0f)));
+}
+
+static float temperature_at(uint32_t t)
+{
+    float temperature = 21.0f + 2.5f * sinf(2 * (float)M_PI * t / day_s);
+    // A window open for ten minutes, twice a day
+    if ((t >= 8 * 3600 && t < 8 * 3600 + 600) || (t >= 19 * 3600 && t < 19 * 3600 + 600)) {
+        temperature -= 4.0f;
+    }
+    return roundf(temperature * 100) / 100;
+}
+
+struct simulation {
+    uint32_t uploads;
+    double radio_s_per_hour;
+    double mean_latency_s;
+    uint32_t max_latency_s;
+    uint32_t window_latency_s;  // from opening the window to the reading that shows it being sent
+};
+
+static simulation simulate(const upload_policy &policy)
+{
+    simulation result = {};
+    std::vector<uint32_t> buffered;  // sample times
+    int16_t uploaded = SAMPLE_NONE_SIGNED;
+    uint64_t latency_sum = 0;
+    uint32_t samples = 0;
+    uint64_t radio_ms = 0;
+    bool window_seen = false;
+
+    for (uint32_t t = 0; t < day_s; t += wake_s) {
+        int16_t temperature = (int16_t)lroundf(temperature_at(t) * 100);
+        buffered.push_back(t);
+        samples++;
+
+        upload_state state = {buffered.size(), t - buffered.front(), temperature, uploaded, false};
+        if (!upload_is_due(policy, state)) {
+            continue;
+        }
+        result.uploads++;
+        radio_ms += link_ms + message_ms * ((buffered.size() + records_per_message - 1) / records_per_message);
+        for (uint32_t sampled : buffered) {
+            latency_sum += t - sampled;
+            result.max_latency_s = t - sampled > result.max_latency_s ? t - sampled : result.max_latency_s;
+        }
+        if (!window_seen && t >= 8 * 3600) {
+            window_seen = true;
+            result.window_latency_s = t - 8 * 3600;
+        }
+        buffered.clear();
+        uploaded = temperature;
+    }
+    result.radio_s_per_hour = radio_ms / 1000.0 / 24;
+    result.mean_latency_s = (double)latency_sum / samples;
+    return result;
+}
+
+static void test_day()
+{
+    struct {
+        const char *name;
+        upload_policy policy;
+    } policies[] = {
+        {"every wake", {1, 0, 0}},
+        {"fill 60", {60, 0, 0}},
+        {"age 900 s", {0, 900, 0}},
+        {"delta 1 C", {0, 0, 100}},
+        {"default", {60, 900, 100}},
+    };
+    simulation results[5];
+
+    printf("%-12s %12s %14s %12s %12s %12s\n", "policy", "uploads/h", "radio s/h", "mean wait s", "max wait s",
+           "window s");
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        results[i] = simulate(policies[i].policy);
+        printf("%-12s %12.1f %14.2f %12.1f %12u %12u\n", policies[i].name, results[i].uploads / 24.0,
+               results[i].radio_s_per_hour, results[i].mean_latency_s, results[i].max_latency_s,
+               results[i].window_latency_s);
+    }
+
+    const simulation &every = results[0], &fill = results[1], &age = results[2], &delta = results[3],
+                     &defaults = results[4];
+    CHECK(every.uploads == day_s / wake_s);
+    CHECK(every.max_latency_s == 0);
+    // Readings wait at most as long as the limits allow
+    CHECK(fill.max_latency_s == (60 - 1) * wake_s);
+    CHECK(age.max_latency_s == 900);
+    CHECK(defaults.max_latency_s <= 900);
+    // The window is reported on the wake it opened, unless a delta isn't watched
+    CHECK(delta.window_latency_s == 0 && defaults.window_latency_s == 0);
+    CHECK(fill.window_latency_s > 0 && age.window_latency_s > 0);
+    // The default keeps the radio off for at least 40 of every 45 wakes
+    CHECK(defaults.uploads * 40 <= every.uploads);
+    CHECK(defaults.radio_s_per_hour * 10 < every.radio_s_per_hour);
+}
+
+int main()
+{
+    test_limits();
+    test_day();
+    return check_result();
+}
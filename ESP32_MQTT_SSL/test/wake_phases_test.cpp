@@ -0,0 +1,123 @@
+/* The wake cycle's sensor and network tasks on the mock BME680 and the
+ * emulated WiFi: joining while the sensor converts against joining after
+ * the reading, with and without the gas heater. Prints when each phase
+ * ended and checks that overlapping saves the conversion time.
+ */
+
+#include "Arduino.h"
+#include <atomic>
+#include "WiFi.h"
+#include "Adafruit_BME680.h"
+#include "host.h"
+#include "check.h"
+
+// Shorter than a real join, to keep the test quick
+static const uint32_t join_ms = 250;
+static const uint32_t dhcp_ms = 100;
+static const uint32_t slack_ms = 40;
+
+struct phases {
+    unsigned long conversion_ms;  // since the wake: beginReading() returned
+    unsigned long wifi_ms;        // connected with an address
+    unsigned long reading_ms;     // endReading() returned
+    unsigned long wake_ms;        // both tasks done
+};
+
+static Adafruit_BME680 bme;
+static TaskHandle_t main_task, sensor_task, network_task;
+static std::atomic<bool> overlap{false};
+static unsigned long wake_start;
+static phases trace;
+
+static void sensor_task_main(void *)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bme.beginReading();
+        trace.conversion_ms = millis() - wake_start;
+        if (overlap) {
+            xTaskNotifyGive(network_task);
+        }
+        int remaining = bme.remainingReadingMillis();
+        if (remaining > 0) {
+            delay(remaining);
+        }
+        CHECK(bme.endReading());
+        trace.reading_ms = millis() - wake_start;
+        if (!overlap) {
+            xTaskNotifyGive(network_task);
+        }
+        xTaskNotifyGive(main_task);
+    }
+}
+
+static void network_task_main(void *)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        WiFi.mode(WIFI_STA);
+        WiFi.begin("host", "pass");
+        while (WiFi.status() != WL_CONNECTED) {
+            delay(2);
+        }
+        trace.wifi_ms = millis() - wake_start;
+        xTaskNotifyGive(main_task);
+    }
+}
+
+static phases wake(bool overlapped, bool gas)
+{
+    overlap = overlapped;
+    WiFi.disconnect(true);
+
+    trace = phases();
+    wake_start = millis();
+    xTaskNotifyGive(sensor_task);
+    for (uint32_t done = 0, n = 1; done < 2 && n > 0; done += n) {
+        n = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5000));
+        CHECK(n > 0);
+    }
+    trace.wake_ms = millis() - wake_start;
+    printf("%-10s %-6s conversion %4lu ms, wifi %4lu ms, reading %4lu ms, awake %4lu ms\n",
+           overlapped ? "overlapped" : "one by one", gas ? "gas" : "no gas", trace.conversion_ms, trace.wifi_ms,
+           trace.reading_ms, trace.wake_ms);
+    return trace;
+}
+
+static void test_phases(bool gas)
+{
+    // The mock's duration for the sketch's oversampling and heater
+    bme.setGasHeater(gas ? 320 : 0, gas ? 150 : 0);
+    unsigned long end = bme.beginReading();
+    unsigned long conversion_ms = end - millis();
+    CHECK(bme.endReading());
+    unsigned long link_ms = join_ms + dhcp_ms;
+
+    phases serial = wake(false, gas);
+    phases overlapped = wake(true, gas);
+
+    CHECK(serial.reading_ms >= conversion_ms && serial.wifi_ms >= conversion_ms + link_ms);
+    CHECK(serial.wake_ms < conversion_ms + link_ms + slack_ms);
+    // The reading is ready long before the link, which sets the wake
+    CHECK(overlapped.reading_ms < overlapped.wifi_ms);
+    CHECK(overlapped.wake_ms >= link_ms && overlapped.wake_ms < link_ms + slack_ms);
+    CHECK(serial.wake_ms - overlapped.wake_ms + slack_ms > conversion_ms);
+}
+
+int main()
+{
+    host_wifi_set_timing(join_ms, dhcp_ms, 20);
+    CHECK(bme.begin());
+    bme.setTemperatureOversampling(BME680_OS_8X);
+    bme.setHumidityOversampling(BME680_OS_2X);
+    bme.setPressureOversampling(BME680_OS_4X);
+    host_bme680_set(21.5, 40, 100000, 50000);
+
+    main_task = xTaskGetCurrentTaskHandle();
+    CHECK(xTaskCreatePinnedToCore(sensor_task_main, "sensor", 4096, NULL, 1, &sensor_task, 1) == pdPASS);
+    CHECK(xTaskCreatePinnedToCore(network_task_main, "network", 8192, NULL, 1, &network_task, 0) == pdPASS);
+
+    test_phases(true);
+    test_phases(false);
+    return check_result();
+}
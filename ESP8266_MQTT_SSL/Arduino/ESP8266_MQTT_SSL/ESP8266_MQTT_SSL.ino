@@ -10,6 +10,9 @@
 ////--------------------------////
 
 #include "secrets.h"
+#if __has_include("certs_der.h")
+#include "certs_der.h" // generated by tools/pem_to_der.py
+#endif
 
 #ifndef SECRET
     const char ssid[] = "WiFiSSID";
@@ -152,11 +155,25 @@ void setup()
     Serial.print(asctime(&timeinfo));
 
     #ifdef CHECK_CA_ROOT
+      #ifdef DIGICERT_DER
+        BearSSL::X509List cert;
+        const uint8_t *der = digicert_der;
+        for (size_t i = 0; i < digicert_der_count; i++) // one or more certificates, back to back
+        {
+            cert.append(der, digicert_der_sizes[i]);
+            der += digicert_der_sizes[i];
+        }
+      #else
         BearSSL::X509List cert(digicert);
+      #endif
         net.setTrustAnchors(&cert);
     #endif
     #ifdef CHECK_PUB_KEY
+      #ifdef PUBKEY_DER
+        BearSSL::PublicKey key(pubkey_der, pubkey_der_len);
+      #else
         BearSSL::PublicKey key(pubkey);
+      #endif
         net.setKnownKey(&key);
     #endif
     #ifdef CHECK_FINGERPRINT
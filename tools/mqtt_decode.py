@@ -0,0 +1,251 @@
+"""Decode sensor payloads published by the ESP32 sketch into CSV.
+
+Reads one payload per line, as printed by mosquitto_sub. Binary formats
+(TELEMETRY_FORMAT_CBOR, TELEMETRY_FORMAT_PACKED) need hex output:
+
+    mosquitto_sub -h broker -p 8883 --cafile ca.crt -t 'home/+/out/#' -F %x | \\
+        python tools/mqtt_decode.py
+
+Archived Gorilla blocks arrive on the out/gorilla subtopic, the '#' picks
+them up along with the regular payloads.
+
+A payload holds a single record or a batch (BATCH_PUBLISH) in any of the
+formats described in src/telemetry/telemetry.h; every record comes out as
+one CSV row.
+"""
+
+import argparse
+import csv
+import json
+import re
+import struct
+import sys
+
+FIELDS = ["timestamp", "temperature", "humidity", "pressure", "gasResistance"]
+
+PACKED_MAGIC = ord("P")
+PACKED_VERSION = 1
+PACKED_HEADER = struct.Struct("<BBH")
+PACKED_RECORD = struct.Struct("<Iffff")
+
+GORILLA_MAGIC = ord("G")
+GORILLA_VERSION = 1
+
+HEX_RE = re.compile(r"^(?:[0-9a-fA-F]{2})+$")
+
+
+def float32(value):
+    """Shortest decimal that maps back to the same float32. NaN marks a
+    field that wasn't measured and comes out empty."""
+    if value != value:
+        return None
+    for digits in range(6, 9):
+        short = float("%.*g" % (digits, value))
+        if struct.pack("<f", short) == struct.pack("<f", value):
+            return short
+    return value
+
+
+class CborReader:
+    """Just enough CBOR for the telemetry encoder: ints, floats, strings,
+    arrays and maps, definite or indefinite length."""
+
+    BREAK = object()
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, n):
+        if self.pos + n > len(self.data):
+            raise ValueError("truncated CBOR")
+        chunk = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return chunk
+
+    def argument(self, info):
+        if info < 24:
+            return info
+        if info == 31:
+            return None
+        sizes = {24: 1, 25: 2, 26: 4, 27: 8}
+        if info not in sizes:
+            raise ValueError("bad CBOR length %d" % info)
+        return int.from_bytes(self.take(sizes[info]), "big")
+
+    def item(self):
+        initial = self.take(1)[0]
+        major, info = initial >> 5, initial & 0x1f
+        if initial == 0xff:
+            return self.BREAK
+        if major == 7:
+            if info == 25:
+                return struct.unpack(">e", self.take(2))[0]
+            if info == 26:
+                return float32(struct.unpack(">f", self.take(4))[0])
+            if info == 27:
+                return struct.unpack(">d", self.take(8))[0]
+            return {20: False, 21: True, 22: None}.get(info)
+        n = self.argument(info)
+        if major == 0:
+            return n
+        if major == 1:
+            return -1 - n
+        if major in (2, 3):
+            raw = self.take(n)
+            return raw.decode("utf-8") if major == 3 else raw
+        if major == 4:
+            return self.items(n)
+        if major == 5:
+            values = self.items(None if n is None else 2 * n)
+            return dict(zip(values[::2], values[1::2]))
+        raise ValueError("unsupported CBOR type %d" % major)
+
+    def items(self, n):
+        values = []
+        while n is None or len(values) < n:
+            value = self.item()
+            if value is self.BREAK:
+                if n is not None:
+                    raise ValueError("unexpected CBOR break")
+                break
+            values.append(value)
+        return values
+
+
+def decode_cbor(data):
+    reader = CborReader(data)
+    value = reader.item()
+    records = value if isinstance(value, list) else [value]
+    if not all(isinstance(r, dict) for r in records):
+        raise ValueError("not a sensor record or batch")
+    return [{FIELDS[k]: v for k, v in r.items() if isinstance(k, int) and k < len(FIELDS)} for r in records]
+
+
+def decode_packed(data):
+    if len(data) < PACKED_HEADER.size:
+        raise ValueError("truncated packed header")
+    _, version, count = PACKED_HEADER.unpack_from(data)
+    if version != PACKED_VERSION:
+        raise ValueError("unknown packed version %d" % version)
+    if len(data) != PACKED_HEADER.size + count * PACKED_RECORD.size:
+        raise ValueError("packed length doesn't match %d records" % count)
+    records = []
+    for i in range(count):
+        values = PACKED_RECORD.unpack_from(data, PACKED_HEADER.size + i * PACKED_RECORD.size)
+        records.append(dict(zip(FIELDS, values[:1] + tuple(float32(v) for v in values[1:]))))
+    return records
+
+
+class BitReader:
+    def __init__(self, data, pos):
+        self.data = data
+        self.bit = pos * 8
+
+    def read(self, count):
+        if self.bit + count > len(self.data) * 8:
+            raise ValueError("truncated Gorilla stream")
+        value = 0
+        for _ in range(count):
+            value = (value << 1) | ((self.data[self.bit >> 3] >> (7 - (self.bit & 7))) & 1)
+            self.bit += 1
+        return value
+
+
+def signed32(value):
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def decode_gorilla(data):
+    """Inverse of GorillaTelemetryEncoder, see gorilla.cpp for the layout."""
+    if len(data) < PACKED_HEADER.size:
+        raise ValueError("truncated Gorilla header")
+    _, version, count = PACKED_HEADER.unpack_from(data)
+    if version != GORILLA_VERSION:
+        raise ValueError("unknown Gorilla version %d" % version)
+
+    reader = BitReader(data, PACKED_HEADER.size)
+    records = []
+    timestamp = delta = 0
+    values = [0] * 4
+    leading = [0] * 4
+    trailing = [0] * 4
+    for i in range(count):
+        if i == 0:
+            timestamp = reader.read(32)
+            values = [reader.read(32) for _ in range(4)]
+        else:
+            if reader.read(1) == 0:
+                dod = 0
+            elif reader.read(1) == 0:
+                dod = reader.read(7) - 63
+            elif reader.read(1) == 0:
+                dod = reader.read(9) - 255
+            elif reader.read(1) == 0:
+                dod = reader.read(12) - 2047
+            else:
+                dod = signed32(reader.read(32))
+            delta = signed32((delta + dod) & 0xffffffff)
+            timestamp = (timestamp + delta) & 0xffffffff
+            for f in range(4):
+                if reader.read(1) == 0:
+                    continue
+                if reader.read(1) == 1:
+                    leading[f] = reader.read(5)
+                    trailing[f] = 32 - leading[f] - (reader.read(5) + 1)
+                    if trailing[f] < 0:
+                        raise ValueError("bad Gorilla window")
+                values[f] ^= reader.read(32 - leading[f] - trailing[f]) << trailing[f]
+        floats = struct.unpack("<4f", struct.pack("<4I", *values))
+        records.append(dict(zip(FIELDS, [timestamp] + [float32(v) for v in floats])))
+    return records
+
+
+def decode_json(data):
+    value = json.loads(data.decode("utf-8"))
+    records = value if isinstance(value, list) else [value]
+    if not all(isinstance(r, dict) for r in records):
+        raise ValueError("not a sensor record or batch")
+    return records
+
+
+def decode_payload(payload):
+    """Returns the list of records (dicts) contained in one payload."""
+    if isinstance(payload, str):
+        payload = payload.encode("utf-8")
+    if not payload:
+        raise ValueError("empty payload")
+    first = payload[0]
+    if first in b"[{":
+        return decode_json(payload)
+    if first == PACKED_MAGIC:
+        return decode_packed(payload)
+    if first == GORILLA_MAGIC:
+        return decode_gorilla(payload)
+    if first >> 5 in (4, 5):
+        return decode_cbor(payload)
+    raise ValueError("unknown payload format")
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    args = parser.parse_args(argv)
+
+    writer = csv.DictWriter(sys.stdout, FIELDS, extrasaction="ignore")
+    writer.writeheader()
+    for line in args.input:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            records = decode_payload(bytes.fromhex(line) if HEX_RE.match(line) else line)
+        except ValueError as e:
+            print("mqtt_decode: skipping payload: %s" % e, file=sys.stderr)
+            continue
+        writer.writerows(records)
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,127 @@
+"""Convert PEM certificates/keys into DER byte arrays for the sketches.
+
+Runs either as a PlatformIO extra script:
+
+    extra_scripts = pre:../tools/pem_to_der.py
+    custom_der_certs =
+        local_root_ca = certs/ca.crt
+        client_key = certs/client.key
+
+or stand-alone on the host:
+
+    python tools/pem_to_der.py -o certs_der.h local_root_ca=certs/ca.crt
+
+For every NAME=FILE pair the generated header contains `NAME_der[]`,
+`NAME_der_len` and a `NAME_DER` define the sketches can test for.
+
+A certificate file may hold a chain: all its certificates are converted
+and stored back to back, `NAME_der_count` and `NAME_der_sizes[]` tell them
+apart. Any other file must contain exactly one PEM block.
+"""
+
+import argparse
+import base64
+import os
+import re
+import sys
+
+PEM_RE = re.compile(r"-----BEGIN ([A-Z0-9 ]+)-----(.*?)-----END \1-----", re.S)
+
+
+def pem_to_der(text, path):
+    """Returns the DER of every PEM block in text, in file order."""
+    matches = list(PEM_RE.finditer(text))
+    if not matches:
+        raise ValueError("%s: no PEM block found" % path)
+    if len(matches) > 1 and any(m.group(1) != "CERTIFICATE" for m in matches):
+        raise ValueError("%s: %d PEM blocks, only certificate chains may have more than one" % (path, len(matches)))
+    ders = []
+    for match in matches:
+        if "ENCRYPTED" in match.group(1) or "Proc-Type:" in match.group(2):
+            raise ValueError("%s: encrypted keys are not supported" % path)
+        body = "".join(line.strip() for line in match.group(2).splitlines())
+        ders.append(base64.b64decode(body))
+    return ders
+
+
+def c_array(name, ders):
+    der = b"".join(ders)
+    lines = ["static const uint8_t %s_der[] PROGMEM = {" % name]
+    for i in range(0, len(der), 16):
+        lines.append("    " + ", ".join("0x%02x" % b for b in der[i:i + 16]) + ",")
+    lines.append("};")
+    lines.append("static const size_t %s_der_len = %d;" % (name, len(der)))
+    lines.append("static const size_t %s_der_count = %d;" % (name, len(ders)))
+    lines.append("static const size_t %s_der_sizes[] = { %s };" % (name, ", ".join(str(len(d)) for d in ders)))
+    lines.append("#define %s_DER" % name.upper())
+    return "\n".join(lines)
+
+
+def generate(pairs, base_dir, output):
+    blocks = []
+    for name, path in pairs:
+        if not re.match(r"^[A-Za-z_][A-Za-z0-9_]*$", name):
+            raise ValueError("invalid symbol name '%s'" % name)
+        full = os.path.join(base_dir, path)
+        with open(full) as f:
+            ders = pem_to_der(f.read(), path)
+        blocks.append(c_array(name, ders))
+
+    content = "\n".join([
+        "// Generated by tools/pem_to_der.py - do not edit",
+        "#ifndef CERTS_DER_H",
+        "#define CERTS_DER_H",
+        "#include <Arduino.h>",
+        "",
+        "#define CERTS_DER",
+        "",
+        "\n\n".join(blocks),
+        "",
+        "#endif",
+        "",
+    ])
+
+    # Only touch the header when it changes, so the sketch isn't rebuilt every time
+    if os.path.exists(output):
+        with open(output) as f:
+            if f.read() == content:
+                return
+    with open(output, "w") as f:
+        f.write(content)
+    print("pem_to_der: wrote %s (%d entries)" % (output, len(pairs)))
+
+
+def parse_pairs(items):
+    pairs = []
+    for item in items:
+        item = item.strip()
+        if not item:
+            continue
+        name, sep, path = item.partition("=")
+        if not sep:
+            raise ValueError("expected NAME=FILE, got '%s'" % item)
+        pairs.append((name.strip(), path.strip()))
+    return pairs
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-o", "--output", default="certs_der.h")
+    parser.add_argument("-C", "--base-dir", default=".")
+    parser.add_argument("certs", nargs="+", metavar="NAME=FILE")
+    args = parser.parse_args(argv)
+    generate(parse_pairs(args.certs), args.base_dir, args.output)
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+except NameError:
+    env = None
+
+if env is not None:
+    pairs = parse_pairs(env.GetProjectOption("custom_der_certs", "").splitlines())
+    if pairs:
+        generate(pairs, env.subst("$PROJECT_DIR"),
+                 os.path.join(env.subst("$PROJECT_SRC_DIR"), "certs_der.h"))
+elif __name__ == "__main__":
+    main(sys.argv[1:])